@@ -0,0 +1,1949 @@
+/* Name: bootloadhid.c
+ * Project: AVR bootloader HID
+ * Tabsize: 4
+ * License: Proprietary, free under certain conditions. See Documentation.
+ *
+ * For: usbXR project: https://github.com/visakhanc/usbXR
+ * Upload engine of bootloadHID, formerly in main.c (Christian Starkjohann,
+ * Visakhan C), rewritten as a reentrant state machine.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include <ctype.h>
+#include <sys/stat.h>
+
+#ifdef WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#endif
+
+#include "bootloadhid.h"
+#include "../firmware/bootloader_defs.h"
+#include "../../firmware/bridge_defs.h"
+
+
+#define IDENT_VENDOR_NUM        	0x16c0
+#define IDENT_VENDOR_STRING     	"obdev.at"
+#define IDENT_PRODUCT_NUM       	1503
+#define IDENT_PRODUCT_STRING    	"HIDBoot"
+#define IDENT_PRODUCT_STRING_REM    "usbXR Sensor"
+#define IDENT_PRODUCT_STRING_REM2   "HIDBoot Remote"
+#define IDENT_BRIDGE_STRING         "usbXR Bridge"
+
+#define MAX_BLOCK_SIZE  4096    /* largest long transfer block we support */
+#define REMOTE_RETRIES  5       /* per block and command */
+#define REMOTE_POLLS    50      /* device info polls, 200 ms apart */
+#define REBOOT_POLLS    50      /* HIDBoot opens after resetting the bridge, 100 ms apart */
+#define MIN_PAGE_SIZE   32      /* smallest flash page of devices with CRCs */
+#define MAX_UNITS       (BOOT_IMAGE_SIZE / 128) /* upload units, see unitSize */
+#define CACHE_MAGIC     "bootloadhid-cache 1"
+#define CRC_POLLS       10      /* polls for a remote page CRC reply, 5 ms apart */
+#define MAX_CRC_RANGES  64      /* stack of address ranges to query */
+#define SESSION_POLLS   500     /* session status polls while the relay waits, 50 ms apart */
+#define SESSION_STALLS  5000    /* stalled data blocks (relay queue full), 2 ms apart */
+#define BATCH_POLLS     100     /* batch status polls until all packets are done, 2 ms apart */
+#define STATS_REPORT_LEN    39  /* report 9 */
+#define STATS_REPORT_MIN    35  /* without the RAM figures */
+
+/* ------------------------------------------------------------------------- */
+
+struct bootImage {
+    char    data[BOOT_IMAGE_SIZE + 256];    /* padded for the last block */
+    int     startAddr, endAddr;
+    int     checksumErrors;
+};
+
+typedef struct deviceInfo {
+    char    reportId;
+    char    pageSize[2];
+    char    flashSize[4];
+    char    maxBlockSize[2];    /* not reported by older boot loaders */
+    char    flags;              /* DEVINFO_FLAG_*, not reported by older ones */
+    char    bootSize[2];        /* not reported by older ones */
+    char    pagesSkipped[2];    /* DEVINFO_FLAG_SKIP only */
+} deviceInfo_t;
+
+#define DEVICE_INFO_MIN_LEN     7   /* report ID, page size and flash size */
+#define DEVICE_INFO_BLOCK_LEN   9   /* ... and max block size */
+#define DEVICE_INFO_FLAGS_LEN   10  /* ... and flags */
+#define DEVICE_INFO_BOOT_LEN    12  /* ... and boot loader size */
+#define DEVICE_INFO_SKIP_LEN    14  /* ... and unchanged pages skipped */
+#define REMOTE_BOOT_SIZE        2048    /* remote boot loader (ATmega8) */
+
+typedef struct deviceData {
+    char    reportId;
+    char    address[3];
+    char    data[128];
+} deviceData_t;
+
+typedef struct deviceLongData {
+    char    reportId;
+    char    address[3];
+    char    data[MAX_BLOCK_SIZE];
+} deviceLongData_t;
+
+#define CRC_PAGES_PER_REPORT    8   /* BOOTLOADER_CRC_PAGES of the firmware */
+
+typedef struct deviceCrc {
+    char    reportId;
+    char    address[3];
+    char    crc[2 * CRC_PAGES_PER_REPORT];
+} deviceCrc_t;
+
+typedef struct remoteDeviceInfo {
+    uint8_t		reportId;
+    uint8_t 	deviceId;
+    uint8_t 	statusType;
+    uint8_t     devStatus;
+    uint8_t   	pageSizeDiv2;
+    uint8_t   	flashSizeInKB;
+	uint8_t 	_padding[2];
+} remoteDeviceInfo_t;
+
+typedef struct progStatus {
+	uint8_t		reportId;
+	uint8_t 	txStatus;
+    uint8_t 	deviceId;
+    uint8_t 	statusType;
+	uint8_t     devStatus;
+	uint8_t 	_padding[3];
+} progStatus_t;
+
+typedef struct progCommand {
+	uint8_t     reportId;
+    uint8_t     deviceId;
+	uint8_t     cmd;
+	uint8_t     args[5];    /* only forwarded if CMD_OTA_HAS_ARGS(cmd) */
+} progCommand_t;
+
+typedef struct remoteCrcStatus {
+	uint8_t		reportId;
+	uint8_t 	txStatus;
+    uint8_t 	deviceId;
+    uint8_t 	statusType;     /* STATUS_TYPE_PAGECRC */
+	uint8_t     address[2];
+	uint8_t     crc[2];
+} remoteCrcStatus_t;
+
+typedef struct sessionStatus {
+	uint8_t		reportId;       /* 7 */
+	uint8_t		state;          /* SESSION_* */
+	uint8_t		error;          /* SESSION_ERR_* */
+	uint8_t		deviceId;
+	uint8_t		pageSizeDiv2;
+	uint8_t		flashSizeInKB;
+	uint8_t		packets[2];
+	uint8_t		address[3];     /* of the failed block */
+} sessionStatus_t;
+
+typedef struct remoteBatch {
+    char    reportId;           /* 8 */
+    char    address[3];
+    char    mask[2];            /* packets to send */
+    char    data[OTA_BATCH_SIZE];
+} remoteBatch_t;
+
+typedef struct batchStatus {
+	uint8_t		reportId;       /* 8 */
+	uint8_t		address[3];
+	uint8_t		pending;        /* packets not finished yet */
+	uint8_t		acked[2];       /* bit i: packet i acknowledged */
+} batchStatus_t;
+
+typedef struct remoteDeviceData {
+    char    reportId;
+    char    address[3];
+    char    data[16];
+} remoteDeviceData_t;
+
+/* Session states. Remote states send a report, wait and check the status
+ * report; the exchange is retried REMOTE_RETRIES times.
+ */
+enum {
+    ST_IDLE = 0,
+    ST_OPEN,
+    ST_INFO,            /* local: read page and flash size */
+    ST_CRC,             /* local: read page CRCs before or after upload */
+    ST_DATA,            /* local: upload one block */
+    ST_LEAVE,           /* local: start application */
+    ST_REBOOT,          /* local: wait until the reset bridge comes back as HIDBoot */
+    ST_WAIT_BOOT_REQ,   /* remote: wait for any boot request */
+    ST_START,           /* remote: send START through ACK payload */
+    ST_WAIT_READY,      /* remote: wait until remote is ready */
+    ST_TXMODE,          /* remote: switch relay to transmit mode */
+    ST_XFER_SEND,       /* remote: send data block or command */
+    ST_XFER_CHECK,      /* remote: read transmit status */
+    ST_SESSION_BEGIN,   /* remote: relay waits for the remote itself */
+    ST_SESSION_WAIT,    /* remote: poll session status until ready */
+    ST_SESSION_CHECK,   /* remote: poll session status until STOP/RESET is done */
+    ST_END,             /* remote: restore relay state */
+    ST_CLOSE,
+    ST_FINISHED,
+};
+
+/* what the current remote exchange (ST_XFER_*) transfers */
+enum {
+    XFER_DATA = 0,
+    XFER_STOP,
+    XFER_RESET,
+    XFER_CRC_QUERY,     /* CMD_OTA_BOOT_PAGECRC for crcAddr, crcLen */
+    XFER_CRC_POLL,      /* CMD_OTA_BOOT_POLL until the CRC arrives */
+};
+
+/* sources of the information which pages are unchanged, see planUpload() */
+enum {
+    PLAN_CACHE = 0,
+    PLAN_PAGE_CRCS,     /* local: CRC of every page in deviceCrc[] */
+    PLAN_RANGE_CRCS,    /* remote: matching units in unitMatch[] */
+};
+
+struct bootSession {
+    bootOptions_t       options;
+    bootEventCallback_t callback;
+    void                *context;
+    const bootImage_t   *image;
+    usbDevice_t         *device;
+    int                 deviceAttached; /* device belongs to the caller */
+    bootDeviceInfo_t    info;
+    int                 haveInfo;
+    int                 state;
+    int                 result;
+    int                 cancelled;
+    long                nextTime;       /* when the current state is due */
+    int                 retry;
+    int                 xfer;
+    int                 startAddr, endAddr, currentAddr, total;
+    int                 pageSize, deviceSize, blockSize;
+    int                 bootSize;       /* end of the flash taken by the boot loader */
+    int                 remoteId;
+    int                 session;        /* relay runs the handshake and retries */
+    int                 batch;          /* relay takes OTA_BATCH_SIZE bytes per report */
+    int                 batchMask;      /* packets of the batch not acknowledged yet */
+    int                 statusIn;       /* relay sends report 3 on the interrupt endpoint */
+    int                 appReboot;      /* relay can page the running application */
+    long                statusTime;     /* ... we read it with GET_REPORT after this */
+    int                 unitSize;       /* pages are skipped in units of this */
+    int                 uploading;      /* data transfer has begun */
+    int                 verifying;      /* ST_CRC reads back after upload */
+    int                 crcAddr;
+    int                 crcLen;         /* remote: length of the queried range */
+    int                 remoteCrc;      /* remote answers CRC queries: 1 yes, -1 no */
+    int                 polls;
+    int                 crcTop;
+    int                 crcRanges[MAX_CRC_RANGES][2];
+    unsigned char       unitMatch[MAX_UNITS];
+    unsigned short      deviceCrc[BOOT_IMAGE_SIZE / MIN_PAGE_SIZE];
+    unsigned char       skip[MAX_UNITS];
+    char                cacheKey[80];
+    int                 cacheUnitSize;
+    unsigned char       cacheValid[MAX_UNITS];
+    unsigned long long  cacheHash[MAX_UNITS];
+    int                 resumeAddr;     /* checkpoint, 0 = none */
+    unsigned long long  resumeHash;     /* hash of the image it belongs to */
+    union {
+        char                bytes[1];
+        deviceInfo_t        info;
+        deviceCrc_t         crc;
+        deviceData_t        data;
+        deviceLongData_t    longData;
+        remoteDeviceData_t  progData;
+        progCommand_t       progCommand;
+        remoteBatch_t       batch;
+    } txBuffer;
+    union {
+        char                bytes[1];
+        deviceInfo_t        info;
+        deviceCrc_t         crc;
+        remoteDeviceInfo_t  devInfo;
+        progStatus_t        progStatus;
+        remoteCrcStatus_t   crcStatus;
+        sessionStatus_t     session;
+        batchStatus_t       batch;
+    } replyBuffer;
+    char                message[256];
+};
+
+/* ------------------------------------------------------------------------- */
+
+static long timeMs(void)
+{
+#ifdef WIN32
+    return (long)GetTickCount();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+#endif
+}
+
+static void sleep_ms(int milliseconds) // cross-platform sleep function
+{
+    if(milliseconds <= 0)
+        return;
+#ifdef WIN32
+    Sleep(milliseconds);
+#elif _POSIX_C_SOURCE >= 199309L
+    struct timespec ts;
+    ts.tv_sec = milliseconds / 1000;
+    ts.tv_nsec = (milliseconds % 1000) * 1000000;
+    nanosleep(&ts, NULL);
+#else
+    usleep(milliseconds * 1000);
+#endif
+}
+
+/* ------------------------------------------------------------------------- */
+
+static int  parseUntilColon(FILE *fp)
+{
+int c;
+
+    do{
+        c = getc(fp);
+    }while(c != ':' && c != EOF);
+    return c;
+}
+
+static int  parseHex(FILE *fp, int numDigits)
+{
+int     i;
+char    temp[9];
+
+    for(i = 0; i < numDigits; i++)
+        temp[i] = getc(fp);
+    temp[i] = 0;
+    return strtol(temp, NULL, 16);
+}
+
+bootImage_t *bootImageNew(void)
+{
+bootImage_t *image = malloc(sizeof(bootImage_t));
+
+    if(image != NULL){
+        memset(image->data, -1, sizeof(image->data));
+        image->startAddr = BOOT_IMAGE_SIZE;
+        image->endAddr = 0;
+        image->checksumErrors = 0;
+    }
+    return image;
+}
+
+void    bootImageFree(bootImage_t *image)
+{
+    free(image);
+}
+
+int bootImageLoadHex(bootImage_t *image, const char *fileName)
+{
+int     address, base, d, segment, i, lineLen, sum;
+FILE    *input;
+
+    input = fopen(fileName, "r");
+    if(input == NULL)
+        return BOOT_ERROR_FILE;
+    while(parseUntilColon(input) == ':'){
+        sum = 0;
+        sum += lineLen = parseHex(input, 2);
+        base = address = parseHex(input, 4);
+        sum += address >> 8;
+        sum += address;
+        sum += segment = parseHex(input, 2);  /* segment value? */
+        if(segment != 0)    /* ignore lines where this byte is not 0 */
+            continue;
+        for(i = 0; i < lineLen ; i++){
+            d = parseHex(input, 2);
+            image->data[address++] = d;
+            sum += d;
+        }
+        sum += parseHex(input, 2);
+        if((sum & 0xff) != 0)
+            image->checksumErrors++;
+        if(image->startAddr > base)
+            image->startAddr = base;
+        if(image->endAddr < address)
+            image->endAddr = address;
+    }
+    fclose(input);
+    return 0;
+}
+
+int bootImageChecksumErrors(const bootImage_t *image)
+{
+    return image->checksumErrors;
+}
+
+int bootImageRange(const bootImage_t *image, int *startAddr, int *endAddr)
+{
+    *startAddr = image->startAddr;
+    *endAddr = image->endAddr;
+    return image->startAddr < image->endAddr;
+}
+
+const char *bootImageData(const bootImage_t *image)
+{
+    return image->data;
+}
+
+/* ------------------------------------------------------------------------- */
+
+const char *bootErrorMessage(int errCode)
+{
+    switch(errCode){
+        case 0:                         return "No error";
+        case USB_ERROR_ACCESS:          return "Access to device denied";
+        case USB_ERROR_NOTFOUND:        return "The specified device was not found";
+        case USB_ERROR_BUSY:            return "The device is used by another application";
+        case USB_ERROR_IO:              return "Communication error with device";
+        case USB_ERROR_STALL:           return "Request refused by device";
+        case BOOT_ERROR_DEVICE:         return "Unexpected answer from device";
+        case BOOT_ERROR_SIZE:           return "Data exceeds remaining flash size";
+        case BOOT_ERROR_TIMEOUT:        return "No response from remote device";
+        case BOOT_ERROR_PROGRAMMING:    return "Remote device did not accept data";
+        case BOOT_ERROR_CANCELLED:      return "Cancelled";
+        case BOOT_ERROR_FILE:           return "Cannot read file";
+        case BOOT_ERROR_MEMORY:         return "Out of memory";
+        case BOOT_ERROR_VERIFY:         return "Flash contents differ from image";
+        default:                        return "Unknown error";
+    }
+}
+
+static int  getUsbInt(char *buffer, int numBytes)
+{
+int shift = 0, value = 0, i;
+
+    for(i = 0; i < numBytes; i++){
+        value |= ((int)*buffer & 0xff) << shift;
+        shift += 8;
+        buffer++;
+    }
+    return value;
+}
+
+static void setUsbInt(char *buffer, int value, int numBytes)
+{
+int i;
+
+    for(i = 0; i < numBytes; i++){
+        *buffer++ = value;
+        value >>= 8;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void emit(bootSession_t *s, bootEvent_t *event)
+{
+    event->remoteId = s->remoteId;
+    event->done = s->currentAddr - s->startAddr;
+    event->total = s->endAddr - s->startAddr;
+    if(s->callback != NULL)
+        s->callback(s, event, s->context);
+}
+
+static void emitMessage(bootSession_t *s, int type, const char *format, ...)
+{
+bootEvent_t event;
+va_list     args;
+
+    va_start(args, format);
+    vsnprintf(s->message, sizeof(s->message), format, args);
+    va_end(args);
+    memset(&event, 0, sizeof(event));
+    event.type = type;
+    event.message = s->message;
+    emit(s, &event);
+}
+
+static void emitAddress(bootSession_t *s, int type, int address, int length)
+{
+bootEvent_t event;
+
+    memset(&event, 0, sizeof(event));
+    event.type = type;
+    event.address = address;
+    event.length = length;
+    emit(s, &event);
+}
+
+static void emitDevice(bootSession_t *s)
+{
+bootEvent_t event;
+
+    memset(&event, 0, sizeof(event));
+    event.type = BOOT_EVENT_DEVICE;
+    event.pageSize = s->pageSize;
+    event.flashSize = s->deviceSize;
+    event.bootSize = s->bootSize;
+    event.blockSize = s->blockSize;
+    event.flags = s->info.flags;
+    emit(s, &event);
+}
+
+static void setState(bootSession_t *s, int state, int delayMs)
+{
+    s->state = state;
+    s->nextTime = timeMs() + delayMs;
+}
+
+/* Records the error and continues with the cleanup state for the mode. */
+static void fail(bootSession_t *s, int err)
+{
+    if(s->result == 0)
+        s->result = err;
+    if(s->options.remote && s->device != NULL && s->state != ST_END){
+        setState(s, ST_END, 200);
+    }else{
+        setState(s, ST_CLOSE, 0);
+    }
+}
+
+/* Rounds the upload range to full pages and checks it against the flash
+ * size minus the boot loader.
+ */
+static int  checkRange(bootSession_t *s)
+{
+int mask;
+
+    if(s->endAddr > s->deviceSize - s->bootSize){
+        emitMessage(s, BOOT_EVENT_ERROR, "Data (%d bytes) exceeds remaining flash size!", s->endAddr);
+        return BOOT_ERROR_SIZE;
+    }
+    if(s->pageSize < 128) {
+        mask = 127;
+    } else {
+        mask = s->pageSize - 1;
+    }
+    s->startAddr &= ~mask;                      /* round down */
+    s->endAddr = (s->endAddr + mask) & ~mask;   /* round up */
+    s->currentAddr = s->startAddr;
+    s->unitSize = mask + 1;
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+#ifdef WIN32
+#   define makeDir(path)    mkdir(path)
+#else
+#   define makeDir(path)    mkdir(path, 0755)
+#endif
+
+/* CRC-16 as computed by _crc16_update() of avr-libc, start value 0xffff */
+static unsigned pageCrc(const char *data, int len)
+{
+unsigned    crc = 0xffff;
+int         i;
+
+    while(len--){
+        crc ^= *data++ & 0xff;
+        for(i = 0; i < 8; i++)
+            crc = (crc & 1) ? (crc >> 1) ^ 0xa001 : crc >> 1;
+    }
+    return crc;
+}
+
+/* 64 bit FNV-1a hash of a unit, for the flash-state cache */
+static unsigned long long unitHash(const char *data, int len)
+{
+unsigned long long  hash = 0xcbf29ce484222325ULL;
+
+    while(len--){
+        hash ^= *data++ & 0xff;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+const char *bootCacheDir(void)
+{
+static char dir[512];
+const char  *base;
+
+#ifdef WIN32
+    if((base = getenv("LOCALAPPDATA")) != NULL){
+        snprintf(dir, sizeof(dir), "%s/bootloadhid", base);
+        return dir;
+    }
+#else
+    if((base = getenv("XDG_CACHE_HOME")) != NULL && base[0] != 0){
+        snprintf(dir, sizeof(dir), "%s/bootloadhid", base);
+        return dir;
+    }
+    if((base = getenv("HOME")) != NULL){
+        snprintf(dir, sizeof(dir), "%s/.cache/bootloadhid", base);
+        return dir;
+    }
+#endif
+    return NULL;
+}
+
+/* Creates 'path' and its parents if they don't exist yet. */
+static void makeDirs(const char *path)
+{
+char    buffer[512];
+int     i;
+
+    snprintf(buffer, sizeof(buffer), "%s", path);
+    for(i = 1; buffer[i] != 0; i++){
+        if(buffer[i] == '/' || buffer[i] == '\\'){
+            char c = buffer[i];
+            buffer[i] = 0;
+            makeDir(buffer);
+            buffer[i] = c;
+        }
+    }
+    makeDir(buffer);
+}
+
+/* The cache key is the USB serial number of a local boot loader or the ID of
+ * a remote device. Local boot loaders without serial number cannot be told
+ * apart: a shared entry would let a second board flashed with the same image
+ * be taken as up to date. They get no key and no cache; the usbXR boot loader
+ * reports page CRCs instead.
+ */
+static void setCacheKey(bootSession_t *s)
+{
+char    serial[64];
+char    *p;
+
+    if(s->options.remote){
+        snprintf(s->cacheKey, sizeof(s->cacheKey), "remote-%02x", s->remoteId);
+    }else if(usbGetSerialNumber(s->device, serial, sizeof(serial)) == 0){
+        snprintf(s->cacheKey, sizeof(s->cacheKey), "hidboot-%s", serial);
+    }else{
+        s->cacheKey[0] = 0;
+        if(!(s->info.flags & DEVINFO_FLAG_PAGE_CRC))
+            emitMessage(s, BOOT_EVENT_MESSAGE, "Device has no serial number, uploading all pages");
+    }
+    for(p = s->cacheKey; *p != 0; p++){
+        if(!isalnum((unsigned char)*p) && *p != '-')
+            *p = '_';
+    }
+}
+
+static int  cachePath(bootSession_t *s, char *path, int len)
+{
+const char  *dir = s->options.cacheDir != NULL ? s->options.cacheDir : bootCacheDir();
+
+    if(dir == NULL || s->cacheKey[0] == 0)
+        return 0;
+    snprintf(path, len, "%s/%s", dir, s->cacheKey);
+    return 1;
+}
+
+static void loadCache(bootSession_t *s)
+{
+char        path[600], line[128];
+unsigned    addr, hi, lo, unitSize;
+FILE        *fp;
+
+    memset(s->cacheValid, 0, sizeof(s->cacheValid));
+    s->resumeAddr = 0;
+    if(!cachePath(s, path, sizeof(path)) || (fp = fopen(path, "r")) == NULL)
+        return;
+    if(fgets(line, sizeof(line), fp) != NULL && strncmp(line, CACHE_MAGIC, strlen(CACHE_MAGIC)) == 0
+       && fgets(line, sizeof(line), fp) != NULL && sscanf(line, "unit %u", &unitSize) == 1 && unitSize == s->unitSize){
+        while(fgets(line, sizeof(line), fp) != NULL){
+            if(sscanf(line, "%x %8x%8x", &addr, &hi, &lo) == 3 && addr % unitSize == 0 && addr < BOOT_IMAGE_SIZE){
+                s->cacheHash[addr / unitSize] = ((unsigned long long)hi << 32) | lo;
+                s->cacheValid[addr / unitSize] = 1;
+            }else if(sscanf(line, "resume %x %8x%8x", &addr, &hi, &lo) == 3 && addr % unitSize == 0){
+                s->resumeAddr = addr;
+                s->resumeHash = ((unsigned long long)hi << 32) | lo;
+            }
+        }
+    }
+    fclose(fp);
+}
+
+/* Updates the cache entry of the device. Before the upload, the units which
+ * are about to be written are removed ('success' == 0), so that an aborted
+ * upload leaves no stale hashes. After a successful upload, all units of the
+ * image are entered.
+ */
+static void saveCache(bootSession_t *s, int success)
+{
+char        path[600], tmpPath[610];
+const char  *dir = s->options.cacheDir != NULL ? s->options.cacheDir : bootCacheDir();
+int         addr, i;
+FILE        *fp;
+
+    for(addr = s->startAddr, i = 0; addr < s->endAddr; addr += s->unitSize, i++){
+        if(success){
+            s->cacheHash[addr / s->unitSize] = unitHash(s->image->data + addr, s->unitSize);
+            s->cacheValid[addr / s->unitSize] = 1;
+        }else if(!s->skip[i]){
+            s->cacheValid[addr / s->unitSize] = 0;
+        }
+    }
+    if(!cachePath(s, path, sizeof(path)))
+        return;
+    makeDirs(dir);
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+    if((fp = fopen(tmpPath, "w")) == NULL){
+        emitMessage(s, BOOT_EVENT_MESSAGE, "Warning: cannot write cache %s: %s", tmpPath, strerror(errno));
+        return;
+    }
+    fprintf(fp, "%s\nunit %d\n", CACHE_MAGIC, s->unitSize);
+    if(s->resumeAddr > 0)
+        fprintf(fp, "resume %05x %08x%08x\n", s->resumeAddr, (unsigned)(s->resumeHash >> 32), (unsigned)s->resumeHash);
+    for(i = 0; i < BOOT_IMAGE_SIZE / s->unitSize; i++){
+        if(s->cacheValid[i])
+            fprintf(fp, "%05x %08x%08x\n", i * s->unitSize, (unsigned)(s->cacheHash[i] >> 32), (unsigned)s->cacheHash[i]);
+    }
+    fclose(fp);
+#ifdef WIN32
+    remove(path);   /* rename() does not replace existing files */
+#endif
+    rename(tmpPath, path);
+}
+
+static unsigned long long imageHash(bootSession_t *s)
+{
+    return unitHash(s->image->data + s->startAddr, s->endAddr - s->startAddr);
+}
+
+/* Records the checkpoint of a failed upload: the units below currentAddr were
+ * acknowledged. A remote acknowledges a packet before it writes the page, so
+ * the last of these units is not counted there.
+ */
+static void saveCheckpoint(bootSession_t *s)
+{
+int addr = s->currentAddr - (s->currentAddr - s->startAddr) % s->unitSize;
+
+    if(s->options.remote)
+        addr -= s->unitSize;
+    if(s->resumeAddr > addr && s->resumeHash == imageHash(s))
+        addr = s->resumeAddr;   /* failed again before reaching the old one */
+    if(addr <= s->startAddr)
+        return;
+    s->resumeAddr = addr;
+    s->resumeHash = imageHash(s);
+    saveCache(s, 0);
+    emitMessage(s, BOOT_EVENT_MESSAGE, "Checkpoint saved, run again with --resume to continue at 0x%05x", addr);
+}
+
+/* Returns 1 if the device CRCs of all pages in the unit at 'addr' match the
+ * image.
+ */
+static int  unitMatchesDevice(bootSession_t *s, int addr)
+{
+int page;
+
+    for(page = addr; page < addr + s->unitSize; page += s->pageSize){
+        if(s->deviceCrc[page / s->pageSize] != pageCrc(s->image->data + page, s->pageSize))
+            return 0;
+    }
+    return 1;
+}
+
+static int  countMismatches(bootSession_t *s)
+{
+int addr, n = 0;
+
+    for(addr = s->startAddr; addr < s->endAddr; addr += s->unitSize){
+        if(!unitMatchesDevice(s, addr))
+            n++;
+    }
+    return n;
+}
+
+/* Decides which units must be uploaded, based on the device CRCs if the
+ * device has reported them, otherwise on the cache. Removes the units to be
+ * written from the cache and positions currentAddr on the first of them.
+ */
+static void planUpload(bootSession_t *s, int plan)
+{
+int addr, i, n = 0, total = 0;
+int haveCrcs = (plan != PLAN_CACHE);
+int resumeAddr = 0;
+
+    if(s->options.resume && !s->options.forceUpload){
+        if(haveCrcs){
+            emitMessage(s, BOOT_EVENT_MESSAGE, "Resuming with the page CRCs of the device");
+        }else if(s->resumeAddr > 0 && s->resumeHash == imageHash(s)){
+            resumeAddr = s->resumeAddr;
+            emitMessage(s, BOOT_EVENT_MESSAGE, "Resuming at 0x%05x", resumeAddr);
+        }else{
+            emitMessage(s, BOOT_EVENT_MESSAGE, "No checkpoint for this image, starting at the beginning");
+        }
+    }
+
+    for(addr = s->startAddr, i = 0; addr < s->endAddr; addr += s->unitSize, i++){
+        s->skip[i] = 0;
+        if(!s->options.forceUpload){
+            if(plan == PLAN_PAGE_CRCS){
+                s->skip[i] = unitMatchesDevice(s, addr);
+            }else if(plan == PLAN_RANGE_CRCS){
+                s->skip[i] = s->unitMatch[i];
+            }else if(addr < resumeAddr){
+                s->skip[i] = 1;
+            }else if(s->cacheValid[addr / s->unitSize]){
+                s->skip[i] = s->cacheHash[addr / s->unitSize] == unitHash(s->image->data + addr, s->unitSize);
+            }
+        }
+        n += s->skip[i];
+        total++;
+    }
+    if(n == total){
+        emitMessage(s, BOOT_EVENT_MESSAGE, "Flash is up to date (%s), nothing to upload", haveCrcs ? "device CRCs" : "cache");
+    }else if(n > 0){
+        emitMessage(s, BOOT_EVENT_MESSAGE, "Skipping %d of %d unchanged pages (%s)", n, total, haveCrcs ? "device CRCs" : "cache");
+    }
+    saveCache(s, 0);
+    s->uploading = 1;
+    s->currentAddr = s->startAddr;
+}
+
+/* Returns 'addr' or, if it starts a unit which is skipped, the start of the
+ * next unit to upload (or endAddr).
+ */
+static int  nextAddress(bootSession_t *s, int addr)
+{
+    while(addr < s->endAddr && (addr - s->startAddr) % s->unitSize == 0 && s->skip[(addr - s->startAddr) / s->unitSize])
+        addr += s->unitSize;
+    return addr;
+}
+
+/* Returns 1 if [addr, addr + len) does not touch any skipped unit. */
+static int  isContiguous(bootSession_t *s, int addr, int len)
+{
+int i;
+
+    for(i = (addr - s->startAddr) / s->unitSize; i <= (addr + len - 1 - s->startAddr) / s->unitSize; i++){
+        if(s->skip[i])
+            return 0;
+    }
+    return 1;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static char *localNames[] = {IDENT_PRODUCT_STRING, IDENT_PRODUCT_STRING_REM2, NULL};
+static char *remoteNames[] = {IDENT_PRODUCT_STRING_REM, IDENT_PRODUCT_STRING_REM2, NULL};
+
+static int  openNamedDevice(usbDevice_t **device, int remote, char **openedName)
+{
+char    **name;
+int     err = USB_ERROR_NOTFOUND;
+
+    for(name = remote ? remoteNames : localNames; *name != NULL; name++){
+        if((err = usbOpenDevice(device, IDENT_VENDOR_NUM, IDENT_VENDOR_STRING, IDENT_PRODUCT_NUM, *name, 1)) == 0){
+            *openedName = *name;
+            return 0;
+        }
+    }
+    *device = NULL;
+    return err;
+}
+
+int bootOpenDevice(usbDevice_t **device, int remote)
+{
+char    *name;
+
+    return openNamedDevice(device, remote, &name);
+}
+
+int bootOpenDeviceRelay(usbDevice_t **device, int remote, int *relay)
+{
+char    *name;
+int     err;
+
+    *relay = 0;
+    if((err = openNamedDevice(device, remote, &name)) == 0)
+        *relay = strcmp(name, IDENT_PRODUCT_STRING_REM2) == 0;
+    return err;
+}
+
+/* 'quiet' suppresses the error message, for polling */
+static int  openDevice(bootSession_t *s, int quiet)
+{
+char    *name;
+int     err;
+
+    if((err = openNamedDevice(&s->device, s->options.remote, &name)) == 0){
+        emitMessage(s, BOOT_EVENT_MESSAGE, "OPENED '%s' (VID:0x%04x PID:0x%04x) device", name, IDENT_VENDOR_NUM, IDENT_PRODUCT_NUM);
+    }else if(!quiet){
+        emitMessage(s, BOOT_EVENT_ERROR, "Error opening %s device: %s", s->options.remote ? "remote HIDBoot" : "HIDBoot", bootErrorMessage(err));
+    }
+    return err;
+}
+
+int bootQueryDeviceInfo(usbDevice_t *device, bootDeviceInfo_t *info)
+{
+deviceInfo_t    reply;
+int             err, len = sizeof(reply);
+
+    if((err = usbGetReport(device, USB_HID_REPORT_TYPE_FEATURE, 1, (char *)&reply, &len)) != 0)
+        return err;
+    if(len < DEVICE_INFO_MIN_LEN)
+        return BOOT_ERROR_DEVICE;
+    info->pageSize = getUsbInt(reply.pageSize, 2);
+    info->flashSize = getUsbInt(reply.flashSize, 4);
+    info->blockSize = sizeof(((deviceData_t *)0)->data);
+    info->flags = 0;
+    if(len >= DEVICE_INFO_BLOCK_LEN){   /* device supports long transfers? */
+        int maxBlockSize = getUsbInt(reply.maxBlockSize, 2);
+        if(maxBlockSize > info->blockSize && maxBlockSize <= MAX_BLOCK_SIZE && (maxBlockSize % info->blockSize) == 0)
+            info->blockSize = maxBlockSize;
+    }
+    if(len >= DEVICE_INFO_FLAGS_LEN)
+        info->flags = reply.flags & 0xff;
+    info->bootSize = 0;
+    if(len >= DEVICE_INFO_BOOT_LEN)
+        info->bootSize = getUsbInt(reply.bootSize, 2);
+    info->pagesSkipped = 0;
+    if(len >= DEVICE_INFO_SKIP_LEN)
+        info->pagesSkipped = getUsbInt(reply.pagesSkipped, 2);
+    if(info->pageSize < MIN_PAGE_SIZE)  /* cannot use CRCs of tiny pages */
+        info->flags &= ~DEVINFO_FLAG_PAGE_CRC;
+    info->reportLen = len;
+    return 0;
+}
+
+/* Returns the next 'numBytes' of a report and advances '*p' */
+static unsigned long statsField(char **p, int numBytes)
+{
+unsigned long   value = (unsigned)getUsbInt(*p, numBytes);
+
+    *p += numBytes;
+    return value;
+}
+
+int bootQueryStats(usbDevice_t *device, bootStats_t *stats)
+{
+char    reply[STATS_REPORT_LEN], *p = reply + 1;
+int     err, len = sizeof(reply);
+
+    if((err = usbGetReport(device, USB_HID_REPORT_TYPE_FEATURE, 9, reply, &len)) != 0)
+        return err;
+    if(len < STATS_REPORT_MIN)
+        return BOOT_ERROR_DEVICE;
+    stats->ticksPerMs = statsField(&p, 2);
+    stats->setReports = statsField(&p, 2);
+    stats->getReports = statsField(&p, 2);
+    stats->pageErases = statsField(&p, 2);
+    stats->pageWrites = statsField(&p, 2);
+    stats->eraseMax = statsField(&p, 2);
+    stats->writeMax = statsField(&p, 2);
+    stats->flashTicks = statsField(&p, 4);
+    stats->txPackets = statsField(&p, 2);
+    stats->txFailed = statsField(&p, 2);
+    stats->txRetransmits = statsField(&p, 2);
+    stats->rxOverwrites = statsField(&p, 2);
+    stats->loops = statsField(&p, 4);
+    stats->loopMin = statsField(&p, 2);
+    stats->loopMax = statsField(&p, 2);
+    stats->ramStatic = stats->stackUnused = 0;
+    if(len >= STATS_REPORT_LEN) {
+        stats->ramStatic = statsField(&p, 2);
+        stats->stackUnused = statsField(&p, 2);
+    }
+    return 0;
+}
+
+int bootClearStats(usbDevice_t *device)
+{
+char    report[STATS_REPORT_LEN] = {9};
+
+    /* Windows wants the length of the descriptor, which depends on the version */
+    if(usbSetReport(device, USB_HID_REPORT_TYPE_FEATURE, report, STATS_REPORT_LEN) == 0)
+        return 0;
+    return usbSetReport(device, USB_HID_REPORT_TYPE_FEATURE, report, STATS_REPORT_MIN);
+}
+
+static int  getStatusReport(bootSession_t *s, int minLen)
+{
+int err, len = sizeof(s->replyBuffer);
+
+    if((err = usbGetReport(s->device, USB_HID_REPORT_TYPE_FEATURE, 3, s->replyBuffer.bytes, &len)) != 0){
+        emitMessage(s, BOOT_EVENT_ERROR, "USBError reading remote status: %s", bootErrorMessage(err));
+        return err;
+    }
+    if(len < minLen){
+        emitMessage(s, BOOT_EVENT_ERROR, "Not enough bytes in status report (%d instead of %d)", len, minLen);
+        return BOOT_ERROR_DEVICE;
+    }
+    return 0;
+}
+
+/* Reads report 3 if the relay has sent it on the interrupt endpoint
+ * (DEVINFO_FLAG_STATUS_IN). Never blocks. Returns 1 if the status is in
+ * replyBuffer, 0 if there is none yet.
+ */
+static int  readStatusInput(bootSession_t *s)
+{
+#ifdef WIN32
+    return 0;   /* usbGetPollHandle() has no descriptor, statusIn is never set */
+#else
+struct pollfd   pfd;
+int             len = sizeof(s->replyBuffer);
+
+    pfd.fd = usbGetPollHandle(s->device);
+    pfd.events = POLLIN;
+    if(pfd.fd < 0 || poll(&pfd, 1, 0) <= 0)
+        return 0;
+    if(usbGetReport(s->device, USB_HID_REPORT_TYPE_INPUT, 3, s->replyBuffer.bytes, &len) != 0)
+        return 0;
+    return len >= (int)sizeof(s->replyBuffer.progStatus) && s->replyBuffer.bytes[0] == 3;
+#endif
+}
+
+/* Sends a command with two 16 bit arguments (ignored by the relay unless
+ * CMD_OTA_HAS_ARGS(cmd)).
+ */
+static int  sendCommandArgs(bootSession_t *s, int cmd, int arg1, int arg2)
+{
+    memset(&s->txBuffer.progCommand, 0, sizeof(s->txBuffer.progCommand));
+    s->txBuffer.progCommand.reportId = 3;
+    s->txBuffer.progCommand.deviceId = s->remoteId;
+    s->txBuffer.progCommand.cmd = cmd;
+    setUsbInt((char *)s->txBuffer.progCommand.args, arg1, 2);
+    setUsbInt((char *)s->txBuffer.progCommand.args + 2, arg2, 2);
+    return usbSetReport(s->device, USB_HID_REPORT_TYPE_FEATURE, s->txBuffer.bytes, sizeof(s->txBuffer.progCommand));
+}
+
+static int  sendCommand(bootSession_t *s, int cmd)
+{
+    return sendCommandArgs(s, cmd, 0, 0);
+}
+
+static int  getSessionStatus(bootSession_t *s)
+{
+int err, len = sizeof(s->replyBuffer);
+
+    if((err = usbGetReport(s->device, USB_HID_REPORT_TYPE_FEATURE, 7, s->replyBuffer.bytes, &len)) != 0){
+        emitMessage(s, BOOT_EVENT_ERROR, "USBError reading session status: %s", bootErrorMessage(err));
+        return err;
+    }
+    if(len < (int)sizeof(s->replyBuffer.session)){
+        emitMessage(s, BOOT_EVENT_ERROR, "Not enough bytes in session status (%d instead of %d)", len, (int)sizeof(s->replyBuffer.session));
+        return BOOT_ERROR_DEVICE;
+    }
+    return 0;
+}
+
+/* Resets a running bridge application into the boot loader (bridge report
+ * 6), unless the boot loader is already there. Returns 0 if the bridge took
+ * the request.
+ */
+static int  rebootBridge(bootSession_t *s)
+{
+usbDevice_t *device;
+char        *name;
+char        report[BRIDGE_BOOT_SIZE] = {BRIDGE_REPORT_BOOT, BRIDGE_BOOT_KEY & 0xff, BRIDGE_BOOT_KEY >> 8};
+int         err;
+
+    if(openNamedDevice(&device, 0, &name) == 0){
+        usbCloseDevice(device);
+        return -1;
+    }
+    if(usbOpenDevice(&device, IDENT_VENDOR_NUM, IDENT_VENDOR_STRING, IDENT_PRODUCT_NUM, IDENT_BRIDGE_STRING, 1) != 0)
+        return -1;
+    err = usbSetReport(device, USB_HID_REPORT_TYPE_FEATURE, report, sizeof(report));
+    usbCloseDevice(device);
+    if(err != 0){   /* older bridge firmware */
+        emitMessage(s, BOOT_EVENT_ERROR, "Cannot reset '%s' into the boot loader: %s", IDENT_BRIDGE_STRING, bootErrorMessage(err));
+        return -1;
+    }
+    emitMessage(s, BOOT_EVENT_MESSAGE, "Reset '%s' into the boot loader, waiting for HIDBoot", IDENT_BRIDGE_STRING);
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void stepOpen(bootSession_t *s)
+{
+bootDeviceInfo_t    relay;
+int                 err;
+
+    if(s->device == NULL && s->options.rebootApp && !s->options.remote && rebootBridge(s) == 0){
+        s->options.leaveBootLoader = 1;     /* back to the application when done */
+        s->retry = REBOOT_POLLS;
+        setState(s, ST_REBOOT, 100);
+        return;
+    }
+    if(s->device == NULL && (err = openDevice(s, 0)) != 0){
+        fail(s, err);
+        return;
+    }
+    if(s->options.verifyOnly && s->options.remote){
+        emitMessage(s, BOOT_EVENT_ERROR, "Verify is not supported for remote devices");
+        fail(s, BOOT_ERROR_DEVICE);
+    }else if(s->endAddr <= s->startAddr){   /* no data to upload */
+        setState(s, s->options.remote ? ST_END : ST_LEAVE, s->options.remote ? 200 : 0);
+    }else if(!s->options.remote){
+        setState(s, ST_INFO, 0);
+    }else{
+        if(bootQueryDeviceInfo(s->device, &relay) == 0){   /* capabilities of the relay */
+            s->session = (relay.flags & DEVINFO_FLAG_SESSION) != 0;
+            s->batch = (relay.flags & DEVINFO_FLAG_BATCH) != 0;
+            s->statusIn = (relay.flags & DEVINFO_FLAG_STATUS_IN) != 0 && usbGetPollHandle(s->device) >= 0;
+            s->appReboot = (relay.flags & DEVINFO_FLAG_APP_REBOOT) != 0;
+        }
+        if(s->session){
+            setState(s, ST_SESSION_BEGIN, 0);
+        }else if(s->remoteId == 0){
+            /* no remote device ID was specified, wait for a boot request */
+            emitMessage(s, BOOT_EVENT_MESSAGE, "WAITING for device info from a remote device");
+            s->retry = REMOTE_POLLS;
+            setState(s, ST_WAIT_BOOT_REQ, 0);
+        }else{
+            setState(s, ST_START, 0);
+        }
+    }
+}
+
+static void stepInfo(bootSession_t *s)
+{
+int err;
+
+    /* the skip counter of a cached info is stale */
+    if(!s->haveInfo || (s->info.flags & DEVINFO_FLAG_SKIP)){
+        if((err = bootQueryDeviceInfo(s->device, &s->info)) != 0){
+            emitMessage(s, BOOT_EVENT_ERROR, "Error reading page size: %s", bootErrorMessage(err));
+            fail(s, err);
+            return;
+        }
+        s->haveInfo = 1;
+    }
+    s->pageSize = s->info.pageSize;
+    s->deviceSize = s->info.flashSize;
+    s->blockSize = s->info.blockSize;
+    s->bootSize = s->info.bootSize;
+    if(s->bootSize == 0)    /* older boot loader: 4 KB on the ATmega328P, 2 KB on the ATmega8 */
+        s->bootSize = s->deviceSize > 8192 ? 4096 : 2048;
+    emitDevice(s);
+    if((err = checkRange(s)) != 0){
+        fail(s, err);
+        return;
+    }
+    setCacheKey(s);
+    loadCache(s);
+    if((s->info.flags & DEVINFO_FLAG_PAGE_CRC) && (!s->options.forceUpload || s->options.verifyOnly)){
+        s->verifying = 0;
+        s->crcAddr = s->startAddr;
+        setState(s, ST_CRC, 0);
+        return;
+    }
+    if(s->options.verifyOnly){  /* device cannot read back, check size only */
+        emitMessage(s, BOOT_EVENT_MESSAGE, "Image of %d (0x%x) bytes fits into device", s->endAddr - s->startAddr, s->endAddr - s->startAddr);
+        setState(s, ST_CLOSE, 0);
+        return;
+    }
+    emitMessage(s, BOOT_EVENT_MESSAGE, "Uploading %d (0x%x) bytes starting at %d (0x%x)", s->endAddr - s->startAddr, s->endAddr - s->startAddr, s->startAddr, s->startAddr);
+    planUpload(s, PLAN_CACHE);
+    setState(s, ST_DATA, 0);
+}
+
+/* Reads the CRCs of CRC_PAGES_PER_REPORT pages per step, before the upload
+ * to find unchanged pages and after it to verify the flash contents.
+ */
+static void stepCrc(bootSession_t *s)
+{
+int err, i, len = sizeof(s->replyBuffer), mismatches;
+
+    memset(&s->txBuffer.crc, 0, sizeof(s->txBuffer.crc));
+    s->txBuffer.crc.reportId = 6;
+    setUsbInt(s->txBuffer.crc.address, s->crcAddr, 3);
+    if((err = usbSetReport(s->device, USB_HID_REPORT_TYPE_FEATURE, s->txBuffer.bytes, sizeof(s->txBuffer.crc))) != 0
+       || (err = usbGetReport(s->device, USB_HID_REPORT_TYPE_FEATURE, 6, s->replyBuffer.bytes, &len)) != 0){
+        emitMessage(s, BOOT_EVENT_ERROR, "Error reading page CRCs: %s", bootErrorMessage(err));
+        fail(s, err);
+        return;
+    }
+    if(len < (int)sizeof(s->replyBuffer.crc) || getUsbInt(s->replyBuffer.crc.address, 3) != s->crcAddr){
+        emitMessage(s, BOOT_EVENT_ERROR, "Unexpected page CRC report at address 0x%05x", s->crcAddr);
+        fail(s, BOOT_ERROR_DEVICE);
+        return;
+    }
+    for(i = 0; i < CRC_PAGES_PER_REPORT && s->crcAddr < BOOT_IMAGE_SIZE; i++){
+        s->deviceCrc[s->crcAddr / s->pageSize] = getUsbInt(s->replyBuffer.crc.crc + 2 * i, 2);
+        s->crcAddr += s->pageSize;
+    }
+    if(s->crcAddr < s->endAddr)
+        return;     /* next step reads the next pages */
+    if(s->verifying || s->options.verifyOnly){
+        if((mismatches = countMismatches(s)) != 0){
+            emitMessage(s, BOOT_EVENT_ERROR, "Verify failed: %d of %d pages differ from image", mismatches, (s->endAddr - s->startAddr) / s->unitSize);
+            fail(s, BOOT_ERROR_VERIFY);
+            return;
+        }
+        emitMessage(s, BOOT_EVENT_MESSAGE, "Verified %d (0x%x) bytes", s->endAddr - s->startAddr, s->endAddr - s->startAddr);
+        setState(s, s->options.verifyOnly ? ST_CLOSE : ST_LEAVE, 0);
+        return;
+    }
+    emitMessage(s, BOOT_EVENT_MESSAGE, "Uploading %d (0x%x) bytes starting at %d (0x%x)", s->endAddr - s->startAddr, s->endAddr - s->startAddr, s->startAddr, s->startAddr);
+    planUpload(s, PLAN_PAGE_CRCS);
+    setState(s, ST_DATA, 0);
+}
+
+/* Called when all blocks have been sent to a local boot loader. */
+static void finishData(bootSession_t *s)
+{
+bootDeviceInfo_t    info;
+int                 skipped;
+
+    if((s->info.flags & DEVINFO_FLAG_SKIP) && bootQueryDeviceInfo(s->device, &info) == 0){
+        skipped = (info.pagesSkipped - s->info.pagesSkipped) & 0xffff;
+        if(skipped != 0)
+            emitMessage(s, BOOT_EVENT_MESSAGE, "%d unchanged pages skipped by the boot loader", skipped);
+    }
+    if(s->info.flags & DEVINFO_FLAG_PAGE_CRC){
+        s->verifying = 1;
+        s->crcAddr = s->startAddr;
+        setState(s, ST_CRC, 0);
+    }else{
+        setState(s, ST_LEAVE, 0);
+    }
+}
+
+static void stepData(bootSession_t *s)
+{
+int err, len;
+
+    if((s->currentAddr = nextAddress(s, s->currentAddr)) >= s->endAddr){
+        finishData(s);
+        return;
+    }
+    if(s->blockSize > (int)sizeof(s->txBuffer.data.data) && s->endAddr - s->currentAddr >= s->blockSize
+       && isContiguous(s, s->currentAddr, s->blockSize)){
+        /* several pages in one long transfer (report 5) */
+        s->txBuffer.longData.reportId = 5;
+        len = s->blockSize;
+    }else{
+        s->txBuffer.data.reportId = 2;
+        len = sizeof(s->txBuffer.data.data);
+    }
+    memcpy(s->txBuffer.data.data, s->image->data + s->currentAddr, len);
+    setUsbInt(s->txBuffer.data.address, s->currentAddr, 3);
+    if((err = usbSetReport(s->device, USB_HID_REPORT_TYPE_FEATURE, s->txBuffer.bytes, 4 + len)) != 0){
+        emitMessage(s, BOOT_EVENT_ERROR, "Error uploading data block: %s", bootErrorMessage(err));
+        fail(s, err);
+        return;
+    }
+    s->currentAddr += len;
+    emitAddress(s, BOOT_EVENT_PROGRESS, s->currentAddr - len, len);
+    if((s->currentAddr = nextAddress(s, s->currentAddr)) >= s->endAddr)
+        finishData(s);
+}
+
+static void stepReboot(bootSession_t *s)
+{
+    if(openDevice(s, 1) == 0){
+        setState(s, ST_OPEN, 0);
+    }else if(--s->retry > 0){
+        setState(s, ST_REBOOT, 100);
+    }else{
+        emitMessage(s, BOOT_EVENT_ERROR, "HIDBoot did not appear after resetting '%s'", IDENT_BRIDGE_STRING);
+        fail(s, BOOT_ERROR_TIMEOUT);
+    }
+}
+
+static void stepLeave(bootSession_t *s)
+{
+    /* the report must have the length the device declares; info passed to
+     * bootSessionSetDevice() may not have it
+     */
+    if(s->options.leaveBootLoader && (s->info.reportLen != 0 || bootQueryDeviceInfo(s->device, &s->info) == 0)){
+        s->txBuffer.info.reportId = 1;
+        usbSetReport(s->device, USB_HID_REPORT_TYPE_FEATURE, s->txBuffer.bytes, s->info.reportLen);
+        /* Ignore errors here. If the device reboots before we poll the response,
+         * this request fails.
+         */
+    }
+    setState(s, ST_CLOSE, 0);
+}
+
+static void stepWaitBootReq(bootSession_t *s)
+{
+int err;
+
+    /* Get device info reported by the remote device */
+    if((err = getStatusReport(s, sizeof(s->replyBuffer.devInfo))) != 0){
+        fail(s, err);
+        return;
+    }
+    if((s->replyBuffer.devInfo.devStatus == STATUS_OTA_BOOT_REQ) && (s->replyBuffer.devInfo.statusType == STATUS_TYPE_DEVINFO) && (s->replyBuffer.devInfo.deviceId)){
+        /* Received valid device info from a remote device */
+        s->remoteId = s->replyBuffer.devInfo.deviceId;
+        emitMessage(s, BOOT_EVENT_MESSAGE, "Device info received from remote device ID: 0x%02x", s->remoteId);
+        setState(s, ST_START, 0);
+    }else if(--s->retry == 0){
+        emitMessage(s, BOOT_EVENT_ERROR, "No valid device info received from any Remote device! last info: deviceID: 0x%02x Status: 0x%02x", s->replyBuffer.devInfo.deviceId, s->replyBuffer.devInfo.devStatus);
+        fail(s, BOOT_ERROR_TIMEOUT);
+    }else{
+        emitAddress(s, BOOT_EVENT_RETRY, 0, 0);
+        s->nextTime = timeMs() + 200;
+    }
+}
+
+static void stepStart(bootSession_t *s)
+{
+int err;
+
+    /* Command the remote device to start receiving data and Get back its device info */
+    if((err = sendCommand(s, CMD_OTA_BOOT_START)) != 0){
+        emitMessage(s, BOOT_EVENT_ERROR, "USBError sending PROG_START command: %s", bootErrorMessage(err));
+        fail(s, err);
+        return;
+    }
+    emitMessage(s, BOOT_EVENT_MESSAGE, "WAITING for Remote device (ID: 0x%02x) to get ready", s->remoteId);
+    s->retry = REMOTE_POLLS;
+    setState(s, ST_WAIT_READY, 0);
+}
+
+static void stepWaitReady(bootSession_t *s)
+{
+int err;
+
+    if((err = getStatusReport(s, sizeof(s->replyBuffer.devInfo))) != 0){
+        fail(s, err);
+        return;
+    }
+    if((s->replyBuffer.devInfo.deviceId == s->remoteId) && (s->replyBuffer.devInfo.devStatus == STATUS_OTA_BOOT_READY)){
+        setState(s, ST_TXMODE, 0);
+    }else if(--s->retry == 0){
+        emitMessage(s, BOOT_EVENT_ERROR, "No response from Remote device! deviceID: 0x%02x Status: 0x%02x", s->replyBuffer.devInfo.deviceId, s->replyBuffer.devInfo.devStatus);
+        fail(s, BOOT_ERROR_TIMEOUT);
+    }else{
+        emitAddress(s, BOOT_EVENT_RETRY, 0, 0);
+        s->nextTime = timeMs() + 200;
+    }
+}
+
+static void startRemoteUpload(bootSession_t *s, int plan)
+{
+    planUpload(s, plan);
+    s->xfer = XFER_DATA;
+    s->batchMask = (1 << OTA_BATCH_PACKETS) - 1;
+    if((s->currentAddr = nextAddress(s, s->currentAddr)) >= s->endAddr){
+        emitMessage(s, BOOT_EVENT_MESSAGE, "ENDING communication");
+        s->xfer = XFER_STOP;
+    }
+    s->retry = s->session ? SESSION_STALLS : REMOTE_RETRIES;
+    setState(s, ST_XFER_SEND, 10);
+}
+
+static void startRemoteReset(bootSession_t *s)
+{
+    emitMessage(s, BOOT_EVENT_MESSAGE, "RESETTING Remote device");
+    s->xfer = XFER_RESET;
+    s->retry = REMOTE_RETRIES;
+    setState(s, ST_XFER_SEND, 200 + 10);
+}
+
+static void pushCrcRange(bootSession_t *s, int addr, int len)
+{
+    if(s->crcTop < MAX_CRC_RANGES){
+        s->crcRanges[s->crcTop][0] = addr;
+        s->crcRanges[s->crcTop][1] = len;
+        s->crcTop++;
+    }   /* else: the units stay unmatched and are uploaded */
+}
+
+/* Queries the next range on the stack or continues with the upload (or
+ * reset after verification) when all ranges are done.
+ */
+static void nextRemoteCrc(bootSession_t *s)
+{
+    if(s->crcTop == 0){
+        if(s->verifying){
+            emitMessage(s, BOOT_EVENT_MESSAGE, "VERIFIED %d (0x%x) bytes", s->endAddr - s->startAddr, s->endAddr - s->startAddr);
+            startRemoteReset(s);
+        }else{
+            startRemoteUpload(s, PLAN_RANGE_CRCS);
+        }
+        return;
+    }
+    s->crcTop--;
+    s->crcAddr = s->crcRanges[s->crcTop][0];
+    s->crcLen = s->crcRanges[s->crcTop][1];
+    s->xfer = XFER_CRC_QUERY;
+    s->retry = REMOTE_RETRIES;
+    setState(s, ST_XFER_SEND, 10);
+}
+
+/* Compares the CRC of the whole image with the remote flash. Before the
+ * upload, mismatching ranges are bisected down to single units, so a few
+ * changed pages cost a few queries per page instead of a full upload.
+ */
+static void startRemoteCrcs(bootSession_t *s, int verify)
+{
+    s->verifying = verify;
+    s->crcTop = 0;
+    memset(s->unitMatch, 0, sizeof(s->unitMatch));
+    pushCrcRange(s, s->startAddr, s->endAddr - s->startAddr);
+    nextRemoteCrc(s);
+}
+
+static void handleRemoteCrc(bootSession_t *s, unsigned crc)
+{
+int i, half;
+
+    if(crc == pageCrc(s->image->data + s->crcAddr, s->crcLen)){
+        for(i = 0; i < s->crcLen / s->unitSize; i++)
+            s->unitMatch[(s->crcAddr - s->startAddr) / s->unitSize + i] = 1;
+    }else if(s->verifying){
+        emitMessage(s, BOOT_EVENT_ERROR, "ERROR: verify failed, remote flash differs from image");
+        fail(s, BOOT_ERROR_VERIFY);
+        return;
+    }else if(s->crcLen > s->unitSize){
+        half = (s->crcLen / s->unitSize / 2) * s->unitSize;
+        pushCrcRange(s, s->crcAddr + half, s->crcLen - half);
+        pushCrcRange(s, s->crcAddr, half);
+    }
+    nextRemoteCrc(s);
+}
+
+/* The remote did not answer a CRC query. */
+static void remoteCrcUnavailable(bootSession_t *s)
+{
+    if(s->verifying){
+        emitMessage(s, BOOT_EVENT_MESSAGE, "Warning: remote device did not report its flash CRC, upload not verified");
+        startRemoteReset(s);
+    }else if(s->remoteCrc == 0){    /* never answered: not supported */
+        s->remoteCrc = -1;
+        emitMessage(s, BOOT_EVENT_MESSAGE, "Remote device does not report page CRCs, using cache");
+        startRemoteUpload(s, PLAN_CACHE);
+    }else{  /* upload this range */
+        nextRemoteCrc(s);
+    }
+}
+
+/* The remote is ready and the relay in transmit mode. Checks the range and
+ * continues with the CRC queries or the upload.
+ */
+static void remoteReady(bootSession_t *s, int pageSizeDiv2, int flashSizeInKB)
+{
+int err;
+
+    s->pageSize = pageSizeDiv2 * 2;
+    s->deviceSize = flashSizeInKB * 1024;
+    s->bootSize = REMOTE_BOOT_SIZE;
+    s->blockSize = s->batch ? OTA_BATCH_SIZE : (int)sizeof(s->txBuffer.progData.data);
+    emitDevice(s);
+    if((err = checkRange(s)) != 0){
+        fail(s, err);
+        return;
+    }
+    emitMessage(s, BOOT_EVENT_MESSAGE, "UPLOADING %d (0x%x) bytes starting at %d (0x%x)", s->endAddr - s->startAddr, s->endAddr - s->startAddr, s->startAddr, s->startAddr);
+    setCacheKey(s);
+    loadCache(s);
+    if(s->options.forceUpload){
+        startRemoteUpload(s, PLAN_CACHE);
+    }else{  /* find unchanged pages with CRC queries first */
+        startRemoteCrcs(s, 0);
+    }
+}
+
+static void stepTxMode(bootSession_t *s)
+{
+int err;
+
+    /* Acknowledgment received from remote, Change to Tx mode */
+    emitMessage(s, BOOT_EVENT_MESSAGE, "CHANGING to Tx mode");
+    if((err = sendCommand(s, CMD_OTA_BOOT_TXMODE)) != 0){
+        emitMessage(s, BOOT_EVENT_ERROR, "USBError sending TXMODE command: %s", bootErrorMessage(err));
+        fail(s, err);
+        return;
+    }
+    /* Parse page size and flash size of the remote from the received device info */
+    remoteReady(s, s->replyBuffer.devInfo.pageSizeDiv2, s->replyBuffer.devInfo.flashSizeInKB);
+}
+
+/* With a session the relay waits for the boot request and READY, sends START
+ * and switches to transmit mode on its own. We only watch the status.
+ */
+static void stepSessionBegin(bootSession_t *s)
+{
+int err;
+
+    if(s->remoteId == 0){
+        emitMessage(s, BOOT_EVENT_MESSAGE, "WAITING for device info from a remote device");
+    }else{
+        emitMessage(s, BOOT_EVENT_MESSAGE, "WAITING for Remote device (ID: 0x%02x) to get ready", s->remoteId);
+    }
+    if((err = sendCommand(s, CMD_OTA_BOOT_SESSION)) != 0){
+        emitMessage(s, BOOT_EVENT_ERROR, "USBError sending SESSION command: %s", bootErrorMessage(err));
+        fail(s, err);
+        return;
+    }
+    /* the remote may be running its application, ask it to reset into the
+     * boot loader (a waiting boot loader ignores this)
+     */
+    if(s->appReboot && s->remoteId != 0){
+        if((err = sendCommand(s, CMD_OTA_APP_REBOOT)) != 0){
+            emitMessage(s, BOOT_EVENT_ERROR, "USBError sending APP_REBOOT command: %s", bootErrorMessage(err));
+            fail(s, err);
+            return;
+        }
+    }
+    s->retry = SESSION_POLLS;
+    setState(s, ST_SESSION_WAIT, 50);
+}
+
+static void stepSessionWait(bootSession_t *s)
+{
+sessionStatus_t *status = &s->replyBuffer.session;
+int             err;
+
+    if((err = getSessionStatus(s)) != 0){
+        fail(s, err);
+        return;
+    }
+    if(status->state == SESSION_ACTIVE){
+        s->remoteId = status->deviceId;
+        emitMessage(s, BOOT_EVENT_MESSAGE, "Remote device (ID: 0x%02x) ready", s->remoteId);
+        remoteReady(s, status->pageSizeDiv2, status->flashSizeInKB);
+    }else if(status->state == SESSION_FAILED || --s->retry == 0){
+        emitMessage(s, BOOT_EVENT_ERROR, "No valid device info received from %s remote device!", s->remoteId == 0 ? "any" : "the");
+        fail(s, BOOT_ERROR_TIMEOUT);
+    }else{
+        setState(s, ST_SESSION_WAIT, 50);
+    }
+}
+
+/* Reports a failed session with the address of the failed block. */
+static void sessionFailed(bootSession_t *s)
+{
+sessionStatus_t *status = &s->replyBuffer.session;
+
+    if(status->error == SESSION_ERR_RADIO && s->xfer == XFER_DATA){
+        s->currentAddr = getUsbInt((char *)status->address, 3);   /* for the checkpoint */
+        emitMessage(s, BOOT_EVENT_ERROR, "ERROR: programming failed at address 0x%05x", s->currentAddr);
+    }else if(status->error == SESSION_ERR_RADIO){
+        emitMessage(s, BOOT_EVENT_ERROR, "ERROR: programming failed at address 0x%05x", getUsbInt((char *)status->address, 3));
+    }else{
+        emitMessage(s, BOOT_EVENT_ERROR, "ERROR: session failed (state: %d, error: %d)", status->state, status->error);
+    }
+    fail(s, BOOT_ERROR_PROGRAMMING);
+}
+
+/* Sends the block at currentAddr: 16 bytes in report 4 or, if the relay
+ * supports it, OTA_BATCH_SIZE bytes in report 8, of which the relay
+ * transmits the packets in batchMask.
+ */
+static int  sendRemoteData(bootSession_t *s)
+{
+    if(s->batch){
+        s->txBuffer.batch.reportId = 8;
+        setUsbInt(s->txBuffer.batch.address, s->currentAddr, 3);
+        setUsbInt(s->txBuffer.batch.mask, s->batchMask, 2);
+        memcpy(s->txBuffer.batch.data, s->image->data + s->currentAddr, sizeof(s->txBuffer.batch.data));
+        return usbSetReport(s->device, USB_HID_REPORT_TYPE_FEATURE, s->txBuffer.bytes, sizeof(s->txBuffer.batch));
+    }
+    s->txBuffer.progData.reportId = 4;
+    memcpy(s->txBuffer.progData.data, s->image->data + s->currentAddr, sizeof(s->txBuffer.progData.data));
+    setUsbInt(s->txBuffer.progData.address, s->currentAddr, 3);
+    return usbSetReport(s->device, USB_HID_REPORT_TYPE_FEATURE, s->txBuffer.bytes, sizeof(s->txBuffer.progData));
+}
+
+/* The block at currentAddr is done, continues with the next one or STOP */
+static void nextRemoteData(bootSession_t *s)
+{
+    s->currentAddr += s->blockSize;
+    emitAddress(s, BOOT_EVENT_PROGRESS, s->currentAddr - s->blockSize, s->blockSize);
+    s->batchMask = (1 << OTA_BATCH_PACKETS) - 1;
+    if((s->currentAddr = nextAddress(s, s->currentAddr)) >= s->endAddr){   /* Send STOP to remote device */
+        emitMessage(s, BOOT_EVENT_MESSAGE, "ENDING communication");
+        s->xfer = XFER_STOP;
+    }
+}
+
+/* Streams the data blocks into the queue of the relay without waiting for
+ * their ACKs. The relay stalls report 4 and 8 while its queue is full.
+ */
+static void sessionSendData(bootSession_t *s)
+{
+int err;
+
+    if((err = sendRemoteData(s)) != 0){    /* usually a STALL, the status decides */
+        if((err = getSessionStatus(s)) != 0){
+            fail(s, err);
+        }else if(s->replyBuffer.session.state != SESSION_ACTIVE){
+            sessionFailed(s);
+        }else if(--s->retry == 0){
+            emitMessage(s, BOOT_EVENT_ERROR, "ERROR: relay does not accept data at address 0x%05x", s->currentAddr);
+            fail(s, BOOT_ERROR_PROGRAMMING);
+        }else{
+            setState(s, ST_XFER_SEND, 2);
+        }
+        return;
+    }
+    s->retry = SESSION_STALLS;
+    nextRemoteData(s);
+    setState(s, ST_XFER_SEND, 0);
+}
+
+/* Sends STOP or RESET behind the queued blocks */
+static void sessionSendFinish(bootSession_t *s)
+{
+int err;
+
+    if((err = sendCommandArgs(s, CMD_OTA_BOOT_FINISH, s->xfer == XFER_STOP ? SESSION_FINISH_STOP : SESSION_FINISH_RESET, 0)) != 0){
+        emitMessage(s, BOOT_EVENT_ERROR, "USBError sending FINISH command: %s", bootErrorMessage(err));
+        fail(s, err);
+        return;
+    }
+    s->retry = SESSION_POLLS;
+    setState(s, ST_SESSION_CHECK, 10);
+}
+
+static void stepSessionCheck(bootSession_t *s)
+{
+sessionStatus_t *status = &s->replyBuffer.session;
+int             err;
+
+    if((err = getSessionStatus(s)) != 0){
+        fail(s, err);
+    }else if(s->xfer == XFER_RESET && (status->state == SESSION_DONE || status->state == SESSION_FAILED)){
+        setState(s, ST_END, 0);     /* remote may have reset before answering */
+    }else if(status->state == SESSION_DONE){
+        if(s->remoteCrc > 0){
+            emitMessage(s, BOOT_EVENT_MESSAGE, "VERIFYING");
+            startRemoteCrcs(s, 1);
+        }else{
+            startRemoteReset(s);
+        }
+    }else if(status->state == SESSION_FAILED){
+        sessionFailed(s);
+    }else if(--s->retry == 0){
+        emitMessage(s, BOOT_EVENT_ERROR, "ERROR: Ending communication failed");
+        fail(s, BOOT_ERROR_PROGRAMMING);
+    }else{
+        setState(s, ST_SESSION_CHECK, 10);
+    }
+}
+
+static void stepXferSend(bootSession_t *s)
+{
+int err, delay;
+
+    if(s->session && s->xfer == XFER_DATA){
+        sessionSendData(s);
+        return;
+    }
+    if(s->session && (s->xfer == XFER_STOP || s->xfer == XFER_RESET)){
+        sessionSendFinish(s);
+        return;
+    }
+    if(s->statusIn){    /* drop reports of earlier transmissions */
+        while(readStatusInput(s))
+            ;
+    }
+    if(s->xfer == XFER_DATA){   /* Send data block to remote device */
+        err = sendRemoteData(s);
+        s->polls = BATCH_POLLS;
+    }else if(s->xfer == XFER_CRC_QUERY){
+        err = sendCommandArgs(s, CMD_OTA_BOOT_PAGECRC, s->crcAddr, s->crcLen);
+    }else if(s->xfer == XFER_CRC_POLL){
+        err = sendCommand(s, CMD_OTA_BOOT_POLL);
+    }else{
+        err = sendCommand(s, s->xfer == XFER_STOP ? CMD_OTA_BOOT_STOP : CMD_OTA_BOOT_RESET);
+    }
+    if(err != 0)    /* status check below decides about a retry */
+        emitAddress(s, BOOT_EVENT_RETRY, s->currentAddr, 0);
+    delay = s->xfer == XFER_RESET ? 10 : 20;
+    if(s->statusIn && !(s->xfer == XFER_DATA && s->batch)){
+        /* the relay reports the end of the transmission, fall back to a GET
+         * of report 3 after the usual delay */
+        s->statusTime = timeMs() + delay;
+        delay = 1;
+    }
+    setState(s, ST_XFER_CHECK, delay);
+}
+
+/* Status check of a CRC query or poll. The CRC arrives in the ACK payload of
+ * a later packet, so we poll until it shows up.
+ */
+static void checkRemoteCrc(bootSession_t *s)
+{
+remoteCrcStatus_t   *status = &s->replyBuffer.crcStatus;
+
+    if(s->xfer == XFER_CRC_QUERY){
+        if(status->txStatus == 0){
+            s->xfer = XFER_CRC_POLL;
+            s->polls = CRC_POLLS;
+            setState(s, ST_XFER_SEND, 5);
+        }else if(--s->retry == 0){
+            remoteCrcUnavailable(s);
+        }else{
+            emitAddress(s, BOOT_EVENT_RETRY, s->crcAddr, 0);
+            setState(s, ST_XFER_SEND, 10);
+        }
+        return;
+    }
+    if(status->txStatus == 0 && status->deviceId == s->remoteId && status->statusType == STATUS_TYPE_PAGECRC
+       && getUsbInt((char *)status->address, 2) == (s->crcAddr & 0xffff)){
+        s->remoteCrc = 1;
+        handleRemoteCrc(s, getUsbInt((char *)status->crc, 2));
+    }else if(--s->polls == 0){
+        remoteCrcUnavailable(s);
+    }else{
+        setState(s, ST_XFER_SEND, 5);
+    }
+}
+
+/* Status check of a batch (report 8). Packets which were not acknowledged
+ * are sent again with the next try, the others are not repeated.
+ */
+static void checkBatch(bootSession_t *s)
+{
+batchStatus_t   *status = &s->replyBuffer.batch;
+int             err, len = sizeof(s->replyBuffer), i;
+
+    if((err = usbGetReport(s->device, USB_HID_REPORT_TYPE_FEATURE, 8, s->replyBuffer.bytes, &len)) != 0){
+        emitMessage(s, BOOT_EVENT_ERROR, "USBError reading batch status: %s", bootErrorMessage(err));
+        fail(s, err);
+        return;
+    }
+    if(len < (int)sizeof(*status) || getUsbInt((char *)status->address, 3) != s->currentAddr){
+        if(--s->retry == 0){    /* relay did not take the batch */
+            emitMessage(s, BOOT_EVENT_ERROR, "ERROR: relay did not accept data at address 0x%05x", s->currentAddr);
+            fail(s, BOOT_ERROR_PROGRAMMING);
+        }else{
+            emitAddress(s, BOOT_EVENT_RETRY, s->currentAddr, 0);
+            setState(s, ST_XFER_SEND, 10);
+        }
+        return;
+    }
+    if(status->pending != 0 && --s->polls > 0){
+        setState(s, ST_XFER_CHECK, 2);
+        return;
+    }
+    s->batchMask &= ~getUsbInt((char *)status->acked, 2);
+    if(s->batchMask == 0){
+        s->retry = REMOTE_RETRIES;
+        nextRemoteData(s);
+        setState(s, ST_XFER_SEND, 0);
+    }else if(--s->retry == 0){
+        for(i = 0; !(s->batchMask & (1 << i)); i++)
+            ;
+        emitMessage(s, BOOT_EVENT_ERROR, "ERROR: programming failed at address 0x%05x", s->currentAddr + 16 * i);
+        fail(s, BOOT_ERROR_PROGRAMMING);
+    }else{
+        emitAddress(s, BOOT_EVENT_RETRY, s->currentAddr, 0);
+        setState(s, ST_XFER_SEND, 10);
+    }
+}
+
+static void stepXferCheck(bootSession_t *s)
+{
+int err, ok;
+
+    if(s->xfer == XFER_DATA && s->batch){
+        checkBatch(s);
+        return;
+    }
+    /* Get the reply from remote device */
+    if(s->statusIn && readStatusInput(s)){
+        /* sent by the relay as soon as the ACK arrived */
+    }else if(s->statusIn && timeMs() < s->statusTime){
+        setState(s, ST_XFER_CHECK, 1);
+        return;
+    }else if((err = getStatusReport(s, sizeof(s->replyBuffer.progStatus))) != 0){
+        fail(s, err);
+        return;
+    }
+    if(s->xfer == XFER_CRC_QUERY || s->xfer == XFER_CRC_POLL){
+        checkRemoteCrc(s);
+        return;
+    }
+    ok = (s->replyBuffer.progStatus.txStatus == 0);
+    if(s->xfer != XFER_RESET)
+        ok = ok && (s->replyBuffer.progStatus.deviceId == s->remoteId);
+    if(ok){
+        s->retry = REMOTE_RETRIES;
+        if(s->xfer == XFER_DATA){
+            nextRemoteData(s);
+            setState(s, ST_XFER_SEND, 10);
+        }else if(s->xfer == XFER_STOP){     /* Verify and reset the remote device */
+            if(s->remoteCrc > 0){
+                emitMessage(s, BOOT_EVENT_MESSAGE, "VERIFYING");
+                startRemoteCrcs(s, 1);
+            }else{
+                startRemoteReset(s);
+            }
+        }else{
+            setState(s, ST_END, 200);
+        }
+    }else if(--s->retry == 0){
+        if(s->xfer == XFER_DATA){
+            emitMessage(s, BOOT_EVENT_ERROR, "ERROR: programming failed at address 0x%05x (txStatus: %d, DevID: 0x%02x, DevStatus: 0x%02x)",
+                        s->currentAddr, s->replyBuffer.progStatus.txStatus, s->replyBuffer.progStatus.deviceId, s->replyBuffer.progStatus.devStatus);
+            fail(s, BOOT_ERROR_PROGRAMMING);
+        }else if(s->xfer == XFER_STOP){
+            emitMessage(s, BOOT_EVENT_ERROR, "ERROR: Ending communication failed");
+            fail(s, BOOT_ERROR_PROGRAMMING);
+        }else{  /* remote may have reset before answering */
+            setState(s, ST_END, 200);
+        }
+    }else{
+        emitAddress(s, BOOT_EVENT_RETRY, s->currentAddr, 0);
+        setState(s, ST_XFER_SEND, 10);
+    }
+}
+
+static void stepEnd(bootSession_t *s)
+{
+int err;
+
+    emitMessage(s, BOOT_EVENT_MESSAGE, "RESTORING state");
+    if((err = sendCommand(s, CMD_OTA_BOOT_END)) != 0){
+        emitMessage(s, BOOT_EVENT_ERROR, "USBError: Sending END command: %s", bootErrorMessage(err));
+        if(s->result == 0)
+            s->result = err;
+    }
+    setState(s, ST_CLOSE, 0);
+}
+
+static void stepClose(bootSession_t *s)
+{
+bootEvent_t event;
+
+    if(s->uploading && s->result == 0){
+        s->resumeAddr = 0;
+        saveCache(s, 1);
+    }else if(s->uploading && s->result != BOOT_ERROR_VERIFY){
+        saveCheckpoint(s);
+    }
+    if(s->device != NULL && !s->deviceAttached)
+        usbCloseDevice(s->device);
+    s->device = NULL;
+    s->state = ST_FINISHED;
+    memset(&event, 0, sizeof(event));
+    event.type = BOOT_EVENT_FINISHED;
+    event.error = s->result;
+    emit(s, &event);
+}
+
+/* ------------------------------------------------------------------------- */
+
+bootSession_t *bootSessionNew(const bootOptions_t *options, bootEventCallback_t callback, void *context)
+{
+bootSession_t   *s = calloc(1, sizeof(bootSession_t));
+
+    if(s != NULL){
+        s->options = *options;
+        s->callback = callback;
+        s->context = context;
+        s->remoteId = options->remoteId;
+    }
+    return s;
+}
+
+void    bootSessionFree(bootSession_t *session)
+{
+    if(session != NULL){
+        if(session->device != NULL && !session->deviceAttached)
+            usbCloseDevice(session->device);
+        free(session);
+    }
+}
+
+void    bootSessionSetDevice(bootSession_t *s, usbDevice_t *device, const bootDeviceInfo_t *info)
+{
+    s->device = device;
+    s->deviceAttached = (device != NULL);
+    s->haveInfo = (info != NULL);
+    if(info != NULL)
+        s->info = *info;
+}
+
+int bootSessionStart(bootSession_t *s, const bootImage_t *image)
+{
+    s->image = image;
+    s->startAddr = s->endAddr = 0;
+    if(image != NULL)
+        bootImageRange(image, &s->startAddr, &s->endAddr);
+    s->currentAddr = s->startAddr;
+    s->result = 0;
+    s->cancelled = 0;
+    s->uploading = 0;
+    setState(s, ST_OPEN, 0);
+    return 0;
+}
+
+void    bootSessionCancel(bootSession_t *s)
+{
+    s->cancelled = 1;
+}
+
+int bootSessionTimeout(bootSession_t *s)
+{
+long    delta;
+
+    if(s->state == ST_FINISHED || s->state == ST_IDLE)
+        return -1;
+    delta = s->nextTime - timeMs();
+    return delta > 0 ? (int)delta : 0;
+}
+
+int bootSessionStep(bootSession_t *s, int maxWaitMs)
+{
+long    now, deadline = timeMs() + maxWaitMs;
+int     didStep = 0;
+
+    while(s->state != ST_FINISHED && s->state != ST_IDLE){
+        now = timeMs();
+        if(s->cancelled && s->result == 0){
+            s->result = BOOT_ERROR_CANCELLED;
+            if(s->state != ST_END && s->state != ST_CLOSE)
+                fail(s, BOOT_ERROR_CANCELLED);
+        }
+        if(s->nextTime > now){
+            if(s->nextTime > deadline){
+                sleep_ms(deadline - now);
+                break;
+            }
+            sleep_ms(s->nextTime - now);
+        }else if(didStep && now >= deadline){
+            break;
+        }
+        switch(s->state){
+        case ST_OPEN:           stepOpen(s); break;
+        case ST_INFO:           stepInfo(s); break;
+        case ST_CRC:            stepCrc(s); break;
+        case ST_DATA:           stepData(s); break;
+        case ST_LEAVE:          stepLeave(s); break;
+        case ST_REBOOT:         stepReboot(s); break;
+        case ST_WAIT_BOOT_REQ:  stepWaitBootReq(s); break;
+        case ST_START:          stepStart(s); break;
+        case ST_WAIT_READY:     stepWaitReady(s); break;
+        case ST_TXMODE:         stepTxMode(s); break;
+        case ST_SESSION_BEGIN:  stepSessionBegin(s); break;
+        case ST_SESSION_WAIT:   stepSessionWait(s); break;
+        case ST_SESSION_CHECK:  stepSessionCheck(s); break;
+        case ST_XFER_SEND:      stepXferSend(s); break;
+        case ST_XFER_CHECK:     stepXferCheck(s); break;
+        case ST_END:            stepEnd(s); break;
+        case ST_CLOSE:          stepClose(s); break;
+        }
+        didStep = 1;
+    }
+    if(s->state == ST_FINISHED)
+        return s->result;
+    return BOOT_RUNNING;
+}
+
+int bootSessionRun(bootSession_t *s)
+{
+int rval;
+
+    while((rval = bootSessionStep(s, 1000)) == BOOT_RUNNING)
+        ;
+    return rval;
+}
+
+/* ------------------------------------------------------------------------- */
@@ -0,0 +1,220 @@
+/* Name: bootloadhid.h
+ * Project: AVR bootloader HID
+ * Tabsize: 4
+ * License: Proprietary, free under certain conditions. See Documentation.
+ *
+ * For: usbXR project: https://github.com/visakhanc/usbXR
+ */
+
+#ifndef __bootloadhid_h_INCLUDED__
+#define __bootloadhid_h_INCLUDED__
+
+/*
+General Description:
+This module (libbootloadhid) contains the upload engine of bootloadHID for
+self programming of the HID boot loader and for over-the-air programming of
+remote nodes through the usbXR relay. It is reentrant: all state lives in
+opaque session and image objects, so one process can drive many uploads.
+
+A session is a state machine. bootSessionStep() performs the actions which
+are due and returns after at most 'maxWaitMs' milliseconds (plus the time of
+a single USB transaction). All output is reported through an event callback
+instead of being printed, delays are never slept beyond the caller's limit.
+
+    bootImage_t   *image = bootImageNew();
+    bootSession_t *session;
+    bootImageLoadHex(image, "test.hex");
+    session = bootSessionNew(&options, eventCallback, context);
+    bootSessionStart(session, image);
+    while(bootSessionStep(session, 100) == BOOT_RUNNING)
+        ;   // do other work here
+    bootSessionFree(session);
+    bootImageFree(image);
+*/
+
+#include "usbcalls.h"
+
+/* ------------------------------------------------------------------------ */
+
+#define BOOT_RUNNING            1
+/* Returned by bootSessionStep() while the session has work left. */
+
+#define BOOT_ERROR_DEVICE       -1  /* unexpected answer from the device */
+#define BOOT_ERROR_SIZE         -2  /* image does not fit into the device */
+#define BOOT_ERROR_TIMEOUT      -3  /* remote device did not answer */
+#define BOOT_ERROR_PROGRAMMING  -4  /* remote device did not accept data */
+#define BOOT_ERROR_CANCELLED    -5  /* bootSessionCancel() was called */
+#define BOOT_ERROR_FILE         -6  /* hex file could not be read, see errno */
+#define BOOT_ERROR_MEMORY       -7
+#define BOOT_ERROR_VERIFY       -8  /* flash contents differ from the image */
+/* Error codes of this module. Positive error codes are USB_ERROR_* values
+ * from usbcalls.h.
+ */
+
+#define BOOT_IMAGE_SIZE         65536
+/* Largest image (in bytes) which can be uploaded. */
+
+/* ------------------------------------------------------------------------ */
+
+typedef struct bootImage    bootImage_t;
+/* Flash contents to upload. Unused bytes are 0xff. */
+
+typedef struct bootSession  bootSession_t;
+/* One upload to one device. Only opaque pointers are available. */
+
+typedef struct bootOptions {
+    int     remote;             /* program a remote node through the relay */
+    int     remoteId;           /* remote device ID, 0 = first boot request */
+    int     leaveBootLoader;    /* start the application after upload */
+    int     rebootApp;          /* local: reset a running bridge into the boot loader, start it again after upload */
+    int     verifyOnly;         /* check the image against the device, no upload */
+    int     forceUpload;        /* write all pages, ignore cache and device CRCs */
+    int     resume;             /* continue at the checkpoint of a failed upload */
+    const char *cacheDir;       /* flash-state cache, NULL = bootCacheDir() */
+} bootOptions_t;
+
+typedef struct bootDeviceInfo {
+    int     pageSize;
+    int     flashSize;
+    int     blockSize;          /* bytes per SET_REPORT, multiple of 128 */
+    int     flags;              /* DEVINFO_FLAG_* from bootloader_defs.h */
+    int     bootSize;           /* bytes at the end of the flash, 0 = not reported */
+    int     pagesSkipped;       /* unchanged pages not rewritten since reset (DEVINFO_FLAG_SKIP) */
+    int     reportLen;          /* bytes of report 1 (with ID) the device sent, 0 = unknown */
+} bootDeviceInfo_t;
+
+typedef struct bootStats {
+    int             ticksPerMs;     /* unit of the times below */
+    unsigned        setReports, getReports;
+    unsigned        pageErases, pageWrites;
+    unsigned        eraseMax, writeMax;
+    unsigned long   flashTicks;     /* spent in erases and writes */
+    unsigned        txPackets, txFailed, txRetransmits;
+    unsigned        rxOverwrites;   /* remote replies lost before they were read */
+    unsigned long   loops;          /* main loop iterations */
+    unsigned        loopMin, loopMax;
+    unsigned        ramStatic;      /* bytes, 0 if not reported */
+    unsigned        stackUnused;    /* bytes the stack never reached */
+} bootStats_t;
+/* Counters of a boot loader with DEVINFO_FLAG_STATS (report 9). The 16 bit
+ * counters wrap around.
+ */
+
+#define BOOT_EVENT_MESSAGE      1   /* progress text in 'message' */
+#define BOOT_EVENT_ERROR        2   /* error text in 'message' */
+#define BOOT_EVENT_DEVICE       3   /* 'pageSize', 'flashSize', 'bootSize', 'blockSize', 'flags' known */
+#define BOOT_EVENT_PROGRESS     4   /* 'length' bytes at 'address' written */
+#define BOOT_EVENT_RETRY        5   /* block at 'address' is sent again */
+#define BOOT_EVENT_FINISHED     6   /* session ended with result 'error' */
+
+typedef struct bootEvent {
+    int         type;           /* BOOT_EVENT_* */
+    const char  *message;
+    int         address;
+    int         length;
+    int         done;           /* bytes uploaded so far */
+    int         total;          /* bytes to upload */
+    int         pageSize;
+    int         flashSize;
+    int         bootSize;       /* flash taken by the boot loader */
+    int         blockSize;
+    int         flags;
+    int         remoteId;
+    int         error;
+} bootEvent_t;
+
+typedef void (*bootEventCallback_t)(bootSession_t *session, const bootEvent_t *event, void *context);
+/* Called from within bootSessionStep(). The event and its message are only
+ * valid during the call.
+ */
+
+/* ------------------------------------------------------------------------ */
+
+bootImage_t *bootImageNew(void);
+/* Allocates an empty image. Returns NULL if out of memory. */
+void    bootImageFree(bootImage_t *image);
+int     bootImageLoadHex(bootImage_t *image, const char *fileName);
+/* Adds the contents of an Intel hex file to the image.
+ * Returns: 0 on success, BOOT_ERROR_FILE if the file cannot be read (errno is
+ * set). Lines with checksum errors are loaded but counted, see
+ * bootImageChecksumErrors().
+ */
+int     bootImageChecksumErrors(const bootImage_t *image);
+int     bootImageRange(const bootImage_t *image, int *startAddr, int *endAddr);
+/* Returns the address range covered by the image in '*startAddr' (inclusive)
+ * and '*endAddr' (exclusive) and 0 if the image is empty, 1 otherwise.
+ */
+const char *bootImageData(const bootImage_t *image);
+/* Returns BOOT_IMAGE_SIZE bytes of image data, indexed by flash address. */
+
+/* ------------------------------------------------------------------------ */
+
+bootSession_t *bootSessionNew(const bootOptions_t *options, bootEventCallback_t callback, void *context);
+/* Creates a session. 'callback' may be NULL. Returns NULL if out of memory. */
+void    bootSessionFree(bootSession_t *session);
+/* Closes the device if still open and frees the session. */
+int     bootSessionStart(bootSession_t *session, const bootImage_t *image);
+/* Starts the session. If 'image' is NULL or empty, only the device is opened
+ * (and left, if requested). The image must stay valid until the session has
+ * finished. Returns 0 on success.
+ */
+int     bootSessionStep(bootSession_t *session, int maxWaitMs);
+/* Performs due actions and waits for at most 'maxWaitMs' milliseconds for
+ * further ones. With 'maxWaitMs' == 0, at most one action is performed.
+ * Returns: BOOT_RUNNING if there is work left, 0 if the session finished
+ * successfully, or an error code.
+ */
+int     bootSessionTimeout(bootSession_t *session);
+/* Returns the number of milliseconds until bootSessionStep() has work to do,
+ * for use as poll()/select() timeout. Returns -1 if the session has finished.
+ */
+void    bootSessionCancel(bootSession_t *session);
+/* Aborts the session. The remote relay is restored on the next steps. */
+int     bootSessionRun(bootSession_t *session);
+/* Runs the session until it has finished. Returns the result as above. */
+
+void    bootSessionSetDevice(bootSession_t *session, usbDevice_t *device, const bootDeviceInfo_t *info);
+/* Lets the session use an already open boot loader or relay device instead of
+ * opening one. The device is not closed when the session finishes. If 'info'
+ * is not NULL, the device info query of local sessions is skipped. Must be
+ * called before bootSessionStart().
+ */
+
+int     bootOpenDevice(usbDevice_t **device, int remote);
+/* Opens the first HIDBoot device (or relay device if 'remote' is set).
+ * Returns 0 on success or a USB_ERROR_* code.
+ */
+int     bootOpenDeviceRelay(usbDevice_t **device, int remote, int *relay);
+/* Like bootOpenDevice(), and sets '*relay' if the device is the usbXR relay
+ * ("HIDBoot Remote"), which serves local and remote sessions alike.
+ */
+int     bootQueryDeviceInfo(usbDevice_t *device, bootDeviceInfo_t *info);
+/* Reads page size, flash size and block size from a local boot loader.
+ * Returns 0 on success or an error code.
+ */
+int     bootQueryStats(usbDevice_t *device, bootStats_t *stats);
+/* Reads the counters of the boot loader or relay. Returns 0 on success or an
+ * error code.
+ */
+int     bootClearStats(usbDevice_t *device);
+/* Sets the counters of the boot loader or relay to 0. Returns 0 on success or
+ * an error code.
+ */
+
+const char *bootCacheDir(void);
+/* Returns the default directory of the flash-state cache: bootloadhid in
+ * $XDG_CACHE_HOME, ~/.cache or %LOCALAPPDATA%. One file per device (USB serial
+ * number) or remote device ID holds a hash of every page of the image which
+ * was last uploaded successfully. Unchanged pages are not uploaded again. If
+ * the boot loader or remote node reports page CRCs, these are used instead of
+ * the cache. A failed upload leaves a checkpoint there: the address up to
+ * which the device acknowledged the image, used by the next upload of the
+ * same image with the 'resume' option.
+ */
+
+const char *bootErrorMessage(int errCode);
+/* Returns a description for USB_ERROR_* and BOOT_ERROR_* codes. */
+
+/* ------------------------------------------------------------------------ */
+
+#endif /* __bootloadhid_h_INCLUDED__ */
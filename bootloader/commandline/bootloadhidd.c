@@ -0,0 +1,693 @@
+/* Name: bootloadhidd.c
+ * Project: AVR bootloader HID
+ * Tabsize: 4
+ * License: Proprietary, free under certain conditions. See Documentation.
+ *
+ * For: usbXR project: https://github.com/visakhanc/usbXR
+ */
+
+/*
+General Description:
+bootloadhidd keeps the HIDBoot device and the usbXR relay open between jobs
+and runs flash, verify and scan requests from clients on a UNIX domain socket.
+Device info of the local boot loader is cached while the device stays open,
+so a job starts moving data right away instead of paying for enumeration,
+string descriptor queries and the info report every time.
+
+There is one job queue per device: "local" (the HIDBoot boot loader) and
+"remote" (the relay, used for all remote nodes). Jobs of both queues run
+concurrently, each driven by a libbootloadhid session from the poll() loop.
+If "local" is the relay itself (HIDBoot Remote), both queues drive the same
+device and take turns instead: a job waits while the other queue runs one.
+
+The protocol is line based, so socat or nc -U work as clients as well:
+
+    FLASH local|remote[:<id>] [-r] [-f] [--resume] <absolute path of hex file>
+    VERIFY local <absolute path of hex file>
+    CANCEL <job>
+    STATUS
+    SCAN
+
+VERIFY compares the page CRCs of the boot loader with the image; boot loaders
+without page CRCs are only checked for the image size.
+
+Replies are "QUEUED <job> <position>", followed by "MSG", "ERROR", "DEVICE",
+"PROGRESS" and "RETRY" lines tagged with the job number and a final
+"DONE <job> <code> <text>". STATUS and SCAN end with "END", CANCEL answers
+"OK" and invalid requests "ERR <text>".
+
+Started with a request as arguments, bootloadhidd acts as client:
+
+    bootloadhidd [-s <socket>] flash local -r test.hex
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "bootloadhid.h"
+
+#define MAX_CLIENTS     16
+#define LINE_LEN        1024
+#define OUT_LEN         (16 * LINE_LEN) /* replies queued for a slow client */
+#define SEND_TIMEOUT    5               /* s, a client not reading is dropped */
+
+typedef struct client {
+    int     fd;
+    int     inLen;
+    char    in[LINE_LEN];
+    int     outLen;
+    char    out[OUT_LEN];
+} client_t;
+
+typedef struct job {
+    struct job      *next;
+    int             id;
+    int             verify;
+    bootOptions_t   options;
+    bootImage_t     *image;
+    client_t        *client;    /* NULL if the client has gone away */
+    char            file[PATH_MAX];
+} job_t;
+
+typedef struct deviceSlot {
+    const char          *name;
+    int                 remote;
+    usbDevice_t         *device;
+    int                 relay;      /* device is the relay, see slotBusy() */
+    bootDeviceInfo_t    info;
+    int                 haveInfo;
+    job_t               *queue;     /* first job is running if session is set */
+    bootSession_t       *session;
+} deviceSlot_t;
+
+static deviceSlot_t slots[2] = {
+    {"local", 0},
+    {"remote", 1},
+};
+#define NUM_SLOTS   ((int)(sizeof(slots) / sizeof(slots[0])))
+
+static client_t     clients[MAX_CLIENTS];
+static int          nextJobId = 1;
+static const char   *socketPath;
+static volatile sig_atomic_t quitRequested;
+
+/* ------------------------------------------------------------------------- */
+
+static void dropClient(client_t *client);
+
+/* Sends queued output as far as the socket takes it without blocking, or all
+ * of it if block is set. The socket has a send timeout of SEND_TIMEOUT.
+ */
+static void flushClient(client_t *client, int block)
+{
+int len, done = 0;
+
+    while(done < client->outLen){
+        len = send(client->fd, client->out + done, client->outLen - done,
+                   MSG_NOSIGNAL | (block ? 0 : MSG_DONTWAIT));
+        if(len < 0){
+            if(errno == EINTR)
+                continue;
+            if(!block && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            dropClient(client);     /* gone or not reading */
+            return;
+        }
+        done += len;
+    }
+    memmove(client->out, client->out + done, client->outLen - done);
+    client->outLen -= done;
+}
+
+/* Lines are queued and flushed from the poll() loop, so a slow client does not
+ * hold up the devices. Only if the queue is full do we wait for it.
+ */
+static void sendLine(client_t *client, const char *format, ...)
+{
+char    line[LINE_LEN];
+va_list args;
+int     len;
+
+    if(client == NULL || client->fd < 0)
+        return;
+    va_start(args, format);
+    len = vsnprintf(line, sizeof(line) - 1, format, args);
+    va_end(args);
+    if(len < 0)
+        return;
+    if(len > (int)sizeof(line) - 2)
+        len = sizeof(line) - 2;
+    line[len++] = '\n';
+    if(client->outLen + len > (int)sizeof(client->out)){
+        flushClient(client, 1);
+        if(client->fd < 0)
+            return;
+    }
+    memcpy(client->out + client->outLen, line, len);
+    client->outLen += len;
+    flushClient(client, 0);
+}
+
+static void sendDeviceLine(client_t *client, const deviceSlot_t *slot)
+{
+    if(slot->device == NULL){
+        sendLine(client, "DEVICE %s closed", slot->name);
+    }else if(slot->haveInfo){
+        sendLine(client, "DEVICE %s open page=%d flash=%d block=%d", slot->name,
+                 slot->info.pageSize, slot->info.flashSize, slot->info.blockSize);
+    }else{
+        sendLine(client, "DEVICE %s open", slot->name);
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void jobEvent(bootSession_t *session, const bootEvent_t *event, void *context)
+{
+job_t           *job = context;
+deviceSlot_t    *slot = &slots[job->options.remote];
+
+    switch(event->type){
+    case BOOT_EVENT_MESSAGE:
+        sendLine(job->client, "MSG %d %s", job->id, event->message);
+        break;
+    case BOOT_EVENT_ERROR:
+        sendLine(job->client, "ERROR %d %s", job->id, event->message);
+        break;
+    case BOOT_EVENT_DEVICE:
+        if(!slot->remote){  /* remote geometry belongs to the node, not the relay */
+            memset(&slot->info, 0, sizeof(slot->info));     /* reportLen is queried again */
+            slot->info.pageSize = event->pageSize;
+            slot->info.flashSize = event->flashSize;
+            slot->info.bootSize = event->bootSize;
+            slot->info.blockSize = event->blockSize;
+            slot->info.flags = event->flags;
+            slot->haveInfo = 1;
+        }
+        sendLine(job->client, "DEVICE %d page=%d flash=%d block=%d", job->id, event->pageSize, event->flashSize, event->blockSize);
+        break;
+    case BOOT_EVENT_PROGRESS:
+        sendLine(job->client, "PROGRESS %d %d %d", job->id, event->done, event->total);
+        break;
+    case BOOT_EVENT_RETRY:
+        sendLine(job->client, "RETRY %d 0x%05x", job->id, event->address);
+        break;
+    }
+}
+
+static void finishJob(deviceSlot_t *slot, job_t *job, int result)
+{
+job_t   **p;
+
+    for(p = &slot->queue; *p != NULL; p = &(*p)->next){
+        if(*p == job){
+            *p = job->next;
+            break;
+        }
+    }
+    sendLine(job->client, "DONE %d %d %s", job->id, result, bootErrorMessage(result));
+    printf("job %d (%s %s): %s\n", job->id, slot->name, job->file, bootErrorMessage(result));
+    bootImageFree(job->image);
+    free(job);
+}
+
+static void closeSlotDevice(deviceSlot_t *slot)
+{
+    if(slot->device != NULL)
+        usbCloseDevice(slot->device);
+    slot->device = NULL;
+    slot->relay = 0;
+    slot->haveInfo = 0;
+}
+
+static int  openSlotDevice(deviceSlot_t *slot)
+{
+int err = 0;
+
+    if(slot->device == NULL && (err = bootOpenDeviceRelay(&slot->device, slot->remote, &slot->relay)) == 0)
+        printf("opened %s device\n", slot->name);
+    return err;
+}
+
+/* Returns 1 if the other slot runs a job on the same device. The remote slot
+ * always opens the relay, so both slots share one if the local one is it.
+ */
+static int  slotBusy(deviceSlot_t *slot)
+{
+    return slots[0].device != NULL && slots[0].relay && slots[!slot->remote].session != NULL;
+}
+
+/* Starts the first queued job of 'slot' if the slot is idle. */
+static void startJob(deviceSlot_t *slot)
+{
+job_t   *job;
+int     err;
+
+    while(slot->session == NULL && (job = slot->queue) != NULL){
+        if((err = openSlotDevice(slot)) != 0){
+            finishJob(slot, job, err);
+            continue;
+        }
+        if(slotBusy(slot))
+            return;     /* started when the other job is done */
+        if((slot->session = bootSessionNew(&job->options, jobEvent, job)) == NULL){
+            finishJob(slot, job, BOOT_ERROR_MEMORY);
+            continue;
+        }
+        bootSessionSetDevice(slot->session, slot->device, slot->haveInfo ? &slot->info : NULL);
+        bootSessionStart(slot->session, job->image);
+    }
+}
+
+static void stepSlot(deviceSlot_t *slot)
+{
+job_t   *job = slot->queue;
+int     result;
+
+    if(slot->session == NULL)
+        return;
+    if((result = bootSessionStep(slot->session, 0)) == BOOT_RUNNING)
+        return;
+    bootSessionFree(slot->session);
+    slot->session = NULL;
+    /* A device which failed or left the boot loader must be opened again. */
+    if(result > 0 || job->options.leaveBootLoader){
+        if(slots[0].relay)  /* the relay has gone for both */
+            closeSlotDevice(&slots[!slot->remote]);
+        closeSlotDevice(slot);
+    }
+    finishJob(slot, job, result);
+    startJob(slot);
+    startJob(&slots[!slot->remote]);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static int  parseTarget(const char *target, bootOptions_t *options)
+{
+unsigned    id = 0;
+
+    memset(options, 0, sizeof(*options));
+    if(strcmp(target, "local") == 0)
+        return 0;
+    if(strncmp(target, "remote", 6) != 0)
+        return -1;
+    options->remote = 1;
+    if(target[6] == ':'){
+        if(sscanf(target + 7, "%x", &id) != 1 || id > 0xff)
+            return -1;
+    }else if(target[6] != 0){
+        return -1;
+    }
+    options->remoteId = id;
+    return 0;
+}
+
+static void queueJob(client_t *client, int verify, char *args)
+{
+bootOptions_t   options;
+deviceSlot_t    *slot;
+job_t           *job, **p;
+char            *target, *file;
+int             position = 0, startAddr, endAddr;
+
+    target = strtok(args, " ");
+    if(target == NULL || parseTarget(target, &options) != 0){
+        sendLine(client, "ERR invalid target");
+        return;
+    }
+    while((file = strtok(NULL, " ")) != NULL && !verify && file[0] == '-'){
+        if(strcmp(file, "-r") == 0){
+            options.leaveBootLoader = 1;
+        }else if(strcmp(file, "-f") == 0){
+            options.forceUpload = 1;
+        }else if(strcmp(file, "--resume") == 0){
+            options.resume = 1;
+        }else{
+            break;
+        }
+    }
+    if(file == NULL || file[0] != '/'){
+        sendLine(client, "ERR absolute file name required");
+        return;
+    }
+    options.verifyOnly = verify;
+    if((job = calloc(1, sizeof(job_t))) == NULL || (job->image = bootImageNew()) == NULL){
+        free(job);
+        sendLine(client, "ERR %s", bootErrorMessage(BOOT_ERROR_MEMORY));
+        return;
+    }
+    if(bootImageLoadHex(job->image, file) != 0){
+        sendLine(client, "ERR cannot read %s: %s", file, strerror(errno));
+        bootImageFree(job->image);
+        free(job);
+        return;
+    }
+    if(!bootImageRange(job->image, &startAddr, &endAddr)){
+        sendLine(client, "ERR no data in %s", file);
+        bootImageFree(job->image);
+        free(job);
+        return;
+    }
+    job->id = nextJobId++;
+    job->verify = verify;
+    job->options = options;
+    job->client = client;
+    snprintf(job->file, sizeof(job->file), "%s", file);
+    slot = &slots[options.remote];
+    for(p = &slot->queue; *p != NULL; p = &(*p)->next)
+        position++;
+    *p = job;
+    sendLine(client, "QUEUED %d %d", job->id, position);
+    startJob(slot);
+}
+
+static void cancelJob(client_t *client, char *args)
+{
+job_t   *job;
+int     i, id = args != NULL ? atoi(args) : 0;
+
+    for(i = 0; i < NUM_SLOTS; i++){
+        for(job = slots[i].queue; job != NULL; job = job->next){
+            if(job->id != id)
+                continue;
+            if(job == slots[i].queue && slots[i].session != NULL){
+                bootSessionCancel(slots[i].session);    /* finishes on next step */
+            }else{
+                finishJob(&slots[i], job, BOOT_ERROR_CANCELLED);
+            }
+            sendLine(client, "OK");
+            return;
+        }
+    }
+    sendLine(client, "ERR no job %d", id);
+}
+
+static void sendStatus(client_t *client, int scan)
+{
+job_t   *job;
+int     i;
+
+    for(i = 0; i < NUM_SLOTS; i++){
+        deviceSlot_t *slot = &slots[i];
+        if(scan && slot->session == NULL){
+            if(slot->device == NULL)
+                openSlotDevice(slot);
+            if(slot->device != NULL && !slot->remote && !slot->haveInfo){
+                if(bootQueryDeviceInfo(slot->device, &slot->info) == 0){
+                    slot->haveInfo = 1;
+                }else{
+                    closeSlotDevice(slot);
+                }
+            }
+        }
+        sendDeviceLine(client, slot);
+        for(job = slot->queue; job != NULL; job = job->next){
+            sendLine(client, "JOB %d %s %s %s %s", job->id, slot->name,
+                     job->verify ? "verify" : "flash",
+                     (job == slot->queue && slot->session != NULL) ? "running" : "queued", job->file);
+        }
+    }
+    sendLine(client, "END");
+}
+
+static void handleLine(client_t *client, char *line)
+{
+char    *cmd, *args;
+
+    cmd = strtok(line, " ");
+    args = strtok(NULL, "");
+    if(cmd == NULL)
+        return;
+    if(strcasecmp(cmd, "FLASH") == 0){
+        queueJob(client, 0, args != NULL ? args : "");
+    }else if(strcasecmp(cmd, "VERIFY") == 0){
+        queueJob(client, 1, args != NULL ? args : "");
+    }else if(strcasecmp(cmd, "CANCEL") == 0){
+        cancelJob(client, args);
+    }else if(strcasecmp(cmd, "STATUS") == 0){
+        sendStatus(client, 0);
+    }else if(strcasecmp(cmd, "SCAN") == 0){
+        sendStatus(client, 1);
+    }else{
+        sendLine(client, "ERR unknown command %s", cmd);
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void dropClient(client_t *client)
+{
+job_t   *job;
+int     i;
+
+    if(client->fd < 0)
+        return;
+    /* queued and running jobs continue without output */
+    for(i = 0; i < NUM_SLOTS; i++){
+        for(job = slots[i].queue; job != NULL; job = job->next){
+            if(job->client == client)
+                job->client = NULL;
+        }
+    }
+    close(client->fd);
+    client->fd = -1;
+}
+
+static void readClient(client_t *client)
+{
+int     len, i, start;
+
+    len = read(client->fd, client->in + client->inLen, sizeof(client->in) - 1 - client->inLen);
+    if(len <= 0){
+        if(len == 0)    /* may only have shut down its sending side */
+            flushClient(client, 1);
+        dropClient(client);
+        return;
+    }
+    client->inLen += len;
+    start = 0;
+    for(i = 0; i < client->inLen; i++){
+        if(client->in[i] == '\n'){
+            client->in[i] = 0;
+            if(i > start && client->in[i - 1] == '\r')
+                client->in[i - 1] = 0;
+            handleLine(client, client->in + start);
+            if(client->fd < 0)
+                return;
+            start = i + 1;
+        }
+    }
+    memmove(client->in, client->in + start, client->inLen - start);
+    client->inLen -= start;
+    if(client->inLen >= (int)sizeof(client->in) - 1){
+        sendLine(client, "ERR line too long");
+        if(client->fd >= 0)
+            flushClient(client, 1);
+        dropClient(client);
+    }
+}
+
+static void acceptClient(int listenFd)
+{
+struct timeval  tv = {SEND_TIMEOUT, 0};
+int             i, fd;
+
+    if((fd = accept(listenFd, NULL, NULL)) < 0)
+        return;
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    for(i = 0; i < MAX_CLIENTS; i++){
+        if(clients[i].fd < 0){
+            clients[i].fd = fd;
+            clients[i].inLen = 0;
+            clients[i].outLen = 0;
+            return;
+        }
+    }
+    close(fd);  /* too many clients */
+}
+
+static void onSignal(int sig)
+{
+    quitRequested = 1;
+}
+
+static int  runServer(void)
+{
+struct sockaddr_un  addr;
+struct pollfd       fds[MAX_CLIENTS + 1];
+client_t            *fdClient[MAX_CLIENTS + 1];
+int                 listenFd, i, n, timeout, t;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socketPath);
+    if((listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0){
+        fprintf(stderr, "socket: %s\n", strerror(errno));
+        return 1;
+    }
+    unlink(socketPath);
+    if(bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listenFd, 4) < 0){
+        fprintf(stderr, "cannot listen on %s: %s\n", socketPath, strerror(errno));
+        return 1;
+    }
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    signal(SIGPIPE, SIG_IGN);
+    for(i = 0; i < MAX_CLIENTS; i++)
+        clients[i].fd = -1;
+    printf("listening on %s\n", socketPath);
+    fflush(stdout);
+    while(!quitRequested){
+        fds[0].fd = listenFd;
+        fds[0].events = POLLIN;
+        n = 1;
+        for(i = 0; i < MAX_CLIENTS; i++){
+            if(clients[i].fd >= 0){
+                fds[n].fd = clients[i].fd;
+                fds[n].events = POLLIN | (clients[i].outLen > 0 ? POLLOUT : 0);
+                fdClient[n++] = &clients[i];
+            }
+        }
+        timeout = -1;
+        for(i = 0; i < NUM_SLOTS; i++){
+            if(slots[i].session != NULL && (t = bootSessionTimeout(slots[i].session)) >= 0){
+                if(timeout < 0 || t < timeout)
+                    timeout = t;
+            }
+        }
+        if(poll(fds, n, timeout) < 0){
+            if(errno == EINTR)
+                continue;
+            fprintf(stderr, "poll: %s\n", strerror(errno));
+            break;
+        }
+        if(fds[0].revents & POLLIN)
+            acceptClient(listenFd);
+        for(i = 1; i < n; i++){
+            if(fds[i].revents & POLLOUT)
+                flushClient(fdClient[i], 0);
+            if(fdClient[i]->fd >= 0 && (fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                readClient(fdClient[i]);
+        }
+        for(i = 0; i < NUM_SLOTS; i++){
+            if(slots[i].session != NULL && bootSessionTimeout(slots[i].session) == 0)
+                stepSlot(&slots[i]);
+        }
+        fflush(stdout);
+    }
+    /* restore the relay of a running remote job before we go */
+    for(i = 0; i < NUM_SLOTS; i++){
+        if(slots[i].session != NULL){
+            bootSessionCancel(slots[i].session);
+            bootSessionRun(slots[i].session);
+            bootSessionFree(slots[i].session);
+        }
+        closeSlotDevice(&slots[i]);
+    }
+    close(listenFd);
+    unlink(socketPath);
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* Sends the request given on the command line and prints the replies until
+ * the request is finished. File names are made absolute for the daemon.
+ */
+static int  runClient(int argc, char **argv)
+{
+struct sockaddr_un  addr;
+char                line[LINE_LEN + PATH_MAX], reply[LINE_LEN];
+char                path[PATH_MAX];
+int                 fd, i, len = 0, n, done = 0, rval = 1;
+FILE                *fp;
+
+    for(i = 0; i < argc; i++){
+        const char *arg = argv[i];
+        if(i == 0 && strcasecmp(arg, "scan") != 0 && strcasecmp(arg, "status") != 0 && strcasecmp(arg, "cancel") != 0
+           && strcasecmp(arg, "flash") != 0 && strcasecmp(arg, "verify") != 0){
+            fprintf(stderr, "unknown command %s\n", arg);
+            return 1;
+        }
+        if(i == argc - 1 && i >= 2 && arg[0] != '/' && realpath(arg, path) != NULL)
+            arg = path;
+        len += snprintf(line + len, sizeof(line) - len, "%s%s", i ? " " : "", arg);
+    }
+    line[len++] = '\n';
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socketPath);
+    if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0){
+        fprintf(stderr, "cannot connect to %s: %s\n", socketPath, strerror(errno));
+        return 1;
+    }
+    if(write(fd, line, len) != len){
+        fprintf(stderr, "cannot send request: %s\n", strerror(errno));
+        return 1;
+    }
+    fp = fdopen(fd, "r");
+    while(!done && fgets(reply, sizeof(reply), fp) != NULL){
+        fputs(reply, stdout);
+        fflush(stdout);
+        if(strncmp(reply, "END", 3) == 0 || strncmp(reply, "OK", 2) == 0){
+            rval = 0;
+            done = 1;
+        }else if(strncmp(reply, "ERR ", 4) == 0){
+            done = 1;
+        }else if(sscanf(reply, "DONE %*d %d", &n) == 1){
+            rval = n != 0;
+            done = 1;
+        }
+    }
+    fclose(fp);
+    return rval;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void printUsage(char *pname)
+{
+    fprintf(stderr, "usage: %s [-s <socket>]                  run daemon\n", pname);
+    fprintf(stderr, "       %s [-s <socket>] <request...>     send request to daemon\n", pname);
+    fprintf(stderr, "requests: flash local|remote[:<id>] [-r] [-f] <hexfile>, verify local <hexfile>,\n");
+    fprintf(stderr, "          cancel <job>, status, scan\n");
+}
+
+int main(int argc, char **argv)
+{
+static char defaultPath[PATH_MAX];
+const char  *dir;
+int         i = 1;
+
+    if((dir = getenv("XDG_RUNTIME_DIR")) != NULL){
+        snprintf(defaultPath, sizeof(defaultPath), "%s/bootloadhidd.sock", dir);
+    }else{
+        snprintf(defaultPath, sizeof(defaultPath), "/tmp/bootloadhidd-%u.sock", (unsigned)getuid());
+    }
+    socketPath = defaultPath;
+    if(i < argc && (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0)){
+        printUsage(argv[0]);
+        return 1;
+    }
+    if(i + 1 < argc && strcmp(argv[i], "-s") == 0){
+        socketPath = argv[i + 1];
+        i += 2;
+    }
+    if(i < argc)
+        return runClient(argc - i, argv + i);
+    return runServer();
+}
+
+/* ------------------------------------------------------------------------- */
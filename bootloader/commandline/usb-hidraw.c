@@ -0,0 +1,247 @@
+/* Name: usb-hidraw.c
+ * Project: usbcalls library
+ * Tabsize: 4
+ * License: Proprietary, free under certain conditions. See Documentation.
+ *
+ * For: usbXR project: https://github.com/visakhanc/usbXR
+ */
+
+/*
+General Description:
+This module implements USB HID report receiving/sending with the Linux hidraw
+interface. Unlike the libusb implementation, the kernel HID driver stays
+attached: devices are found through /sys/class/hidraw, opened as /dev/hidrawN
+and feature reports are transferred with the HIDIOCSFEATURE/HIDIOCGFEATURE
+ioctls. Input reports from the interrupt-in endpoint are read with read() on
+the same file descriptor, which can also be passed to poll()/epoll.
+
+No root privileges are required if the device node is accessible, e.g.
+through the udev rule in 99-usbxr.rules.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <linux/hidraw.h>
+
+#include "usbcalls.h"
+
+struct usbDevice {
+    int     fd;
+    int     usesReportIDs;
+    char    name[256];      /* hidrawN, for sysfs lookups */
+};
+
+/* ------------------------------------------------------------------------- */
+
+static int  errnoToUsbError(int err)
+{
+    switch(err){
+        case EACCES:
+        case EPERM:     return USB_ERROR_ACCESS;
+        case EBUSY:     return USB_ERROR_BUSY;
+        case ENOENT:
+        case ENODEV:
+        case ENXIO:     return USB_ERROR_NOTFOUND;
+        case EPIPE:     return USB_ERROR_STALL;
+        default:        return USB_ERROR_IO;
+    }
+}
+
+/* Reads a sysfs attribute of the USB device which owns the hidraw node. The
+ * hidraw 'device' link points to the HID device, its parent is the USB
+ * interface and the grandparent is the USB device with the string attributes.
+ * Returns 0 on success, -1 if the attribute does not exist (e.g. for virtual
+ * devices which are not on USB).
+ */
+static int  readUsbAttribute(const char *hidrawName, const char *attribute, char *buf, int buflen)
+{
+char    path[512];
+FILE    *fp;
+int     len;
+
+    snprintf(path, sizeof(path), "/sys/class/hidraw/%s/device/../../%s", hidrawName, attribute);
+    if((fp = fopen(path, "r")) == NULL)
+        return -1;
+    if(fgets(buf, buflen, fp) == NULL){
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    len = strlen(buf);
+    while(len > 0 && (buf[len - 1] == '\n' || buf[len - 1] == '\r'))
+        buf[--len] = 0;
+    return 0;
+}
+
+static int  namesMatch(int fd, const char *hidrawName, char *vendorName, char *productName)
+{
+char    string[256], expected[512];
+
+    if(readUsbAttribute(hidrawName, "manufacturer", string, sizeof(string)) == 0){
+        if(strcmp(string, vendorName) != 0)
+            return 0;
+        if(readUsbAttribute(hidrawName, "product", string, sizeof(string)) != 0)
+            return 0;
+        return strcmp(string, productName) == 0;
+    }
+    /* No USB parent in sysfs: compare against the name the HID core builds
+     * from manufacturer and product string ("manufacturer product").
+     */
+    if(ioctl(fd, HIDIOCGRAWNAME(sizeof(string)), string) < 0)
+        return 0;
+    string[sizeof(string) - 1] = 0;
+    snprintf(expected, sizeof(expected), "%s %s", vendorName, productName);
+    return strcmp(string, expected) == 0;
+}
+
+int usbOpenDevice(usbDevice_t **device, int vendor, char *vendorName, int product, char *productName, int usesReportIDs)
+{
+DIR                     *dir;
+struct dirent           *entry;
+struct hidraw_devinfo   info;
+int                     fd = -1;
+int                     errorCode = USB_ERROR_NOTFOUND;
+char                    hidrawName[256];
+
+    if((dir = opendir("/sys/class/hidraw")) == NULL){
+        fprintf(stderr, "Warning: cannot read /sys/class/hidraw: %s\n", strerror(errno));
+        return USB_ERROR_NOTFOUND;
+    }
+    while((entry = readdir(dir)) != NULL){
+        char    path[300];
+        if(strncmp(entry->d_name, "hidraw", 6) != 0)
+            continue;
+        snprintf(hidrawName, sizeof(hidrawName), "%s", entry->d_name);
+        snprintf(path, sizeof(path), "/dev/%s", entry->d_name);
+        if((fd = open(path, O_RDWR | O_CLOEXEC)) < 0){
+            /* we cannot query the IDs without opening; remember why it failed */
+            if(errno == EACCES || errno == EPERM)
+                errorCode = USB_ERROR_ACCESS;
+            continue;
+        }
+        if(ioctl(fd, HIDIOCGRAWINFO, &info) == 0 && (info.vendor & 0xffff) == vendor && (info.product & 0xffff) == product){
+            if(vendorName == NULL && productName == NULL)   /* name does not matter */
+                break;
+            errorCode = USB_ERROR_NOTFOUND;
+            if(namesMatch(fd, entry->d_name, vendorName, productName))
+                break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    closedir(dir);
+    if(fd >= 0){
+        usbDevice_t *dev = malloc(sizeof(usbDevice_t));
+        if(dev == NULL){
+            close(fd);
+            return USB_ERROR_IO;
+        }
+        dev->fd = fd;
+        dev->usesReportIDs = usesReportIDs;
+        snprintf(dev->name, sizeof(dev->name), "%s", hidrawName);
+        *device = dev;
+        errorCode = 0;
+    }
+    return errorCode;
+}
+
+/* ------------------------------------------------------------------------- */
+
+void    usbCloseDevice(usbDevice_t *device)
+{
+    if(device != NULL){
+        close(device->fd);
+        free(device);
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+
+int usbGetSerialNumber(usbDevice_t *device, char *buffer, int len)
+{
+    if(readUsbAttribute(device->name, "serial", buffer, len) == 0 && buffer[0] != 0)
+        return 0;
+#ifdef HIDIOCGRAWUNIQ
+    /* devices without USB parent (e.g. uhid) only have the HID unique ID */
+    if(ioctl(device->fd, HIDIOCGRAWUNIQ(len), buffer) >= 0){
+        buffer[len - 1] = 0;
+        if(buffer[0] != 0)
+            return 0;
+    }
+#endif
+    return USB_ERROR_NOTFOUND;
+}
+
+/* ------------------------------------------------------------------------- */
+
+int usbGetPollHandle(usbDevice_t *device)
+{
+    return device->fd;
+}
+
+/* ------------------------------------------------------------------------- */
+
+int usbSetReport(usbDevice_t *device, int reportType, char *buffer, int len)
+{
+int bytesSent;
+
+    /* hidraw expects the report ID (or 0 if report IDs are not used) in the
+     * first byte, which is exactly our buffer format.
+     */
+    switch(reportType){
+    case USB_HID_REPORT_TYPE_OUTPUT:
+        bytesSent = write(device->fd, buffer, len);
+        break;
+    case USB_HID_REPORT_TYPE_FEATURE:
+        bytesSent = ioctl(device->fd, HIDIOCSFEATURE(len), buffer);
+        break;
+    default:
+        return USB_ERROR_IO;
+    }
+    if(bytesSent < 0)
+        return errnoToUsbError(errno);
+    return bytesSent == len ? 0 : USB_ERROR_IO;
+}
+
+/* ------------------------------------------------------------------------- */
+
+int usbGetReport(usbDevice_t *device, int reportType, int reportNumber, char *buffer, int *len)
+{
+int bytesReceived;
+
+    switch(reportType){
+    case USB_HID_REPORT_TYPE_INPUT:
+        if(device->usesReportIDs){
+            bytesReceived = read(device->fd, buffer, *len);
+        }else{  /* make room for dummy report ID */
+            bytesReceived = read(device->fd, buffer + 1, *len - 1);
+            if(bytesReceived >= 0){
+                buffer[0] = reportNumber;
+                bytesReceived++;
+            }
+        }
+        break;
+    case USB_HID_REPORT_TYPE_FEATURE:
+        buffer[0] = device->usesReportIDs ? reportNumber : 0;
+        bytesReceived = ioctl(device->fd, HIDIOCGFEATURE(*len), buffer);
+        if(bytesReceived >= 0 && !device->usesReportIDs)
+            buffer[0] = reportNumber;  /* add dummy report ID */
+        break;
+    default:
+        return USB_ERROR_IO;
+    }
+    if(bytesReceived < 0){
+        fprintf(stderr, "Error sending message: %s\n", strerror(errno));
+        return errnoToUsbError(errno);
+    }
+    *len = bytesReceived;
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
@@ -25,6 +25,7 @@ devices differ in report ID usage, you must change the code.
 
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include <usb.h>
 
 #define usbDevice   usb_dev_handle  /* use libusb's device structure */
@@ -158,6 +159,28 @@ void    usbCloseDevice(usbDevice_t *device)
 
 /* ------------------------------------------------------------------------- */
 
+int usbGetSerialNumber(usbDevice_t *device, char *buffer, int len)
+{
+int index = usb_device(device)->descriptor.iSerialNumber;
+
+    if(index == 0)
+        return USB_ERROR_NOTFOUND;
+    if(usbGetStringAscii(device, index, 0x0409, buffer, len - 1) < 0){
+        fprintf(stderr, "Warning: cannot query serial number: %s\n", usb_strerror());
+        return USB_ERROR_IO;
+    }
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+int usbGetPollHandle(usbDevice_t *device)
+{
+    return -1;  /* libusb 0.1 has no pollable descriptor */
+}
+
+/* ------------------------------------------------------------------------- */
+
 int usbSetReport(usbDevice_t *device, int reportType, char *buffer, int len)
 {
 int bytesSent;
@@ -167,11 +190,8 @@ int bytesSent;
         len--;
     }
     bytesSent = usb_control_msg(device, USB_TYPE_CLASS | USB_RECIP_INTERFACE | USB_ENDPOINT_OUT, USBRQ_HID_SET_REPORT, reportType << 8 | buffer[0], 0, buffer, len, 5000);
-    if(bytesSent != len){
-        if(bytesSent < 0)
-            fprintf(stderr, "Error sending message: %s\n", usb_strerror());
-        return USB_ERROR_IO;
-    }
+    if(bytesSent != len)    /* libusb 0.1 returns -errno */
+        return bytesSent == -EPIPE ? USB_ERROR_STALL : USB_ERROR_IO;
     return 0;
 }
 
@@ -133,6 +133,28 @@ void    usbCloseDevice(usbDevice_t *device)
 
 /* ------------------------------------------------------------------------ */
 
+int usbGetSerialNumber(usbDevice_t *device, char *buffer, int len)
+{
+char    uniBuffer[512];
+
+    if(!HidD_GetSerialNumberString((HANDLE)device, uniBuffer, sizeof(uniBuffer)))
+        return USB_ERROR_NOTFOUND;
+    convertUniToAscii(uniBuffer);
+    if(uniBuffer[0] == 0)
+        return USB_ERROR_NOTFOUND;
+    snprintf(buffer, len, "%s", uniBuffer);
+    return 0;
+}
+
+/* ------------------------------------------------------------------------ */
+
+int usbGetPollHandle(usbDevice_t *device)
+{
+    return -1;  /* use ReadFile() on the device handle instead */
+}
+
+/* ------------------------------------------------------------------------ */
+
 int usbSetReport(usbDevice_t *device, int reportType, char *buffer, int len)
 {
 HANDLE  handle = (HANDLE)device;
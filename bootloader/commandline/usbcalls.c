@@ -14,6 +14,8 @@
 
 #if defined(WIN32)
 #   include "usb-windows.c"
+#elif defined(__linux__) && !defined(USE_LIBUSB)
+#   include "usb-hidraw.c"
 #else
 /* e.g. defined(__APPLE__) */
 #   include "usb-libusb.c"
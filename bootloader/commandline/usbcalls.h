@@ -15,7 +15,8 @@
 General Description:
 This module implements an abstraction layer for access to USB/HID communication
 functions. An implementation based on libusb (portable to Linux, FreeBSD and
-Mac OS X) and a native implementation for Windows are provided.
+Mac OS X), one based on the Linux hidraw interface and a native implementation
+for Windows are provided.
 */
 
 /* ------------------------------------------------------------------------ */
@@ -30,8 +31,12 @@ Mac OS X) and a native implementation for Windows are provided.
 #define USB_ERROR_NOTFOUND  2
 #define USB_ERROR_BUSY      16
 #define USB_ERROR_IO        5
+#define USB_ERROR_STALL     32
 /* These are the error codes which can be returned by functions of this
- * module.
+ * module. USB_ERROR_STALL means the device refused the request; the relay and
+ * the bridge use it as back pressure while their queues are full, so it is
+ * not reported by this module. Callers print errors which they treat as
+ * fatal.
  */
 
 /* ------------------------------------------------------------------------ */
@@ -75,6 +80,19 @@ int usbGetReport(usbDevice_t *device, int reportType, int reportID, char *buffer
  * in '*len'.
  * Returns: 0 on success, an error code otherwise.
  */
+int usbGetSerialNumber(usbDevice_t *device, char *buffer, int len);
+/* This function copies the serial number string of the device (converted to
+ * ISO Latin1) to 'buffer', which has room for 'len' bytes including the
+ * terminating 0.
+ * Returns: 0 on success, USB_ERROR_NOTFOUND if the device has no serial
+ * number or another error code.
+ */
+int usbGetPollHandle(usbDevice_t *device);
+/* This function returns a file descriptor which becomes readable when an
+ * input report from the interrupt-in endpoint is available. It can be passed
+ * to poll(), select() or epoll in order to multiplex several devices.
+ * Returns: the file descriptor or -1 if the implementation has none.
+ */
 
 /* ------------------------------------------------------------------------ */
 
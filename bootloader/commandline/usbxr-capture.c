@@ -0,0 +1,402 @@
+/* Name: usbxr-capture.c
+ * Project: AVR bootloader HID
+ * Tabsize: 4
+ * License: Proprietary, free under certain conditions. See Documentation.
+ *
+ * For: usbXR project: https://github.com/visakhanc/usbXR
+ */
+
+/*
+General Description:
+usbxr-capture turns the bridge application (firmware/) into a sniffer: the
+radio listens without sending ACKs on one channel and address (report 5) and
+every packet is written to a pcap file and printed, decoded as Enhanced
+ShockBurst frame and, where it matches, as remote boot protocol message
+(bootloader_defs.h) or usbxr-ping echo:
+
+    usbxr-capture -c 100 -a fc:fc:fc:fc:fc -w boot.pcap
+    usbxr-capture -r boot.pcap
+
+The pcap file uses link type LINKTYPE_USER0 (147). Each packet is
+[channel, address width, address (CONFIG_RF24_ADDRESS order), raw bits],
+the raw bits as sent by the bridge: packet control field, payload and CRC
+following the address, not byte aligned. The frame is checked offline, so
+packets with a bad CRC are kept and marked.
+
+The bridge timestamps packets with a 16 bit counter; it is extended here
+with the help of the host clock, which only needs to be good to half a wrap
+(175 ms). Low speed USB carries about 8 kB/s, several hundred short packets
+per second; more are dropped by the bridge and counted in its report 3.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <poll.h>
+#endif
+
+#include "usbcalls.h"
+#include "../firmware/bootloader_defs.h"
+#include "../../firmware/bridge_defs.h"
+
+#define IDENT_VENDOR_NUM        0x16c0
+#define IDENT_VENDOR_STRING     "obdev.at"
+#define IDENT_PRODUCT_NUM       1503
+#define IDENT_PRODUCT_STRING    "usbXR Bridge"
+
+#define LINKTYPE_USER0      147
+#define MAX_ADDR_WIDTH      5
+#define MAX_PACKET          (2 + MAX_ADDR_WIDTH + BRIDGE_CAPTURE_RAW)
+
+typedef struct pcapHeader {
+    uint32_t    magic;
+    uint16_t    versionMajor;
+    uint16_t    versionMinor;
+    int32_t     thisZone;
+    uint32_t    sigFigs;
+    uint32_t    snapLen;
+    uint32_t    linkType;
+} pcapHeader_t;
+
+typedef struct pcapRecord {
+    uint32_t    tsSec;
+    uint32_t    tsUsec;
+    uint32_t    inclLen;
+    uint32_t    origLen;
+} pcapRecord_t;
+
+static volatile int quit;
+
+/* ------------------------------------------------------------------------- */
+
+static int64_t  timeUs(void)
+{
+#ifdef WIN32
+    static LARGE_INTEGER    freq;
+    LARGE_INTEGER           t;
+
+    if(freq.QuadPart == 0)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t);
+    return t.QuadPart * 1000000 / freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * (int64_t)1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* Returns 'n' bits (up to 16) from bit position 'pos', MSB first as on air. */
+static unsigned getBits(const unsigned char *raw, int pos, int n)
+{
+unsigned    value = 0;
+
+    while(n--){
+        value = (value << 1) | ((raw[pos >> 3] >> (7 - (pos & 7))) & 1);
+        pos++;
+    }
+    return value;
+}
+
+static unsigned crcBits(unsigned crc, unsigned value, int n)
+{
+    while(n--){
+        if(((crc >> 15) ^ (value >> n)) & 1){
+            crc = (crc << 1) ^ 0x1021;
+        }else{
+            crc <<= 1;
+        }
+        crc &= 0xffff;
+    }
+    return crc;
+}
+
+/* Decodes the remote boot protocol and usbxr-ping messages. */
+static void decodePayload(const unsigned char *p, int len, char *out, int size)
+{
+static const char   *cmdNames[] = {"START", "RESET", "STOP", "END", "TXMODE", "UPDATE", "PAGECRC", "POLL"};
+const char          *status;
+int                 i, n;
+
+    if(len == 0){
+        snprintf(out, size, "ACK");
+    }else if(len >= 1 && (p[0] == BRIDGE_ECHO_REQUEST || p[0] == BRIDGE_ECHO_POLL)){
+        snprintf(out, size, p[0] == BRIDGE_ECHO_POLL ? "ECHO POLL" : "ECHO REQUEST seq %d", len > 1 ? p[1] : 0);
+    }else if(len >= 2 && p[1] >= CMD_OTA_BOOT_START && p[1] <= CMD_OTA_BOOT_POLL){
+        n = snprintf(out, size, "CMD %s dev 0x%02x", cmdNames[p[1] - CMD_OTA_BOOT_START], p[0]);
+        if(p[1] == CMD_OTA_BOOT_PAGECRC && len >= 6)
+            snprintf(out + n, size - n, " addr 0x%04x len %d", p[2] | (p[3] << 8), p[4] | (p[5] << 8));
+    }else if(len >= 3 && (p[1] == STATUS_TYPE_BOOT || p[1] == STATUS_TYPE_DEVINFO)){
+        status = p[2] == STATUS_OTA_BOOT_REQ ? "REQ" : p[2] == STATUS_OTA_BOOT_READY ? "READY" : p[2] == STATUS_OTA_BOOT_OK ? "OK" : "?";
+        n = snprintf(out, size, "STATUS %s dev 0x%02x %s", p[1] == STATUS_TYPE_BOOT ? "BOOT" : "DEVINFO", p[0], status);
+        if(p[1] == STATUS_TYPE_DEVINFO && len >= 5)
+            snprintf(out + n, size - n, " page %d flash %d KB", p[3] * 2, p[4]);
+    }else if(len >= 6 && p[1] == STATUS_TYPE_PAGECRC){
+        snprintf(out, size, "STATUS PAGECRC dev 0x%02x addr 0x%04x crc 0x%04x", p[0], p[2] | (p[3] << 8), p[4] | (p[5] << 8));
+    }else if(len == 19){
+        snprintf(out, size, "DATA addr 0x%06x", p[0] | (p[1] << 8) | (p[2] << 16));
+    }else{
+        n = snprintf(out, size, "DATA");
+        for(i = 0; i < len && n < size - 4; i++)
+            n += snprintf(out + n, size - n, " %02x", p[i]);
+    }
+}
+
+/* Decodes one captured packet (pcap record data) into a line of text. */
+static void decodePacket(const unsigned char *pkt, int len, char *out, int size)
+{
+const unsigned char *addr = pkt + 2, *raw;
+unsigned char       payload[32];
+int                 width, rawLen, plen, pid, noAck, i, n;
+unsigned            crc = 0xffff;
+
+    width = pkt[1];
+    raw = addr + width;
+    rawLen = len - 2 - width;
+    if(len < 2 || width < 2 || width > MAX_ADDR_WIDTH || rawLen < 2){
+        snprintf(out, size, "malformed record");
+        return;
+    }
+    plen = getBits(raw, 0, 6);
+    pid = getBits(raw, 6, 2);
+    noAck = getBits(raw, 8, 1);
+    n = snprintf(out, size, "ch %3d len %2d pid %d%s ", pkt[0], plen, pid, noAck ? " noack" : "");
+    if(plen > 32){
+        snprintf(out + n, size - n, "invalid length");
+        return;
+    }
+    for(i = 0; i < plen && 9 + 8 * i + 8 <= rawLen * 8; i++)
+        payload[i] = getBits(raw, 9 + 8 * i, 8);
+    if(9 + 8 * plen + 16 > rawLen * 8){
+        n += snprintf(out + n, size - n, "truncated: ");
+        plen = i;
+    }else{
+        for(i = width - 1; i >= 0; i--)    /* the address goes out last byte first */
+            crc = crcBits(crc, addr[i], 8);
+        crc = crcBits(crc, getBits(raw, 0, 9), 9);
+        for(i = 0; i < plen; i++)
+            crc = crcBits(crc, payload[i], 8);
+        if(crc != getBits(raw, 9 + 8 * plen, 16))
+            n += snprintf(out + n, size - n, "BAD CRC: ");
+    }
+    decodePayload(payload, plen, out + n, size - n);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static int  readCapture(char *file)
+{
+FILE            *fp;
+pcapHeader_t    hdr;
+pcapRecord_t    rec;
+unsigned char   pkt[256];
+char            line[256];
+long            count = 0;
+
+    if((fp = fopen(file, "rb")) == NULL){
+        perror(file);
+        return 1;
+    }
+    if(fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != 0xa1b2c3d4 || hdr.linkType != LINKTYPE_USER0){
+        fprintf(stderr, "%s: not a usbxr-capture file\n", file);
+        fclose(fp);
+        return 1;
+    }
+    while(fread(&rec, sizeof(rec), 1, fp) == 1 && rec.inclLen <= sizeof(pkt)){
+        if(fread(pkt, 1, rec.inclLen, fp) != rec.inclLen)
+            break;
+        decodePacket(pkt, rec.inclLen, line, sizeof(line));
+        printf("%10u.%06u  %s\n", rec.tsSec, rec.tsUsec, line);
+        count++;
+    }
+    fclose(fp);
+    printf("%ld packets\n", count);
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static int  setCapture(usbDevice_t *dev, int mode, int channel, unsigned char *addr, int width)
+{
+char    report[BRIDGE_CAPTURE_SIZE] = {BRIDGE_REPORT_CAPTURE};
+
+    report[1] = mode;
+    report[2] = channel;
+    report[3] = width;
+    memcpy(report + 4, addr, width);
+    return usbSetReport(dev, USB_HID_REPORT_TYPE_FEATURE, report, sizeof(report));
+}
+
+/* Reads one input report. Returns its length, 0 on timeout or -1 on error. */
+static int  readReport(usbDevice_t *dev, unsigned char *buffer)
+{
+int     len = BRIDGE_IN_REPORT_SIZE;
+#ifndef WIN32
+int     fd = usbGetPollHandle(dev);
+
+    if(fd >= 0){
+        struct pollfd   pfd = {.fd = fd, .events = POLLIN};
+        if(poll(&pfd, 1, 100) <= 0)
+            return 0;
+    }
+#endif
+    if(usbGetReport(dev, USB_HID_REPORT_TYPE_INPUT, BRIDGE_REPORT_DATA, (char *)buffer, &len) != 0)
+        return -1;
+    return len;
+}
+
+static void signalHandler(int sig)
+{
+    quit = 1;
+}
+
+static int  capture(int channel, unsigned char *addr, int width, char *file, long maxCount, int quiet)
+{
+usbDevice_t     *dev;
+FILE            *fp = NULL;
+pcapHeader_t    hdr = {0xa1b2c3d4, 2, 4, 0, 0, MAX_PACKET, LINKTYPE_USER0};
+pcapRecord_t    rec;
+unsigned char   report[BRIDGE_IN_REPORT_SIZE], pkt[MAX_PACKET], *r;
+char            line[256];
+int             err, len, pos, end, rlen;
+long            count = 0;
+int64_t         hostUs, lastHostUs = 0, ticks = 0, firstTicks = 0, delta, wraps, us;
+time_t          startTime = 0;
+
+    if((err = usbOpenDevice(&dev, IDENT_VENDOR_NUM, IDENT_VENDOR_STRING, IDENT_PRODUCT_NUM, IDENT_PRODUCT_STRING, 1)) != 0){
+        fprintf(stderr, "Error opening %s: %s\n", IDENT_PRODUCT_STRING, err == USB_ERROR_ACCESS ? "Access denied" : "Device not found");
+        return 1;
+    }
+    if(file != NULL){
+        if((fp = fopen(file, "wb")) == NULL){
+            perror(file);
+            usbCloseDevice(dev);
+            return 1;
+        }
+        fwrite(&hdr, sizeof(hdr), 1, fp);
+    }
+    if(setCapture(dev, 1, channel, addr, width) != 0){
+        fprintf(stderr, "Error starting capture mode\n");
+        usbCloseDevice(dev);
+        return 1;
+    }
+    signal(SIGINT, signalHandler);
+    signal(SIGTERM, signalHandler);
+    printf("Capturing on channel %d, press Ctrl-C to stop\n", channel);
+    while(!quit && (maxCount == 0 || count < maxCount)){
+        if((len = readReport(dev, report)) < 0){
+            fprintf(stderr, "Error reading input report\n");
+            break;
+        }
+        hostUs = timeUs();
+        end = 2 + report[1];
+        if(len < 2 || end > len)
+            continue;
+        for(pos = 2; pos < end; pos += 1 + rlen){
+            r = report + pos;
+            rlen = BRIDGE_RECORD_LEN(*r);
+            if(BRIDGE_RECORD_PIPE(*r) != BRIDGE_PIPE_CAPTURE || rlen < 3)
+                continue;
+            /* extend the 16 bit timestamp: the host clock tells the number of wraps */
+            delta = ((r[1] | (r[2] << 8)) - ticks) & 0xffff;
+            if(count > 0){
+                wraps = ((hostUs - lastHostUs) * BRIDGE_TICK_HZ / 1000000 - delta + 0x8000) / 0x10000;
+                ticks += delta + (wraps > 0 ? wraps * 0x10000 : 0);
+            }else{
+                ticks = firstTicks = r[1] | (r[2] << 8);
+                startTime = time(NULL);
+            }
+            lastHostUs = hostUs;
+            pkt[0] = channel;
+            pkt[1] = width;
+            memcpy(pkt + 2, addr, width);
+            memcpy(pkt + 2 + width, r + 3, rlen - 2);
+            rec.inclLen = rec.origLen = 2 + width + rlen - 2;
+            us = (ticks - firstTicks) * 1000000 / BRIDGE_TICK_HZ;
+            rec.tsSec = startTime + us / 1000000;
+            rec.tsUsec = us % 1000000;
+            if(fp != NULL){
+                fwrite(&rec, sizeof(rec), 1, fp);
+                fwrite(pkt, 1, rec.inclLen, fp);
+            }
+            if(!quiet){
+                decodePacket(pkt, rec.inclLen, line, sizeof(line));
+                printf("%10u.%06u  %s\n", rec.tsSec, rec.tsUsec, line);
+            }
+            count++;
+        }
+    }
+    setCapture(dev, 0, channel, addr, width);
+    usbCloseDevice(dev);
+    if(fp != NULL)
+        fclose(fp);
+    printf("%ld packets captured\n", count);
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static int  parseAddress(char *s, unsigned char *addr)
+{
+int     width = 0;
+char    *end;
+
+    while(*s && width < MAX_ADDR_WIDTH){
+        addr[width++] = strtoul(s, &end, 16);
+        if(end == s)
+            return 0;
+        s = *end == ':' ? end + 1 : end;
+    }
+    return *s ? 0 : width;
+}
+
+static void printUsage(char *pname)
+{
+    fprintf(stderr, "usage: %s [-c <channel>] [-a <address>] [-w <file>] [-n <count>] [-q]\n", pname);
+    fprintf(stderr, "       %s -r <file>\n", pname);
+    fprintf(stderr, "  -c   RF channel (default 100)\n");
+    fprintf(stderr, "  -a   address, 2..5 hex bytes in CONFIG_RF24_ADDRESS order (default fc:fc:fc:fc:fc)\n");
+    fprintf(stderr, "  -w   write packets to pcap file\n");
+    fprintf(stderr, "  -n   stop after <count> packets\n");
+    fprintf(stderr, "  -q   don't print packets\n");
+    fprintf(stderr, "  -r   decode a capture file\n");
+}
+
+int main(int argc, char **argv)
+{
+unsigned char   addr[MAX_ADDR_WIDTH] = {0xfc, 0xfc, 0xfc, 0xfc, 0xfc};
+int             opt, channel = 100, width = 5, quiet = 0;
+char            *file = NULL, *readFile = NULL;
+long            maxCount = 0;
+
+    while((opt = getopt(argc, argv, "c:a:w:n:qr:h")) != -1){
+        switch(opt){
+        case 'c': channel = atoi(optarg); break;
+        case 'a': width = parseAddress(optarg, addr); break;
+        case 'w': file = optarg; break;
+        case 'n': maxCount = atol(optarg); break;
+        case 'q': quiet = 1; break;
+        case 'r': readFile = optarg; break;
+        default:
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if(readFile != NULL)
+        return readCapture(readFile);
+    if(channel < 0 || channel > 125 || width < 2){
+        printUsage(argv[0]);
+        return 1;
+    }
+    return capture(channel, addr, width, file, maxCount, quiet);
+}
@@ -0,0 +1,280 @@
+/* Name: usbxr-ping.c
+ * Project: AVR bootloader HID
+ * Tabsize: 4
+ * License: Proprietary, free under certain conditions. See Documentation.
+ *
+ * For: usbXR project: https://github.com/visakhanc/usbXR
+ */
+
+/*
+General Description:
+usbxr-ping measures the round trip time from the host through usbXR to a
+remote node and back. It talks to the bridge application (firmware/) and
+needs a remote which supports the echo protocol of bridge_defs.h: every
+sample sends an echo request and a poll packet, the remote returns the
+request in the ACK of the poll and the bridge passes it up as input report.
+
+The bridge reports the air time of both packets (BRIDGE_EVENT_TX records), so
+the round trip time is split into radio time and the rest (USB transfers,
+scheduling on host and bridge), reported as "usb":
+
+    usbxr-ping -c 1000 -s 32
+
+Input reports are read with poll() on the handle of usbGetPollHandle(), so
+only backends which have one (Linux hidraw) are supported. The others read
+report 1 with GET_REPORT, which returns no data instead of waiting for the
+next input report, so every sample would spin until its timeout; usbxr-ping
+refuses to run there. usbxr-sim -b emulates bridge and remote for tests
+without hardware.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#include <poll.h>
+#endif
+
+#include "usbcalls.h"
+#include "../../firmware/bridge_defs.h"
+
+#define IDENT_VENDOR_NUM        0x16c0
+#define IDENT_VENDOR_STRING     "obdev.at"
+#define IDENT_PRODUCT_NUM       1503
+#define IDENT_PRODUCT_STRING    "usbXR Bridge"
+
+#define SEND_RETRIES    100     /* report 2 is stalled while the TX queue is full, 1 ms apart */
+
+typedef struct sample {
+    long    rtt;    /* microseconds */
+    long    radio;
+} sample_t;
+
+static int  payloadSize = 8;
+static int  count = 1000;
+static int  intervalMs = 0;
+static int  timeoutMs = 100;
+static int  verbose = 0;
+
+/* ------------------------------------------------------------------------- */
+
+static long timeUs(void)
+{
+#ifdef WIN32
+    static LARGE_INTEGER    freq;
+    LARGE_INTEGER           t;
+
+    if(freq.QuadPart == 0)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t);
+    return (long)(t.QuadPart * 1000000 / freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+#endif
+}
+
+static void sleep_ms(int milliseconds)
+{
+#ifdef WIN32
+    Sleep(milliseconds);
+#else
+    usleep(milliseconds * 1000);
+#endif
+}
+
+/* ------------------------------------------------------------------------- */
+
+static int  sendPacket(usbDevice_t *dev, unsigned char *payload, int len)
+{
+char    report[2 + BRIDGE_MAX_PAYLOAD];
+int     i, err = 0;
+
+    report[0] = BRIDGE_REPORT_SEND;
+    report[1] = len | BRIDGE_SEND_EVENT;
+    memcpy(report + 2, payload, len);
+    for(i = 0; i < SEND_RETRIES; i++){
+        if((err = usbSetReport(dev, USB_HID_REPORT_TYPE_OUTPUT, report, 2 + len)) == 0)
+            break;
+        sleep_ms(1);    /* the bridge sends one packet per air time */
+    }
+    if(err != 0)
+        fprintf(stderr, "Error sending packet: %s\n", err == USB_ERROR_STALL ? "bridge queue full" : "USB error");
+    return err;
+}
+
+/* Reads one input report. Returns its length, 0 on timeout or -1 on error. */
+static int  readReport(usbDevice_t *dev, unsigned char *buffer, int timeout)
+{
+int     len = BRIDGE_IN_REPORT_SIZE;
+#ifndef WIN32
+struct pollfd   pfd = {.fd = usbGetPollHandle(dev), .events = POLLIN};  /* checked by main() */
+
+    if(poll(&pfd, 1, timeout) <= 0)
+        return 0;
+#endif
+    if(usbGetReport(dev, USB_HID_REPORT_TYPE_INPUT, BRIDGE_REPORT_DATA, (char *)buffer, &len) != 0)
+        return -1;
+    return len;
+}
+
+/* Runs one sample. Returns 1 with the times in 's' if the echo came back, 0
+ * if it was lost or -1 on a USB error.
+ */
+static int  pingOnce(usbDevice_t *dev, int seq, sample_t *s)
+{
+unsigned char   request[BRIDGE_MAX_PAYLOAD], poll = BRIDGE_ECHO_POLL;
+unsigned char   report[BRIDGE_IN_REPORT_SIZE], *rec;
+int             i, len, pos, end, events = 0, echoed = 0, failed = 0;
+long            start, now;
+
+    while(readReport(dev, report, 0) > 0)   /* drop leftovers of lost samples */
+        ;
+    request[0] = BRIDGE_ECHO_REQUEST;
+    request[1] = seq;
+    for(i = 2; i < payloadSize; i++)
+        request[i] = i;
+    s->radio = 0;
+    start = timeUs();
+    if(sendPacket(dev, request, payloadSize) != 0 || sendPacket(dev, &poll, 1) != 0)
+        return -1;
+    while(events < 2 || (!echoed && !failed)){
+        now = timeUs();
+        if(now - start >= timeoutMs * 1000L)
+            return 0;
+        if((len = readReport(dev, report, timeoutMs - (now - start) / 1000)) < 0)
+            return -1;
+        now = timeUs();
+        end = 2 + report[1];
+        if(len < 2 || end > len)
+            continue;
+        for(pos = 2; pos < end; pos += 1 + BRIDGE_RECORD_LEN(*rec)){
+            rec = report + pos;
+            if(BRIDGE_RECORD_PIPE(*rec) == BRIDGE_PIPE_EVENT){
+                if(rec[1] != BRIDGE_EVENT_TX)
+                    continue;
+                events++;
+                if(rec[3] != 0)
+                    failed = 1;
+                s->radio += (rec[4] | (rec[5] << 8)) * 1000000L / BRIDGE_TICK_HZ;
+            }else if(BRIDGE_RECORD_PIPE(*rec) == 0 && BRIDGE_RECORD_LEN(*rec) == payloadSize
+                     && rec[1] == BRIDGE_ECHO_REQUEST && rec[2] == (seq & 0xff)){
+                echoed = 1;
+                s->rtt = now - start;
+            }
+        }
+    }
+    return echoed;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static int  compareLong(const void *a, const void *b)
+{
+long    x = *(const long *)a, y = *(const long *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void printStats(const char *name, long *values, int n)
+{
+long    sum = 0;
+int     i;
+
+    qsort(values, n, sizeof(long), compareLong);
+    for(i = 0; i < n; i++)
+        sum += values[i];
+    printf("%-5s min/avg/p99/max = %.3f/%.3f/%.3f/%.3f ms\n", name, values[0] / 1000.0,
+           sum / 1000.0 / n, values[(n * 99 - 1) / 100] / 1000.0, values[n - 1] / 1000.0);
+}
+
+static void printUsage(char *pname)
+{
+    fprintf(stderr, "usage: %s [-c <count>] [-s <size>] [-i <ms>] [-w <ms>] [-v]\n", pname);
+    fprintf(stderr, "  -c   number of samples (default %d)\n", count);
+    fprintf(stderr, "  -s   payload size in bytes, 2..%d (default %d)\n", BRIDGE_MAX_PAYLOAD, payloadSize);
+    fprintf(stderr, "  -i   pause between samples in ms (default %d)\n", intervalMs);
+    fprintf(stderr, "  -w   timeout per sample in ms (default %d)\n", timeoutMs);
+    fprintf(stderr, "  -v   print every sample\n");
+}
+
+int main(int argc, char **argv)
+{
+usbDevice_t *dev;
+sample_t    sample;
+long        *rtt, *radio, *usb;
+int         opt, i, n = 0, lost = 0, rval, err;
+
+    while((opt = getopt(argc, argv, "c:s:i:w:vh")) != -1){
+        switch(opt){
+        case 'c': count = atoi(optarg); break;
+        case 's': payloadSize = atoi(optarg); break;
+        case 'i': intervalMs = atoi(optarg); break;
+        case 'w': timeoutMs = atoi(optarg); break;
+        case 'v': verbose = 1; break;
+        default:
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if(count < 1 || payloadSize < 2 || payloadSize > BRIDGE_MAX_PAYLOAD || timeoutMs < 1){
+        printUsage(argv[0]);
+        return 1;
+    }
+    if((err = usbOpenDevice(&dev, IDENT_VENDOR_NUM, IDENT_VENDOR_STRING, IDENT_PRODUCT_NUM, IDENT_PRODUCT_STRING, 1)) != 0){
+        fprintf(stderr, "Error opening %s: %s\n", IDENT_PRODUCT_STRING, err == USB_ERROR_ACCESS ? "Access denied" : "Device not found");
+        return 1;
+    }
+    if(usbGetPollHandle(dev) < 0){
+        fprintf(stderr, "%s needs a USB backend with input report polling (Linux hidraw)\n", argv[0]);
+        usbCloseDevice(dev);
+        return 1;
+    }
+    rtt = malloc(count * sizeof(long));
+    radio = malloc(count * sizeof(long));
+    usb = malloc(count * sizeof(long));
+    if(rtt == NULL || radio == NULL || usb == NULL){
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    printf("PING %s: %d bytes, %d samples\n", IDENT_PRODUCT_STRING, payloadSize, count);
+    for(i = 0; i < count; i++){
+        if((rval = pingOnce(dev, i, &sample)) < 0){
+            fprintf(stderr, "USB error in sample %d\n", i);
+            break;
+        }
+        if(rval == 0){
+            lost++;
+            if(verbose)
+                printf("seq=%d lost\n", i);
+        }else{
+            if(sample.radio > sample.rtt)   /* clock granularity */
+                sample.radio = sample.rtt;
+            rtt[n] = sample.rtt;
+            radio[n] = sample.radio;
+            usb[n] = sample.rtt - sample.radio;
+            n++;
+            if(verbose)
+                printf("seq=%d rtt=%.3f ms radio=%.3f ms\n", i, sample.rtt / 1000.0, sample.radio / 1000.0);
+        }
+        if(intervalMs > 0)
+            sleep_ms(intervalMs);
+    }
+    usbCloseDevice(dev);
+    printf("%d sent, %d echoed, %d lost\n", n + lost, n, lost);
+    if(n > 0){
+        printStats("rtt", rtt, n);
+        printStats("usb", usb, n);
+        printStats("radio", radio, n);
+    }
+    free(rtt);
+    free(radio);
+    free(usb);
+    return n > 0 ? 0 : 1;
+}
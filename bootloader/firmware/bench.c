@@ -0,0 +1,186 @@
+/* Name: bench.c
+ * Project: AVR bootloader HID
+ * Tabsize: 4
+ *
+ * For: usbXR project: https://github.com/visakhanc/usbXR
+ */
+
+/*
+General Description:
+Replaces V-USB in the simulation benchmark (BENCH_MODE, see bench.h). The
+main loop of the boot loader calls usbPoll() as usual, which passes the next
+report of a fixed sequence to usbFunctionSetup() and usbFunctionWrite() in
+pieces of 8 bytes, like the driver does for a low speed control transfer:
+
+  - BENCH_PAGES pages of report 2 (self programming),
+  - BENCH_BLOCKS blocks of report 4 for the remote, one at a time,
+  - BENCH_BATCHES batches of report 8 with all packets selected.
+
+Each report is framed by markers, the relayed ones until the status reports
+(3 and 8) show that the radio has finished them.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <avr/io.h>
+#include "usbdrv.h"
+#include "bootloader_defs.h"
+#include "rf24_txq.h"
+#include "bench.h"
+
+#define BENCH_PAGES			16
+#define BENCH_PAGE_ADDR		0x4000	/* below the boot loader */
+#define BENCH_BLOCKS		16
+#define BENCH_BATCHES		4
+#define BENCH_REMOTE_ID		0x11
+
+enum {
+	STEP_PAGE = 0,
+	STEP_TXMODE,
+	STEP_BLOCK,
+	STEP_BLOCK_WAIT,
+	STEP_BATCH,
+	STEP_BATCH_WAIT,
+	STEP_END,
+	STEP_DONE,
+};
+
+usbMsgPtr_t		usbMsgPtr;
+usbTxStatus_t	usbTxStatus1 = {USBPID_NAK};	/* usbInterruptIsReady() is always true */
+
+static uint8_t	report[6 + OTA_BATCH_SIZE];	/* largest: report 8 */
+static uint8_t	step;
+static uint8_t	count;
+
+
+
+/* Passes a SET_REPORT of 'len' bytes in report[] to the boot loader. Returns
+ * the last result of usbFunctionWrite(): 1 = complete, 0xff = STALL.
+ */
+static uint8_t	benchSet(uint16_t len)
+{
+usbRequest_t	rq;
+uint16_t		i;
+uint8_t			n, rval = 0;
+
+	rq.bmRequestType = USBRQ_TYPE_CLASS | USBRQ_RCPT_INTERFACE | USBRQ_DIR_HOST_TO_DEVICE;
+	rq.bRequest = USBRQ_HID_SET_REPORT;
+	rq.wValue.bytes[0] = report[0];
+	rq.wValue.bytes[1] = 3;  /* feature report */
+	rq.wIndex.word = 0;
+	rq.wLength.word = len;
+	if(usbFunctionSetup((uchar *)&rq) != USB_NO_MSG) {
+		return 1;
+	}
+	for(i = 0; i < len && 0 == rval; i += n) {
+		n = (len - i > 8) ? 8 : len - i;
+		rval = usbFunctionWrite(&report[i], n);
+	}
+	return rval;
+}
+
+/* Returns the data of a GET_REPORT of report 'id' */
+static uint8_t	*benchGet(uint8_t id)
+{
+usbRequest_t	rq;
+
+	rq.bmRequestType = USBRQ_TYPE_CLASS | USBRQ_RCPT_INTERFACE | USBRQ_DIR_DEVICE_TO_HOST;
+	rq.bRequest = USBRQ_HID_GET_REPORT;
+	rq.wValue.bytes[0] = id;
+	rq.wValue.bytes[1] = 3;
+	rq.wIndex.word = 0;
+	rq.wLength.word = sizeof(report);
+	usbFunctionSetup((uchar *)&rq);
+	return (uint8_t *)usbMsgPtr;
+}
+
+static void	benchCommand(uint8_t cmd)
+{
+	memset(report, 0, 8);
+	report[0] = 3;
+	report[1] = BENCH_REMOTE_ID;
+	report[2] = cmd;
+	benchSet(8);
+}
+
+/* Report with a 3 byte address and 'len' bytes of data from 'offset' */
+static void	benchData(uint8_t id, uint16_t addr, uint8_t offset, uint8_t len)
+{
+uint8_t	i;
+
+	report[0] = id;
+	report[1] = addr & 0xff;
+	report[2] = addr >> 8;
+	report[3] = 0;
+	for(i = 0; i < len; i++) {
+		report[offset + i] = addr + i;
+	}
+}
+
+
+
+void	usbInit(void)
+{
+}
+
+void	usbSetInterrupt(uchar *data, uchar len)
+{
+}
+
+void	usbPoll(void)
+{
+	switch(step) {
+	case STEP_PAGE:
+		benchData(2, BENCH_PAGE_ADDR + count * SPM_PAGESIZE, 4, SPM_PAGESIZE);
+		BENCH_MARK(BENCH_PAGE);
+		benchSet(4 + SPM_PAGESIZE);
+		BENCH_MARK(BENCH_PAGE | BENCH_END);
+		if(++count == BENCH_PAGES) {
+			count = 0;
+			step = STEP_TXMODE;
+		}
+		break;
+	case STEP_TXMODE:
+		benchCommand(CMD_OTA_BOOT_TXMODE);
+		step = STEP_BLOCK;
+		break;
+	case STEP_BLOCK:
+		benchData(4, count * 16, 4, 16);
+		BENCH_MARK(BENCH_RELAY);
+		benchSet(4 + 16);
+		step = STEP_BLOCK_WAIT;
+		break;
+	case STEP_BLOCK_WAIT:
+		if(benchGet(3)[1] != RF24_TXQ_PENDING) {  /* transmit status */
+			BENCH_MARK(BENCH_RELAY | BENCH_END);
+			step = STEP_BLOCK;
+			if(++count == BENCH_BLOCKS) {
+				count = 0;
+				step = STEP_BATCH;
+			}
+		}
+		break;
+	case STEP_BATCH:
+		benchData(8, count * OTA_BATCH_SIZE, 6, OTA_BATCH_SIZE);
+		report[4] = 0xff;  /* send mask */
+		report[5] = 0xff;
+		BENCH_MARK(BENCH_BATCH);
+		benchSet(6 + OTA_BATCH_SIZE);
+		step = STEP_BATCH_WAIT;
+		break;
+	case STEP_BATCH_WAIT:
+		if(0 == benchGet(8)[4]) {  /* no packets pending */
+			BENCH_MARK(BENCH_BATCH | BENCH_END);
+			step = STEP_BATCH;
+			if(++count == BENCH_BATCHES) {
+				step = STEP_END;
+			}
+		}
+		break;
+	case STEP_END:
+		benchCommand(CMD_OTA_BOOT_END);
+		BENCH_MARK(BENCH_DONE);
+		step = STEP_DONE;
+		break;
+	}
+}
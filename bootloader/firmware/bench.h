@@ -0,0 +1,34 @@
+/* Name: bench.h
+ * Project: AVR bootloader HID
+ * Tabsize: 4
+ *
+ * For: usbXR project: https://github.com/visakhanc/usbXR
+ */
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+/*
+General Description:
+Markers of the simulation benchmark (make sim-bench). The boot loader is
+built with -DBENCH_MODE and bench.c instead of V-USB: bench.c calls
+usbFunctionSetup() and usbFunctionWrite() with a fixed sequence of reports,
+the way usbPoll() would. ../simulator/usbxr-bench runs the result in simavr,
+emulates the radio at the SPI register level and counts the CPU cycles
+between the begin and the end marker of each event.
+
+A marker is a write to GPIOR0, which the firmware uses for nothing else.
+The header is shared with the host harness, so include <avr/io.h> first.
+*/
+
+#define BENCH_PAGE		1		/* usbFunctionWrite() calls of one report 2 page */
+#define BENCH_ERASE		2		/* boot_page_erase() */
+#define BENCH_WRITE		3		/* boot_page_write() */
+#define BENCH_RELAY		4		/* report 4 block until its ACK */
+#define BENCH_BATCH		5		/* report 8 batch until all ACKs */
+#define BENCH_END		0x80	/* | event: end of the event */
+#define BENCH_DONE		0xff	/* all events done, stop the simulation */
+
+#define BENCH_MARK(event)	(GPIOR0 = (event))
+
+#endif /* BENCH_H_ */
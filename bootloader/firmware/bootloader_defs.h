@@ -17,15 +17,122 @@
 #define CMD_OTA_BOOT_END        	0xa3
 #define CMD_OTA_BOOT_TXMODE			0xa4
 #define CMD_OTA_BOOT_UPDATE			0xa5
+/* Commands from CMD_OTA_BOOT_PAGECRC on carry arguments. The relay forwards
+ * all 7 bytes of report 3 (device ID, command, 5 argument bytes) for them,
+ * older commands are forwarded as 2 bytes (device ID, command).
+ */
+#define CMD_OTA_BOOT_PAGECRC		0xa6	/* args: address (2), length (2) */
+#define CMD_OTA_BOOT_POLL			0xa7	/* no args, fetches the ACK payload */
+#define CMD_OTA_HAS_ARGS(cmd)		((cmd) >= CMD_OTA_BOOT_PAGECRC)
+/* Session commands are handled by the relay itself (like START, END and
+ * TXMODE), see DEVINFO_FLAG_SESSION and report 7 below.
+ */
+#define CMD_OTA_BOOT_SESSION		0xa8	/* device ID, 0 = first boot request */
+#define CMD_OTA_BOOT_FINISH			0xa9	/* arg: SESSION_FINISH_* */
+/* Sent to the running application of a remote, not to its boot loader. The
+ * relay loads [device ID, CMD_OTA_APP_REBOOT] as ACK payload after every
+ * packet it receives until that remote sends its boot request (or the session
+ * ends), so the application gets it with the ACK of its next packet. The
+ * application (ota_app.h) resets into its boot loader through the entry word
+ * of bootloader_entry.h, and the remote boot loader then sends
+ * STATUS_OTA_BOOT_REQ without the button. Only accepted (else STALL) while
+ * a CMD_OTA_BOOT_SESSION for the same device ID waits for its boot request,
+ * so the session timeout bounds the paging. See DEVINFO_FLAG_APP_REBOOT.
+ */
+#define CMD_OTA_APP_REBOOT			0xaa
 
 /* Status types */
 #define STATUS_TYPE_BOOT			0xb0
 #define STATUS_TYPE_DEVINFO			0xb1
+#define STATUS_TYPE_PAGECRC			0xb2
+/* Reply to CMD_OTA_BOOT_PAGECRC, loaded as ACK payload by the remote boot
+ * loader and therefore returned with the ACK of the next packet (usually
+ * CMD_OTA_BOOT_POLL): device ID, STATUS_TYPE_PAGECRC, address (2), CRC (2).
+ * The CRC is _crc16_update() with start value 0xffff over 'length' bytes of
+ * flash from 'address'. Remote boot loaders which don't know the command
+ * never send this status type.
+ */
 
 /* Status */
 #define STATUS_OTA_BOOT_REQ			0xc0
 #define STATUS_OTA_BOOT_READY		0xc1
 #define STATUS_OTA_BOOT_OK			0xc2
 
+/* Device info report (report 1) of the HID boot loader, all little endian:
+ * [1, page size (2), flash size (4), max block size (2), flags, boot loader
+ * size (2), pages skipped (2)]. Older boot loaders end after the block size,
+ * the flags or the boot loader size; the application may use the flash up to
+ * flash size - boot loader size. With DEVINFO_FLAG_SKIP, 'pages skipped'
+ * counts the pages of reports 2 and 5 since reset which matched the flash
+ * and were neither erased nor written (wraps around).
+ */
+#define DEVINFO_LEN					14
+
+/* Capability flags in the device info report (report 1) of the HID boot loader */
+#define DEVINFO_FLAG_PAGE_CRC		0x01	/* report 6 returns page CRCs */
+#define DEVINFO_FLAG_SESSION		0x02	/* relay runs OTA sessions, report 7 */
+
+/* OTA session of the relay. CMD_OTA_BOOT_SESSION waits for the boot request
+ * of the remote, sends START in the ACK payload, waits for READY and switches
+ * the relay to transmit mode. Data blocks (report 4) are then queued and
+ * retransmitted by the relay in order; report 4 stalls while the queue is
+ * full. CMD_OTA_BOOT_FINISH sends STOP or RESET after the queued blocks, RESET
+ * also returns the relay to receive mode. Report 3 keeps working for other
+ * commands (page CRCs) during the session, CMD_OTA_BOOT_END aborts it.
+ *
+ * Report 7 (feature, read only) returns the session status: state, error,
+ * device ID, page size / 2 and flash size in KB of the remote, number of
+ * acknowledged packets (2) and the address of the failed block (3).
+ */
+#define SESSION_FINISH_STOP			0x01
+#define SESSION_FINISH_RESET		0x02
+
+#define SESSION_IDLE				0
+#define SESSION_WAIT_REQ			1
+#define SESSION_WAIT_READY			2
+#define SESSION_ACTIVE				3
+#define SESSION_FINISHING			4	/* STOP or RESET queued */
+#define SESSION_DONE				5	/* STOP or RESET acknowledged */
+#define SESSION_FAILED				6
+
+#define SESSION_ERR_NONE			0
+#define SESSION_ERR_TIMEOUT			1	/* no boot request or READY in time */
+#define SESSION_ERR_RADIO			2	/* packet not acknowledged */
+
+/* Batched data for the remote, report 8. A SET carries a base address (3),
+ * a send mask (2) and OTA_BATCH_SIZE bytes; the relay splits the data into
+ * OTA_BATCH_PACKETS packets of 16 bytes with their address (like report 4)
+ * and sends the packets selected by the mask back to back. A GET returns
+ * the base address (3), the number of packets not finished yet and a bitmap
+ * (2) of the acknowledged packets, bit 0 for the first 16 bytes. A SET
+ * stalls until all packets of the previous batch are queued, so the host
+ * resends only the failed packets with the mask of the missing ACKs.
+ */
+#define DEVINFO_FLAG_BATCH			0x04	/* relay accepts report 8 */
+#define OTA_BATCH_SIZE				128
+#define OTA_BATCH_PACKETS			(OTA_BATCH_SIZE / 16)
+
+/* Report 3 is also an input report. The relay sends it on the interrupt-in
+ * endpoint when a packet queued by a SET of report 3 or 4 is finished, with
+ * the transmit status and the ACK payload of the remote, so the host reads
+ * it instead of waiting and polling report 3.
+ */
+#define DEVINFO_FLAG_STATUS_IN		0x08	/* report 3 arrives on the interrupt endpoint */
+
+/* Counters of the boot loader, report 9. A GET returns, all little endian:
+ * Timer 1 ticks per ms (2), SET and GET requests (2 each), page erases and
+ * page writes (2 each), longest erase and longest write in ticks (2 each),
+ * ticks spent in erases and writes (4), packets sent to the remote, failed
+ * and retransmitted (2 each), replies of the remote overwritten before the
+ * host read them (2), main loop iterations (4) and the shortest and longest
+ * main loop iteration in ticks (2 each), static RAM in bytes (2) and the
+ * bytes of RAM the stack has never reached since reset (2). A SET of any data
+ * clears the counters, not the RAM figures. Older boot loaders return 35
+ * bytes, without the RAM figures.
+ */
+#define DEVINFO_FLAG_STATS			0x10	/* report 9 returns counters */
+#define DEVINFO_FLAG_SKIP			0x20	/* unchanged pages are skipped, blank pages only erased */
+#define DEVINFO_FLAG_APP_REBOOT		0x40	/* relay pages remote applications, CMD_OTA_APP_REBOOT */
+
 
 #endif
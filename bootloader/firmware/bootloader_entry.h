@@ -0,0 +1,48 @@
+/* Name: bootloader_entry.h
+ * Project: usbXR
+ * Tabsize: 4
+ *
+ * For: usbXR project: https://github.com/visakhanc/usbXR
+ */
+
+#ifndef BOOTLOADER_ENTRY_H_
+#define BOOTLOADER_ENTRY_H_
+
+/*
+General Description:
+Software entry into the HID boot loader, shared by the boot loader and the
+applications. The application stores BOOTLOADER_ENTRY_MAGIC in the two
+bytes at BOOTLOADER_ENTRY_ADDR and resets the AVR with the watchdog
+(bootloader_enter()). The boot loader reads the word in .init3, before
+main() is called and anything is pushed onto the stack, clears it and stays
+in boot loader mode as if the button had been pressed.
+
+The word is the top of the stack, so it survives the reset: neither program
+initializes it (it is not part of .data or .bss) and the boot loader reads
+it before its own stack reaches it. The application must not return after
+writing it.
+*/
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+
+#define BOOTLOADER_ENTRY_MAGIC	0xb007
+#define BOOTLOADER_ENTRY_ADDR	(RAMEND - 1)
+
+#define bootloader_entry_word	(*(volatile uint16_t *)BOOTLOADER_ENTRY_ADDR)
+
+static inline void	bootloader_enter(void) __attribute__((__noreturn__));
+/* Resets the AVR into the boot loader, 15 ms after the call. */
+
+static inline void	bootloader_enter(void)
+{
+	cli();
+	bootloader_entry_word = BOOTLOADER_ENTRY_MAGIC;
+	wdt_enable(WDTO_15MS);
+	for(;;)
+		;
+}
+
+#endif /* BOOTLOADER_ENTRY_H_ */
@@ -27,10 +27,12 @@ can be read. This will usually consist of activating a pull-up resistor for an
 external jumper which selects boot loader mode. You may call leaveBootloader()
 from this function if you know that the main code should run.
 
-bootLoaderCondition() is called immediately after initialization and in each
-main loop iteration. If it returns TRUE, the boot loader will be active. If it
-returns FALSE, the boot loader jumps to address 0 (the loaded application)
-immediately.
+bootLoaderCondition() is called once, immediately after initialization. If it
+returns TRUE, the boot loader will be active. If it returns FALSE, the boot
+loader jumps to address 0 (the loaded application) immediately, unless the
+application requested the boot loader through the entry word of
+bootloader_entry.h or the flash holds no application (first word erased).
+The decision is not revisited in the main loop.
 
 For compatibility with Thomas Fischl's avrusbboot, we also support the macro
 names BOOTLOADER_INIT and BOOTLOADER_CONDITION for this functionality. If
@@ -80,6 +82,40 @@ these macros are defined, the boot loader usees them.
 
 /* --------------------------- Functional Range ---------------------------- */
 
+#ifndef BOOTLOADER_SIZE
+#if defined(__AVR_ATmega328P__)
+#define BOOTLOADER_SIZE         4096
+#else
+#define BOOTLOADER_SIZE         2048
+#endif
+#endif
+/* Size of the boot section in bytes, set by BOOT_SIZE in the Makefile along
+ * with the start address and the BOOTSZ fuses. The host reads it from the
+ * device info report (report 1) and leaves the rest of the flash to the
+ * application. On the ATmega328P, 2048 builds the small variant: no relay,
+ * and the optional features below (page CRCs, sessions, batches, the status
+ * input report, counters) and long transfers are off unless enabled here
+ * explicitly. The Makefile fails the link if the result does not fit.
+ */
+
+#ifndef BOOTLOADER_RELAY
+#if defined(__AVR_ATmega328P__) && BOOTLOADER_SIZE > 2048
+#define BOOTLOADER_RELAY        1
+#else
+#define BOOTLOADER_RELAY        0
+#endif
+#endif
+/* If this macro is defined to 1, the boot loader is also the usbXR relay for
+ * over the air uploads ("HIDBoot Remote", reports 3 and 4) and needs the
+ * radio. Set by RELAY in the Makefile; "make RELAY=0" builds a boot loader
+ * for local uploads only, without rf24.c and rf24_txq.c.
+ */
+#if defined(__AVR_ATmega328P__) && BOOTLOADER_SIZE > 2048
+#define BOOTLOADER_FULL         1
+#else
+#define BOOTLOADER_FULL         0
+#endif
+
 #define BOOTLOADER_CAN_EXIT     1
 /* If this macro is defined to 1, the boot loader command line utility can
  * initiate a reboot after uploading the FLASH when the "-r" command line
@@ -93,6 +129,93 @@ these macros are defined, the boot loader usees them.
  * an example: http://git.lochraster.org:2080/?p=fd0/usbload;a=tree
  */
 
+#define BOOTLOADER_LONG_BLOCK_SIZE  512
+/* Number of flash data bytes carried by one report 5 transfer when
+ * USB_CFG_LONG_TRANSFERS is enabled in usbconfig.h. Must be a multiple of
+ * SPM_PAGESIZE. The value is advertised to the host in the device info
+ * report (report 1), so the command line utility adapts automatically.
+ */
+
+#if BOOTLOADER_FULL
+#define BOOTLOADER_PAGE_CRC     1
+#else
+#define BOOTLOADER_PAGE_CRC     0
+#endif
+/* If this macro is defined to 1, the host can read the CRC-16 of flash pages
+ * through report 6 and skip pages which already hold the right data. A SET
+ * of report 6 selects the start address, each GET returns the CRCs of the
+ * next BOOTLOADER_CRC_PAGES pages. Costs about 150 bytes of flash.
+ */
+#define BOOTLOADER_CRC_PAGES    8
+
+#if BOOTLOADER_FULL
+#define BOOTLOADER_SKIP_SAME    1
+#else
+#define BOOTLOADER_SKIP_SAME    0
+#endif
+/* If this macro is defined to 1, each page of reports 2 and 5 is compared
+ * with the flash while it is loaded into the page buffer. A page which
+ * matches is neither erased nor written (saves about 8 ms and a write cycle),
+ * a page of all 0xff is only erased. The erase moves from the first to the
+ * last word of the page. The count of skipped pages is in report 1.
+ */
+
+#if BOOTLOADER_FULL && BOOTLOADER_RELAY
+#define BOOTLOADER_SESSION      1
+#else
+#define BOOTLOADER_SESSION      0
+#endif
+/* If this macro is defined to 1, the relay runs the handshake of an over the
+ * air upload itself (CMD_OTA_BOOT_SESSION, report 7, see bootloader_defs.h)
+ * and retransmits data blocks in order, so the host only streams the blocks.
+ * Needs BOOTLOADER_RELAY and Timer 1 for the timeouts.
+ */
+#define BOOTLOADER_SESSION_TIMEOUT  1000
+/* Time in units of 10 ms the relay waits for the boot request and for the
+ * READY status of the remote.
+ */
+#define BOOTLOADER_SESSION_RETRIES  20
+/* Extra retransmit rounds (of up to 15 retransmits each) per packet before
+ * the session fails.
+ */
+
+#if BOOTLOADER_FULL && BOOTLOADER_RELAY
+#define BOOTLOADER_BATCH        1
+#else
+#define BOOTLOADER_BATCH        0
+#endif
+/* If this macro is defined to 1, the relay accepts OTA_BATCH_SIZE bytes for
+ * the remote in one report (report 8, see bootloader_defs.h) and sends them
+ * as back to back radio packets. Costs a buffer of OTA_BATCH_SIZE bytes RAM.
+ */
+
+#if BOOTLOADER_FULL && BOOTLOADER_RELAY
+#define BOOTLOADER_STATUS_IN    1
+#else
+#define BOOTLOADER_STATUS_IN    0
+#endif
+/* If this macro is defined to 1, report 3 is also an input report: the relay
+ * sends it on the interrupt-in endpoint as soon as the ACK of the remote (with
+ * its status in the ACK payload) or the retransmit limit ends a transmission.
+ * The host then needs neither a fixed delay nor a GET of report 3.
+ */
+#define BOOTLOADER_STATUS_INTERVAL  1
+/* Poll interval of the interrupt-in endpoint in milliseconds if
+ * BOOTLOADER_STATUS_IN is enabled. The USB specification asks for at least
+ * 10 ms on low speed devices, Linux polls at the requested rate anyway.
+ */
+
+#if BOOTLOADER_FULL
+#define BOOTLOADER_STATS        1
+#else
+#define BOOTLOADER_STATS        0
+#endif
+/* If this macro is defined to 1, the boot loader counts USB requests, flash
+ * operations, radio packets and main loop iterations and times them with
+ * Timer 1. The counters are read (GET) and cleared (SET) through report 9,
+ * see bootloader_defs.h. Costs about 40 bytes of RAM.
+ */
+
 /* ------------------------------------------------------------------------- */
 
 /* Example configuration: Port D bit 3 is connected to a jumper which ties
@@ -130,10 +253,14 @@ static inline void  bootLoaderInit(void)
 {
     LED_INIT();
     BUTTON_INIT(); /* activate pull-up for key; turn LED ON */
-    _delay_ms(100);  /* wait for levels to stabilize */
+    _delay_us(100);  /* the pull-up charges the button line within a few us */
 }
 
-#define bootLoaderCondition()   (BUTTON_PRESSED())   /* Stay in bootloder if button is pressed */
+/* Stay in bootloder if button is pressed. main() also stays if the
+ * application asked for the boot loader (bootloader_entry.h) or if there is
+ * no application; otherwise it starts the application right away.
+ */
+#define bootLoaderCondition()   (BUTTON_PRESSED())
 
 #endif
 
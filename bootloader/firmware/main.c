@@ -14,16 +14,27 @@
  */
 
 #include <stdbool.h>
+#include <stddef.h>  /* offsetof() */
 #include <string.h>  /* memcpy() */
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/wdt.h>
 #include <util/delay.h>
 #include <avr/boot.h>
+#include <avr/pgmspace.h>
+#include <util/crc16.h>
 #include "rf24.h"
 #include "rf24_config.h"
+#include "rf24_txq.h"
+#include "stack_paint.h"
+#include "bootloader_entry.h"
 #include "usbdrv.h"
 #include "bootloader_defs.h"
+#ifdef BENCH_MODE
+#include "bench.h"
+#else
+#define BENCH_MARK(event)
+#endif
 
 
 
@@ -32,8 +43,10 @@
 
 #if (FLASHEND) > 0xffff /* we need long addressing */
 #   define addr_t           uint32_t
+#   define readFlashWord(a) pgm_read_word_far(a)
 #else
 #   define addr_t           uint16_t
+#   define readFlashWord(a) pgm_read_word(a)
 #endif
 
 /* allow compatibility with avrusbboot's bootloaderconfig.h: */
@@ -52,6 +65,25 @@
 #define GICR    MCUCR
 #endif
 
+#if USB_CFG_LONG_TRANSFERS
+#   define MAX_BLOCK_SIZE   BOOTLOADER_LONG_BLOCK_SIZE
+#else
+#   define MAX_BLOCK_SIZE   128
+#endif
+
+#define DEVINFO_FLAGS   ((BOOTLOADER_PAGE_CRC ? DEVINFO_FLAG_PAGE_CRC : 0) | (BOOTLOADER_SESSION ? DEVINFO_FLAG_SESSION : 0) \
+                         | (BOOTLOADER_BATCH ? DEVINFO_FLAG_BATCH : 0) | (BOOTLOADER_STATUS_IN ? DEVINFO_FLAG_STATUS_IN : 0) \
+                         | (BOOTLOADER_STATS ? DEVINFO_FLAG_STATS : 0) | (BOOTLOADER_SKIP_SAME ? DEVINFO_FLAG_SKIP : 0) \
+                         | (BOOTLOADER_SESSION ? DEVINFO_FLAG_APP_REBOOT : 0))
+
+#define TIMER1_TICKS_PER_MS (F_CPU / 8 / 1000)  /* Timer 1 runs at 1/8 of the CPU clock */
+
+#if (FLASHEND) > 0xffff
+#   define readFlashByte(addr)  pgm_read_byte_far(addr)
+#else
+#   define readFlashByte(addr)  pgm_read_byte(addr)
+#endif
+
 
 /* HID Input report structure */
 typedef struct {
@@ -59,6 +91,62 @@ typedef struct {
 	uint8_t data[7];
 } hidReport_t;
 
+#if BOOTLOADER_SESSION
+/* Session status, report 7 (see bootloader_defs.h) */
+typedef struct {
+	uint8_t		reportId;
+	uint8_t		state;
+	uint8_t		error;
+	uint8_t		deviceId;
+	uint8_t		pageSizeDiv2;
+	uint8_t		flashSizeInKB;
+	uint16_t	packets;		/* little endian, like the AVR */
+	uint8_t		addr[3];		/* of the failed data block */
+} sessionReport_t;
+
+#define SESSION_TAG_DATA	0x80	/* | slot in sessionAddr[] */
+#define SESSION_TAG_STOP	0x40
+#define SESSION_TAG_RESET	0x41
+#endif
+
+#if BOOTLOADER_BATCH
+/* Batch status, report 8 (see bootloader_defs.h) */
+typedef struct {
+	uint8_t		reportId;
+	uint8_t		addr[3];
+	uint8_t		pending;		/* packets not finished yet */
+	uint16_t	acked;			/* bit i: packet i acknowledged */
+} batchReport_t;
+
+#define BATCH_TAG			0x20	/* | BATCH_TAG_ODD | packet index */
+#define BATCH_TAG_ODD		0x10	/* every other batch, tells old packets apart */
+#define BATCH_MASK			((uint16_t)((1UL << OTA_BATCH_PACKETS) - 1))
+#endif
+
+#if BOOTLOADER_STATS
+/* Counters, report 9 (see bootloader_defs.h) */
+typedef struct {
+	uint8_t		reportId;
+	uint16_t	ticksPerMs;
+	uint16_t	setReports;
+	uint16_t	getReports;
+	uint16_t	pageErases;
+	uint16_t	pageWrites;
+	uint16_t	eraseMax;		/* Timer 1 ticks */
+	uint16_t	writeMax;
+	uint32_t	flashTicks;		/* erases and writes */
+	uint16_t	txPackets;
+	uint16_t	txFailed;
+	uint16_t	txRetransmits;
+	uint16_t	rxOverwrites;	/* replyBufferRemote replaced before it was read */
+	uint32_t	loops;			/* main loop iterations */
+	uint16_t	loopMin;		/* Timer 1 ticks */
+	uint16_t	loopMax;
+	uint16_t	ramStatic;		/* stack_paint.h, not cleared */
+	uint16_t	stackUnused;
+} statsReport_t;
+#endif
+
 
 
 
@@ -69,19 +157,40 @@ static uint8_t	exitMainloop;
 #endif
 static addr_t   currentAddress; /* in bytes */
 static uint8_t	offset;         /* data already processed in current transfer */
-static uint8_t  replyBuffer[7] = {
+static usbMsgLen_t bytesRemaining; /* bytes left in current data transfer */
+static uint8_t  replyBuffer[DEVINFO_LEN] = {
         1,     /* report ID */
         SPM_PAGESIZE & 0xff,
         SPM_PAGESIZE >> 8,
         ((long)FLASHEND + 1) & 0xff,
         (((long)FLASHEND + 1) >> 8) & 0xff,
         (((long)FLASHEND + 1) >> 16) & 0xff,
-        (((long)FLASHEND + 1) >> 24) & 0xff
+        (((long)FLASHEND + 1) >> 24) & 0xff,
+        MAX_BLOCK_SIZE & 0xff,
+        MAX_BLOCK_SIZE >> 8,
+        DEVINFO_FLAGS,
+        BOOTLOADER_SIZE & 0xff,
+        BOOTLOADER_SIZE >> 8,
+        0, 0    /* pages skipped */
     };
 
-#if defined(__AVR_ATmega328P__)
+#if BOOTLOADER_SKIP_SAME
+static bool		pageSame;		/* page received so far matches the flash */
+static bool		pageBlank;		/* ... is all 0xff */
+#define pagesSkipped	(*(uint16_t *)&replyBuffer[DEVINFO_LEN - 2])	/* see bootloader_defs.h */
+#endif
+
+#if BOOTLOADER_PAGE_CRC
+static addr_t   crcAddress;     /* first page of the next report 6 reply */
+static uint8_t  crcBuffer[4 + 2 * BOOTLOADER_CRC_PAGES] = {6};
+#endif
+
+#if BOOTLOADER_RELAY
 static bool		remoteBoot;
 static hidReport_t	replyBufferRemote = {.reportId = 3};
+#if BOOTLOADER_STATUS_IN
+static bool		statusIn;	/* replyBufferRemote is due on the interrupt endpoint */
+#endif
 static uint8_t 	txBuf[CONFIG_RF24_STATIC_PL_LENGTH];
 static uint8_t 	rxBuf[CONFIG_RF24_STATIC_PL_LENGTH];
 static uint8_t 	addr[CONFIG_RF24_ADDR_LEN] = CONFIG_RF24_ADDRESS;
@@ -89,6 +198,34 @@ static uint8_t	recv_len;
 static bool bootInProgress = false;
 static volatile bool bootAckPld = false;  /* Transmit ACK payload for boot request */
 static uint8_t ackPld[2];
+#if BOOTLOADER_SESSION
+static bool appPaging;  /* ackPld holds CMD_OTA_APP_REBOOT, reload it after every packet */
+#endif
+#endif
+
+#if BOOTLOADER_STATS
+static statsReport_t	stats = {.reportId = 9, .ticksPerMs = TIMER1_TICKS_PER_MS, .loopMin = 0xffff};
+static uint16_t	loopTime;		/* Timer 1 count at the previous main loop iteration */
+#if BOOTLOADER_RELAY
+static bool		replyUnread;	/* replyBufferRemote not read by the host yet */
+#endif
+#endif
+
+#if BOOTLOADER_SESSION
+static sessionReport_t	session = {.reportId = 7};
+static uint8_t	sessionAddr[RF24_TXQ_DEPTH][3];  /* addresses of the blocks in flight */
+static uint8_t	sessionSlot;	/* slot of the next block */
+static uint8_t	sessionFinish;	/* tag of the STOP/RESET packet to queue, 0 = none */
+static uint16_t	sessionTimer;	/* 10 ms ticks left to wait for the remote */
+#endif
+
+#if BOOTLOADER_BATCH
+static batchReport_t	batch = {.reportId = 8};
+static uint8_t	batchBuf[5 + OTA_BATCH_SIZE];	/* report 8 without ID */
+static uint8_t	batchPrev[3];	/* address of the previous batch */
+static uint16_t	batchSend;		/* packets still to queue */
+static uint8_t	batchOdd;		/* BATCH_TAG_ODD of the current batch */
+static bool		batchWrite;		/* usbFunctionWrite() receives report 8 */
 #endif
 
 	
@@ -102,7 +239,7 @@ const PROGMEM char usbHidReportDescriptor[USB_CFG_HID_REPORT_DESCRIPTOR_LENGTH]
     0x75, 0x08,                    //   REPORT_SIZE (8)
 
 	0x85, 0x01,                    //   REPORT_ID (1)
-    0x95, 0x06,                    //   REPORT_COUNT (6)
+    0x95, DEVINFO_LEN - 1,         //   REPORT_COUNT (13)
     0x09, 0x00,                    //   USAGE (Undefined)
     0xb2, 0x02, 0x01,              //   FEATURE (Data,Var,Abs,Buf)
 
@@ -111,11 +248,30 @@ const PROGMEM char usbHidReportDescriptor[USB_CFG_HID_REPORT_DESCRIPTOR_LENGTH]
     0x09, 0x00,                    //   USAGE (Undefined)
     0xb2, 0x02, 0x01,              //   FEATURE (Data,Var,Abs,Buf)
 
-#if defined(__AVR_ATmega328P__)
+#if USB_CFG_LONG_TRANSFERS
+    0x85, 0x05,                    //   REPORT_ID (5)
+    0x96, (3 + MAX_BLOCK_SIZE) & 0xff,
+          (3 + MAX_BLOCK_SIZE) >> 8, //   REPORT_COUNT (3 + MAX_BLOCK_SIZE)
+    0x09, 0x00,                    //   USAGE (Undefined)
+    0xb2, 0x02, 0x01,              //   FEATURE (Data,Var,Abs,Buf)
+#endif
+
+#if BOOTLOADER_PAGE_CRC
+    0x85, 0x06,                    //   REPORT_ID (6)
+    0x95, 3 + 2 * BOOTLOADER_CRC_PAGES, //   REPORT_COUNT (3 + 2 * BOOTLOADER_CRC_PAGES)
+    0x09, 0x00,                    //   USAGE (Undefined)
+    0xb2, 0x02, 0x01,              //   FEATURE (Data,Var,Abs,Buf)
+#endif
+
+#if BOOTLOADER_RELAY
     0x85, 0x03,                    //   REPORT_ID (3)
     0x95, 0x07,                    //   REPORT_COUNT (7)
     0x09, 0x00,                    //   USAGE (Undefined)
     0xb2, 0x02, 0x01,              //   FEATURE (Data,Var,Abs,Buf)
+#if BOOTLOADER_STATUS_IN
+    0x09, 0x00,                    //   USAGE (Undefined)
+    0x81, 0x02,                    //   INPUT (Data,Var,Abs)
+#endif
 
     0x85, 0x04,                    //   REPORT_ID (4)
     0x95, 0x13,                    //   REPORT_COUNT (19)
@@ -123,6 +279,27 @@ const PROGMEM char usbHidReportDescriptor[USB_CFG_HID_REPORT_DESCRIPTOR_LENGTH]
     0xb2, 0x02, 0x01,              //   FEATURE (Data,Var,Abs,Buf)
 #endif
 
+#if BOOTLOADER_SESSION
+    0x85, 0x07,                    //   REPORT_ID (7)
+    0x95, 0x0a,                    //   REPORT_COUNT (10)
+    0x09, 0x00,                    //   USAGE (Undefined)
+    0xb2, 0x02, 0x01,              //   FEATURE (Data,Var,Abs,Buf)
+#endif
+
+#if BOOTLOADER_BATCH
+    0x85, 0x08,                    //   REPORT_ID (8)
+    0x95, 5 + OTA_BATCH_SIZE,      //   REPORT_COUNT (5 + OTA_BATCH_SIZE)
+    0x09, 0x00,                    //   USAGE (Undefined)
+    0xb2, 0x02, 0x01,              //   FEATURE (Data,Var,Abs,Buf)
+#endif
+
+#if BOOTLOADER_STATS
+    0x85, 0x09,                    //   REPORT_ID (9)
+    0x95, sizeof(statsReport_t) - 1, //   REPORT_COUNT (38)
+    0x09, 0x00,                    //   USAGE (Undefined)
+    0xb2, 0x02, 0x01,              //   FEATURE (Data,Var,Abs,Buf)
+#endif
+
     0xc0                           // END_COLLECTION
 };
 
@@ -134,6 +311,7 @@ const PROGMEM char usbHidReportDescriptor[USB_CFG_HID_REPORT_DESCRIPTOR_LENGTH]
 
 /* As the application might use the Watchdog Timer for a software reset, this function is needed to disable WDT as early as possible during initialization */
 uint8_t mcusr_mirror __attribute__ ((section (".noinit")));
+static bool entryRequested __attribute__ ((section (".noinit")));   /* see bootloader_entry.h */
 void get_mcusr(void) \
   __attribute__((naked)) \
   __attribute__((section(".init3")));
@@ -143,8 +321,15 @@ void get_mcusr(void)
   mcusr_mirror = MCUSR;
   MCUSR = 0;
   wdt_disable();
+  /* RAM holds garbage after power-on and brown-out */
+  entryRequested = !(mcusr_mirror & ((1 << PORF) | (1 << BORF)))
+                   && bootloader_entry_word == BOOTLOADER_ENTRY_MAGIC;
+  bootloader_entry_word = 0;
 }
 
+/* An erased reset vector means there is no application to start */
+#define appValid()  (readFlashWord(0) != 0xffff)
+
 
 
 static void (*nullVector)(void) __attribute__((__noreturn__));
@@ -156,6 +341,11 @@ static void leaveBootloader(void)
     USB_INTR_CFG = 0;       /* also reset config bits */
 #if F_CPU == 12800000
     TCCR0 = 0;              /* default value */
+#endif
+#if BOOTLOADER_SESSION || BOOTLOADER_STATS
+    TCCR1B = 0;             /* default values */
+    OCR1A = 0;
+    TCNT1 = 0;
 #endif
     GICR = (1 << IVCE);     /* enable change of interrupt vectors */
     GICR = (0 << IVSEL);    /* move interrupts to application flash section */
@@ -169,16 +359,394 @@ static void leaveBootloader(void)
 
 
 
-uint8_t   usbFunctionSetup(uint8_t data[8])
+#if BOOTLOADER_STATS
+/* Counts a page erase or write which started at Timer 1 count 'start' */
+static void statsFlash(uint16_t start, uint16_t *count, uint16_t *max)
+{
+uint16_t	ticks = TCNT1 - start;
+
+	(*count)++;
+	stats.flashTicks += ticks;
+	if(ticks > *max) {
+		*max = ticks;
+	}
+}
+
+static void statsLoop(void)
+{
+uint16_t	now = TCNT1, ticks = now - loopTime;
+
+	loopTime = now;
+	stats.loops++;
+	if(ticks < stats.loopMin) {
+		stats.loopMin = ticks;
+	}
+	if(ticks > stats.loopMax) {
+		stats.loopMax = ticks;
+	}
+}
+
+#if BOOTLOADER_RELAY
+/* Called when replyBufferRemote gets new contents */
+static void statsReply(void)
+{
+	if(replyUnread) {
+		stats.rxOverwrites++;
+	}
+	replyUnread = true;
+}
+#endif
+#endif
+
+
+
+#if BOOTLOADER_PAGE_CRC
+/* Fills crcBuffer with the CRC-16 of BOOTLOADER_CRC_PAGES pages starting at
+ * crcAddress (same polynomial as _crc16_update(), start value 0xffff) and
+ * advances crcAddress, so consecutive GETs walk through the flash.
+ */
+static void calcPageCrcs(void)
+{
+uint8_t     i;
+uint16_t    j, crc;
+addr_t      addr = crcAddress;
+
+    boot_spm_busy_wait();       /* pages written before must be readable */
+    cli();                      /* an interrupt between SPMCSR and spm drops the spm */
+    boot_rww_enable();
+    sei();
+    crcBuffer[1] = addr & 0xff;
+    crcBuffer[2] = (addr >> 8) & 0xff;
+    crcBuffer[3] = (uint32_t)addr >> 16;
+    for(i = 0; i < BOOTLOADER_CRC_PAGES; i++) {
+        crc = 0xffff;
+        for(j = 0; j < SPM_PAGESIZE; j++) {
+            crc = _crc16_update(crc, readFlashByte(addr));
+            addr++;
+        }
+        crcBuffer[4 + 2 * i] = crc & 0xff;
+        crcBuffer[5 + 2 * i] = crc >> 8;
+    }
+    crcAddress = addr;
+}
+#endif
+
+
+
+#if BOOTLOADER_RELAY
+/* Queues txBuf for the remote. The result is filled into replyBufferRemote by
+ * relayPoll() when the ACK (or the retransmit limit) is reached; until then
+ * the transmit status reads RF24_TXQ_PENDING. With BOOTLOADER_STATUS_IN the
+ * result is also sent on the interrupt endpoint.
+ */
+static void relayPacket(uint8_t len)
+{
+	replyBufferRemote.data[0] = RF24_TXQ_PENDING;
+	if(rf24_txq_put(txBuf, len, 0)) {
+		replyBufferRemote.data[0] = RF24_TXQ_FAILED;
+	}
+}
+
+#if BOOTLOADER_BATCH
+/* Address of the packet with 'tag' in the current or the previous batch */
+static void batchAddress(uint8_t tag, uint8_t *addr)
+{
+uint8_t		*base = ((tag & BATCH_TAG_ODD) == batchOdd) ? batch.addr : batchPrev;
+uint32_t	a;
+
+	a = base[0] | ((uint16_t)base[1] << 8) | ((uint32_t)base[2] << 16);
+	a += (tag & 0x0f) * 16;
+	addr[0] = a & 0xff;
+	addr[1] = (a >> 8) & 0xff;
+	addr[2] = a >> 16;
+}
+
+/* Queues the packets of the current batch while the TX queue has room */
+static void batchPoll(void)
+{
+uint8_t	pkt[3 + 16], i;
+
+	while(batchSend) {
+		for(i = 0; !(batchSend & ((uint16_t)1 << i)); i++)
+			;
+		batchAddress(batchOdd | i, pkt);
+		memcpy(&pkt[3], &batchBuf[5 + 16 * i], 16);
+		if(rf24_txq_put(pkt, sizeof(pkt), BATCH_TAG | batchOdd | i)) {
+			return;
+		}
+		batchSend &= ~((uint16_t)1 << i);
+	}
+}
+
+static void batchDone(uint8_t tag, uint8_t status)
+{
+	if((tag & BATCH_TAG_ODD) == batchOdd) {
+		batch.pending--;
+		if(RF24_TXQ_OK == status) {
+			batch.acked |= (uint16_t)1 << (tag & 0x0f);
+		}
+	}
+}
+#endif
+
+#if BOOTLOADER_SESSION
+static void sessionDone(uint8_t tag, uint8_t status);
+#endif
+
+static void relayPoll(void)
+{
+uint8_t	tag, status;
+
+	if(rf24_txq_poll(&tag, &status)) {
+#if BOOTLOADER_STATS
+		stats.txPackets++;
+		stats.txRetransmits += rf24_txq_retransmits();
+#endif
+		if(RF24_TXQ_OK == status) {
+			LED_TOGGLE();
+			rf24_receive_packet(&replyBufferRemote.data[1], &recv_len);  /* ACK payload */
+		}
+#if BOOTLOADER_STATS
+		else {
+			stats.txFailed++;
+		}
+#endif
+		if(0 == tag) {
+			replyBufferRemote.data[0] = status;
+#if BOOTLOADER_STATUS_IN
+			statusIn = true;
+#endif
+#if BOOTLOADER_STATS
+			statsReply();
+#endif
+		}
+#if BOOTLOADER_BATCH
+		else if(tag & BATCH_TAG) {
+			batchDone(tag, status);
+		}
+#endif
+#if BOOTLOADER_SESSION
+		if(tag && SESSION_IDLE != session.state) {
+			sessionDone(tag, status);
+		}
+#endif
+	}
+}
+
+/* Leaves transmit mode after an upload (CMD_OTA_BOOT_END or the end of a
+ * session). relayPoll() stops with bootInProgress, so packets still queued
+ * (up to BOOTLOADER_SESSION_RETRIES rounds each) are dropped.
+ */
+static void relayEnd(void)
+{
+	bootInProgress = false;
+	bootAckPld = false;
+#if BOOTLOADER_SESSION
+	appPaging = false;
+#endif
+	rf24_txq_abort();
+#if BOOTLOADER_SESSION
+	rf24_txq_retries(0);
+#endif
+#if BOOTLOADER_BATCH
+	batchSend = 0;
+	batch.pending = 0;
+#endif
+#if BOOTLOADER_STATUS_IN
+	statusIn = false;
+#endif
+}
+#endif
+
+
+
+#if BOOTLOADER_BATCH
+/* Receives report 8. Stalls while the packets of the previous batch are not
+ * all queued or the relay is not in transmit mode.
+ */
+static uint8_t batchReceive(uint8_t *data, uint8_t len)
+{
+uint8_t	i;
+
+	if(0 == offset) {
+		if(!bootInProgress || batchSend
+#if BOOTLOADER_SESSION
+		   || (SESSION_IDLE != session.state && SESSION_ACTIVE != session.state)
+#endif
+		   ) {
+			return 0xff;
+		}
+		data++;  /* Skip report ID */
+		len--;
+	}
+	while(len-- && offset < sizeof(batchBuf)) {
+		batchBuf[offset++] = *data++;
+	}
+	if(offset < sizeof(batchBuf)) {
+		return 0;
+	}
+	memcpy(batchPrev, batch.addr, 3);
+	memcpy(batch.addr, batchBuf, 3);
+	batchSend = (batchBuf[3] | ((uint16_t)batchBuf[4] << 8)) & BATCH_MASK;
+	batch.pending = 0;
+	for(i = 0; i < OTA_BATCH_PACKETS; i++) {
+		if(batchSend & ((uint16_t)1 << i)) {
+			batch.pending++;
+		}
+	}
+	batch.acked = 0;
+	batchOdd ^= BATCH_TAG_ODD;
+	return 1;
+}
+#endif
+
+
+
+#if BOOTLOADER_SESSION
+static void sessionFail(uint8_t error)
+{
+	session.state = SESSION_FAILED;
+	session.error = error;
+	sessionFinish = 0;
+	rf24_txq_retries(0);  /* let the blocks behind fail fast */
+}
+
+/* CMD_OTA_BOOT_SESSION: waits for the boot request of 'id' (any remote if 0) */
+static void sessionBegin(uint8_t id)
+{
+	relayEnd();
+	memset(&session.state, 0, sizeof(session) - 1);
+	session.deviceId = id;
+	session.state = SESSION_WAIT_REQ;
+	sessionFinish = 0;
+	sessionTimer = BOOTLOADER_SESSION_TIMEOUT;
+}
+
+/* Called with device info of a remote in rxBuf while the relay receives. The
+ * START command is loaded as ACK payload by the caller if bootAckPld is set.
+ */
+static void sessionDevInfo(void)
+{
+	if(appPaging && STATUS_OTA_BOOT_REQ == rxBuf[2] && rxBuf[0] == ackPld[0]) {  /* it has reset */
+		appPaging = false;
+		bootAckPld = false;
+		rf24_flush_txfifo();  /* drop the loaded CMD_OTA_APP_REBOOT */
+	}
+	if(SESSION_WAIT_REQ == session.state && STATUS_OTA_BOOT_REQ == rxBuf[2]
+	   && (0 == session.deviceId || rxBuf[0] == session.deviceId)) {
+		session.deviceId = rxBuf[0];
+		ackPld[0] = rxBuf[0];
+		ackPld[1] = CMD_OTA_BOOT_START;
+		bootAckPld = true;
+		session.state = SESSION_WAIT_READY;
+		sessionTimer = BOOTLOADER_SESSION_TIMEOUT;
+	}
+	else if(SESSION_WAIT_READY == session.state && STATUS_OTA_BOOT_READY == rxBuf[2]
+	        && rxBuf[0] == session.deviceId) {
+		session.pageSizeDiv2 = rxBuf[3];
+		session.flashSizeInKB = rxBuf[4];
+		session.state = SESSION_ACTIVE;
+		bootAckPld = false;
+		rf24_txq_retries(BOOTLOADER_SESSION_RETRIES);
+		bootInProgress = true;  /* rf24_txq_put() switches to PTX */
+	}
+}
+
+/* Queues the data block in txBuf. Returns 0xff (STALL, the host sends the
+ * block again) if the queue is full or the session is not active.
+ */
+static uint8_t sessionPut(void)
+{
+	if(SESSION_ACTIVE != session.state || rf24_txq_put(txBuf, 19, SESSION_TAG_DATA | sessionSlot)) {
+		return 0xff;
+	}
+	memcpy(sessionAddr[sessionSlot], txBuf, 3);
+	if(++sessionSlot >= RF24_TXQ_DEPTH) {
+		sessionSlot = 0;
+	}
+	return 1;
+}
+
+static void sessionDone(uint8_t tag, uint8_t status)
+{
+	if(RF24_TXQ_OK == status) {
+		session.packets++;
+		if(SESSION_FINISHING == session.state && (tag & SESSION_TAG_STOP)) {
+			session.state = SESSION_DONE;
+		}
+	}
+	else if(SESSION_FAILED != session.state) {
+		if(tag & SESSION_TAG_DATA) {
+			memcpy(session.addr, sessionAddr[tag & ~SESSION_TAG_DATA], 3);
+		}
+#if BOOTLOADER_BATCH
+		else if(tag & BATCH_TAG) {
+			batchAddress(tag, session.addr);
+		}
+#endif
+		sessionFail(SESSION_ERR_RADIO);
+	}
+	if(SESSION_TAG_RESET == tag) {  /* the remote may reset before its ACK */
+		relayEnd();
+	}
+}
+
+/* Runs the timeouts and queues STOP/RESET behind the data blocks. */
+static void sessionPoll(void)
+{
+uint8_t	cmd[2];
+
+	if(TIFR1 & (1 << OCF1A)) {  /* every 10 ms */
+		TIFR1 = 1 << OCF1A;
+		OCR1A += TIMER1_TICKS_PER_MS * 10;
+		if((SESSION_WAIT_REQ == session.state || SESSION_WAIT_READY == session.state) && 0 == --sessionTimer) {
+			sessionFail(SESSION_ERR_TIMEOUT);
+			bootAckPld = false;
+			appPaging = false;
+			rf24_flush_txfifo();  /* drop the START ACK payload */
+		}
+	}
+	if(sessionFinish) {
+		cmd[0] = session.deviceId;
+		cmd[1] = (SESSION_TAG_RESET == sessionFinish) ? CMD_OTA_BOOT_RESET : CMD_OTA_BOOT_STOP;
+		if(0 == rf24_txq_put(cmd, sizeof(cmd), sessionFinish)) {
+			sessionFinish = 0;
+		}
+	}
+}
+#endif
+
+
+
+usbMsgLen_t   usbFunctionSetup(uint8_t data[8])
 {
 usbRequest_t    *rq = (void *)data;
 
+#if BOOTLOADER_STATS
+    if(USBRQ_HID_SET_REPORT == rq->bRequest) {
+        stats.setReports++;
+    }
+    else if(USBRQ_HID_GET_REPORT == rq->bRequest) {
+        stats.getReports++;
+    }
+#endif
     if(USBRQ_HID_SET_REPORT == rq->bRequest) {
+#if BOOTLOADER_STATS
+        if(rq->wValue.bytes[0] == 9) {  /* clear counters, data is ignored */
+            memset(&stats.setReports, 0, sizeof(stats) - offsetof(statsReport_t, setReports));
+            stats.loopMin = 0xffff;
+            return 0;
+        }
+#endif
 	    if(rq->wValue.bytes[0] > 1) {
-#if defined(__AVR_ATmega328P__)
-			remoteBoot = (rq->wValue.bytes[0] == 2) ? false : true;
+#if BOOTLOADER_RELAY
+			remoteBoot = (rq->wValue.bytes[0] == 3) || (rq->wValue.bytes[0] == 4);
+#endif
+#if BOOTLOADER_BATCH
+			batchWrite = (rq->wValue.bytes[0] == 8);
 #endif
             offset = 0;
+            bytesRemaining = rq->wLength.word;
             return USB_NO_MSG;  /* Process the packet in usbFunctionWrite() */
         }
 #if BOOTLOADER_CAN_EXIT
@@ -192,11 +760,41 @@ usbRequest_t    *rq = (void *)data;
 			usbMsgPtr = (usbMsgPtr_t)replyBuffer;
 			return sizeof(replyBuffer);
 		}
-#if defined(__AVR_ATmega328P__)
+#if BOOTLOADER_RELAY
 		else if(rq->wValue.bytes[0] == 3) {
+#if BOOTLOADER_STATS
+			replyUnread = false;
+#endif
 			usbMsgPtr = (usbMsgPtr_t)&replyBufferRemote;
 			return sizeof(replyBufferRemote);
 		}
+#endif
+#if BOOTLOADER_SESSION
+		else if(rq->wValue.bytes[0] == 7) {
+			usbMsgPtr = (usbMsgPtr_t)&session;
+			return sizeof(session);
+		}
+#endif
+#if BOOTLOADER_BATCH
+		else if(rq->wValue.bytes[0] == 8) {
+			usbMsgPtr = (usbMsgPtr_t)&batch;
+			return sizeof(batch);
+		}
+#endif
+#if BOOTLOADER_STATS
+		else if(rq->wValue.bytes[0] == 9) {
+			stats.ramStatic = stack_static();
+			stats.stackUnused = stack_unused();
+			usbMsgPtr = (usbMsgPtr_t)&stats;
+			return sizeof(stats);
+		}
+#endif
+#if BOOTLOADER_PAGE_CRC
+		else if(rq->wValue.bytes[0] == 6) {
+			calcPageCrcs();
+			usbMsgPtr = (usbMsgPtr_t)crcBuffer;
+			return sizeof(crcBuffer);
+		}
 #endif
     }
     return 0;
@@ -204,6 +802,45 @@ usbRequest_t    *rq = (void *)data;
 
 
 
+#ifndef TEST_MODE
+static void pageErase(addr_t addr)
+{
+#if BOOTLOADER_STATS
+uint16_t	start = TCNT1;
+#endif
+
+	BENCH_MARK(BENCH_ERASE);
+	cli();
+	boot_page_erase(addr);
+	sei();
+	boot_spm_busy_wait();       /* wait until page is erased */
+	BENCH_MARK(BENCH_ERASE | BENCH_END);
+#if BOOTLOADER_STATS
+	statsFlash(start, &stats.pageErases, &stats.eraseMax);
+#endif
+}
+
+static void pageWrite(addr_t addr)
+{
+#if BOOTLOADER_STATS
+uint16_t	start = TCNT1;
+#endif
+
+	BENCH_MARK(BENCH_WRITE);
+	cli();
+	boot_page_write(addr);
+	sei();
+	boot_spm_busy_wait();
+	BENCH_MARK(BENCH_WRITE | BENCH_END);
+#if BOOTLOADER_STATS
+	statsFlash(start, &stats.pageWrites, &stats.writeMax);
+#endif
+}
+#else
+#define pageErase(addr)
+#define pageWrite(addr)
+#endif
+
 uint8_t usbFunctionWrite(uint8_t *data, uint8_t len)
 {
 union {
@@ -213,12 +850,20 @@ union {
 }   address;
 	uint8_t	isLast = 0;
 
-#if defined(__AVR_ATmega328P__)
+#if BOOTLOADER_BATCH
+	if(batchWrite) {
+		return batchReceive(data, len);
+	}
+#endif
+#if BOOTLOADER_RELAY
 	if(remoteBoot) {
 		replyBufferRemote.data[1] = 0;	/* Clear byte to validate received data */
 		if(offset == 0) {  /* Report ID */
 			if(data[0] == 3) {	/* Report ID:3 -> Command */
 				if(data[2] == CMD_OTA_BOOT_START) {
+#if BOOTLOADER_SESSION
+					session.state = SESSION_IDLE;  /* host runs the handshake */
+#endif
 					ackPld[0] = data[1]; /* Device ID */
 					ackPld[1] = data[2]; /* Command to be sent */
 					rf24_flush_txfifo(); /* Flush pending ack payloads if any */
@@ -226,20 +871,42 @@ union {
 					bootAckPld = true;
 				}
 				else if(data[2] == CMD_OTA_BOOT_END) {
-					bootInProgress = false;
-					bootAckPld = false;
-					rf24_rx_mode();
+					relayEnd();
+#if BOOTLOADER_SESSION
+					session.state = SESSION_IDLE;
+#endif
 				}
 				else if(data[2] == CMD_OTA_BOOT_TXMODE) {
-					bootInProgress = true;
-					rf24_tx_mode();
+					bootInProgress = true;  /* rf24_txq_put() switches to PTX */
+				}
+#if BOOTLOADER_SESSION
+				else if(data[2] == CMD_OTA_BOOT_SESSION) {
+					sessionBegin(data[1]);
 				}
-				else {  /* transmit other commands to remote */
-					txBuf[0] = data[1];
-					txBuf[1] = data[2];
-					if(0 == (replyBufferRemote.data[0] = rf24_transmit_packet(txBuf, 2))) {
-						rf24_receive_packet(&replyBufferRemote.data[1], &recv_len);
+				else if(data[2] == CMD_OTA_APP_REBOOT) {
+					/* only while the session waits for this remote: paging
+					 * ends with its boot request or the session timeout
+					 */
+					if(SESSION_WAIT_REQ != session.state || 0 == data[1] || data[1] != session.deviceId) {
+						return 0xff;
 					}
+					ackPld[0] = data[1];
+					ackPld[1] = CMD_OTA_APP_REBOOT;
+					rf24_flush_txfifo();
+					rf24_set_ack_payload(RF24_PIPE0, ackPld, sizeof(ackPld));
+					bootAckPld = true;
+					appPaging = true;
+				}
+				else if(data[2] == CMD_OTA_BOOT_FINISH) {
+					if(SESSION_ACTIVE == session.state || SESSION_DONE == session.state) {
+						sessionFinish = (data[3] & SESSION_FINISH_RESET) ? SESSION_TAG_RESET : SESSION_TAG_STOP;
+						session.state = SESSION_FINISHING;
+					}
+				}
+#endif
+				else {  /* transmit other commands (and their arguments) to remote */
+					memcpy(txBuf, &data[1], 7);
+					relayPacket(CMD_OTA_HAS_ARGS(data[2]) ? 7 : 2);
 				}
 				return 1;
 			}
@@ -250,16 +917,32 @@ union {
 			txBuf[offset++] = *data++;
 		}
 		if(19 == offset) {  /* whole block received, now send the packet to remote */
-			isLast = 1;
-			if(0 == (replyBufferRemote.data[0] = rf24_transmit_packet(txBuf, offset))) {
-				LED_TOGGLE();
-				rf24_receive_packet(&replyBufferRemote.data[1], &recv_len);
+#if BOOTLOADER_SESSION
+			if(SESSION_IDLE != session.state) {
+				return sessionPut();
 			}
+#endif
+			isLast = 1;
+			relayPacket(offset);
 		}
 		return isLast;
 	}
 #endif
 
+	bytesRemaining -= len;
+	isLast = (bytesRemaining == 0); /* report 2 and 5 differ only in length */
+#if BOOTLOADER_PAGE_CRC
+	if(0 == offset && data[0] == 6) {  /* select start address for page CRCs */
+		crcAddress = data[1] | ((uint16_t)data[2] << 8);
+#if (FLASHEND) > 0xffff
+		crcAddress |= (addr_t)data[3] << 16;
+#endif
+		offset = 2;  /* ignore the rest of the report */
+	}
+	if(2 == offset) {
+		return isLast;
+	}
+#endif
 	address.l = currentAddress;
 	if(0 == offset) {
 		address.c[0] = data[1];
@@ -270,9 +953,8 @@ union {
 #endif
 		data += 4;
 		len -= 4;
+		offset = 1;
 	}
-	offset += len;
-	isLast = offset & 0x80; /* != 0 if last block received */
 	do {
 		addr_t prevAddr;
 #if SPM_PAGESIZE > 256
@@ -281,14 +963,21 @@ union {
 		uint8_t pageAddr;
 #endif
 		pageAddr = address.s[0] & (SPM_PAGESIZE - 1);
+#if BOOTLOADER_SKIP_SAME
+		if(0 == pageAddr) {
+			pageSame = pageBlank = true;
+		}
+		if(*(uint16_t *)data != readFlashWord(address.l)) {
+			pageSame = false;
+		}
+		if(*(uint16_t *)data != 0xffff) {
+			pageBlank = false;
+		}
+#else
 		if(0 == pageAddr) {              /* if page start: erase */
-#ifndef TEST_MODE
-			cli();
-			boot_page_erase(address.l); /* erase page */
-			sei();
-			boot_spm_busy_wait();       /* wait until page is erased */
-#endif
+			pageErase(address.l);
 		}
+#endif
 		cli();
 		boot_page_fill(address.l, *(short *)data);
 		sei();
@@ -298,11 +987,27 @@ union {
 		/* write page when we cross page boundary */
 		pageAddr = address.s[0] & (SPM_PAGESIZE - 1);
 		if(0 == pageAddr){
+#if BOOTLOADER_SKIP_SAME
+			if(pageSame) {
+				pagesSkipped++;
+			}
+			else {
+				pageErase(prevAddr);	/* the page buffer survives the erase */
+				if(!pageBlank) {
+					pageWrite(prevAddr);
+				}
+			}
 #ifndef TEST_MODE
+			/* clears the page buffer, flash readable for the next page; must
+			 * not be dropped by an interrupt, skipped pages are not written
+			 */
+			boot_spm_busy_wait();
 			cli();
-			boot_page_write(prevAddr);
+			boot_rww_enable();
 			sei();
-			boot_spm_busy_wait();
+#endif
+#else
+			pageWrite(prevAddr);
 #endif
 		}
 		len -= 2;
@@ -321,25 +1026,27 @@ uint8_t   i = 0;
     TCCR0 = 3;          /* 1/64 prescaler */
 #endif
     usbInit();
-    /* enforce USB re-enumerate: */
-    usbDeviceDisconnect();  /* do this while interrupts are disabled */
-    do{             /* fake USB disconnect for > 250 ms */
-        _delay_ms(1);
-    } while(--i);
-    usbDeviceConnect();
+    /* enforce USB re-enumerate, unless the host cannot know us yet: */
+    if(!(mcusr_mirror & (1 << PORF))) {
+        usbDeviceDisconnect();  /* do this while interrupts are disabled */
+        do{             /* fake USB disconnect for > 250 ms */
+            _delay_ms(1);
+        } while(--i);
+        usbDeviceConnect();
+    }
     sei();
 }
 
 
 int main(void)
 {
-#if defined(__AVR_ATmega328P__)
+#if BOOTLOADER_RELAY
 	uint8_t  len;
 #endif
 
     /* initialize hardware */
     bootLoaderInit();	
-	if(bootLoaderCondition()) {
+	if(bootLoaderCondition() || entryRequested || !appValid()) {
 		uchar i = 0, j = 0;
 
 #ifndef TEST_MODE
@@ -348,15 +1055,42 @@ int main(void)
 #endif
 
         initForUsbConnectivity();
-#if defined(__AVR_ATmega328P__)
+#if BOOTLOADER_RELAY
 		if(0 != rf24_init(RF24_MODE_PRX, addr)) {
 			LED_ON();
 		}
+#endif
+#if BOOTLOADER_SESSION
+		OCR1A = TIMER1_TICKS_PER_MS * 10;  /* 10 ms session ticks, see sessionPoll() */
+#endif
+#if BOOTLOADER_SESSION || BOOTLOADER_STATS
+		TCCR1B = 1 << CS11;  /* free running, 1/8 prescaler */
 #endif
         do {  /* main event loop */
             usbPoll();
-#if defined(__AVR_ATmega328P__)
-    		if(!bootInProgress) {
+#if BOOTLOADER_STATS
+            statsLoop();
+#endif
+#if BOOTLOADER_SESSION
+            sessionPoll();
+#endif
+#if BOOTLOADER_RELAY
+    		if(bootInProgress) {
+    			relayPoll();
+#if BOOTLOADER_BATCH
+    			batchPoll();
+#endif
+#if BOOTLOADER_STATUS_IN
+    			if(statusIn && usbInterruptIsReady()) {
+    				statusIn = false;
+#if BOOTLOADER_STATS
+    				replyUnread = false;
+#endif
+    				usbSetInterrupt((uchar *)&replyBufferRemote, sizeof(replyBufferRemote));
+    			}
+#endif
+    		}
+    		else {
     			rf24_receive_packet(rxBuf, &len);
     			if(len) {
     				LED_TOGGLE();
@@ -365,11 +1099,22 @@ int main(void)
     						cli();
     						memcpy(replyBufferRemote.data, rxBuf, len);
     						sei();
+#if BOOTLOADER_STATS
+    						statsReply();
+#endif
+#if BOOTLOADER_SESSION
+    						sessionDevInfo();
+#endif
     						if(bootAckPld) {
     							rf24_set_ack_payload(RF24_PIPE0, ackPld, sizeof(ackPld));
     						}
     					}
     				}
+#if BOOTLOADER_SESSION
+    				else if(appPaging) {  /* the ACK of this packet took the last one */
+    					rf24_set_ack_payload(RF24_PIPE0, ackPld, sizeof(ackPld));
+    				}
+#endif
     			}
     		}
 #endif
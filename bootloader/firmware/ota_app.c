@@ -0,0 +1,18 @@
+/* Name: ota_app.c
+ * Project: usbXR
+ * Tabsize: 4
+ *
+ * For: usbXR project: https://github.com/visakhanc/usbXR
+ */
+
+#include <avr/io.h>
+#include "bootloader_defs.h"
+#include "bootloader_entry.h"
+#include "ota_app.h"
+
+void	ota_app_ack_payload(uint8_t deviceId, const uint8_t *data, uint8_t len)
+{
+	if(len >= 2 && data[0] == deviceId && CMD_OTA_APP_REBOOT == data[1]) {
+		bootloader_enter();
+	}
+}
@@ -0,0 +1,34 @@
+/* Name: ota_app.h
+ * Project: usbXR
+ * Tabsize: 4
+ *
+ * For: usbXR project: https://github.com/visakhanc/usbXR
+ */
+
+#ifndef OTA_APP_H_
+#define OTA_APP_H_
+
+/*
+General Description:
+Over the air update support for the applications of remote nodes. A remote
+application sends its packets to usbXR as PTX and gets the ACK payloads of
+the relay back. When the host asks for an update of the node (bootloadHID
+remote -d <id>), the relay loads CMD_OTA_APP_REBOOT for the node's device
+ID as ACK payload (see bootloader_defs.h). Pass every ACK payload to
+ota_app_ack_payload(); if it is meant for this node, the AVR is reset into
+its boot loader with the entry word of bootloader_entry.h, and the boot
+loader asks for the upload without the button.
+
+The node has to send packets for the relay to reach it, so an application
+which sleeps long should wake up at least every few seconds during updates.
+The remote boot loader must check the entry word like the HID boot loader.
+*/
+
+#include <stdint.h>
+
+void	ota_app_ack_payload(uint8_t deviceId, const uint8_t *data, uint8_t len);
+/* Checks the ACK payload 'data' of 'len' bytes received by the node with
+ * 'deviceId'. Does not return if it asks this node for an update.
+ */
+
+#endif /* OTA_APP_H_ */
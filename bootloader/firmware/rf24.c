@@ -0,0 +1,163 @@
+/* Name: rf24.c
+ * Project: usbXR
+ * Tabsize: 4
+ *
+ * For: usbXR project: https://github.com/visakhanc/usbXR
+ */
+
+#include <avr/pgmspace.h>
+#include <util/delay.h>
+#include "rf24.h"
+#include "rf24_spi.h"
+
+#if !CONFIG_RF24_POLLED_MODE
+#   error "rf24.c supports polled mode only (CONFIG_RF24_POLLED_MODE 1)"
+#endif
+#if RFM7x_INIT
+#   error "rf24.c does not initialize RFM7x modules (RFM7x_INIT)"
+#endif
+
+#define NRF_ACTIVATE		0x50
+#define NRF_REG_SETUP_RETR	0x04
+#define NRF_REG_RF_SETUP	0x06
+#define NRF_REG_TX_ADDR		0x10
+#define NRF_REG_FEATURE		0x1d
+#define NRF_CONFIG_CRCO		(1 << 2)
+#define NRF_CONFIG_PWR_UP	(1 << 1)
+#define NRF_CONFIG_PRIM_RX	(1 << 0)
+#define NRF_FEATURE_EN_DPL		(1 << 2)
+#define NRF_FEATURE_EN_ACK_PAY	(1 << 1)
+
+/* Register values derived from rf24_config.h */
+#define CONFIG_VALUE	(NRF_CONFIG_EN_CRC | NRF_CONFIG_CRCO | NRF_CONFIG_PWR_UP)
+
+#if CONFIG_RF24_ACK_PL_ENABLED
+#   define ACK_BYTES	CONFIG_RF24_ACK_PL_LENGTH
+#else
+#   define ACK_BYTES	0
+#endif
+
+/* Auto retransmit delay in 250 us steps - 1: long enough for the ACK with
+ * its payload, as in the table of the datasheet.
+ */
+#if CONFIG_RF24_DATA_RATE == RF24_RATE_250KBPS
+#   define ARD_STEPS	(1 + (ACK_BYTES + 7) / 8)
+#elif CONFIG_RF24_DATA_RATE == RF24_RATE_1MBPS
+#   define ARD_STEPS	(ACK_BYTES > 5 ? 1 : 0)
+#else
+#   define ARD_STEPS	(ACK_BYTES > 15 ? 1 : 0)
+#endif
+
+#define FEATURE_VALUE	((CONFIG_RF24_DYNAMIC_PL_ENABLED ? NRF_FEATURE_EN_DPL : 0) \
+						| (CONFIG_RF24_ACK_PL_ENABLED ? NRF_FEATURE_EN_ACK_PAY : 0))
+
+/* [register, value] pairs written by rf24_init(), CONFIG last */
+static const uint8_t	initTable[] PROGMEM = {
+	NRF_REG_EN_AA,		CONFIG_RF24_AUTOACK_ENABLED ? 0x01 : 0,
+	NRF_REG_EN_RXADDR,	0x01,
+	NRF_REG_SETUP_AW,	CONFIG_RF24_ADDR_LEN - 2,
+	NRF_REG_SETUP_RETR,	(ARD_STEPS << 4) | CONFIG_RF24_TX_RETRANSMITS,
+	NRF_REG_RF_CH,		CONFIG_RF24_RF_CHANNEL,
+	NRF_REG_RF_SETUP,	CONFIG_RF24_DATA_RATE | CONFIG_RF24_TX_PWR,
+	NRF_REG_RX_PW_P0,	CONFIG_RF24_STATIC_PL_LENGTH,
+	NRF_REG_DYNPD,		CONFIG_RF24_DYNAMIC_PL_ENABLED ? 0x01 : 0,
+	NRF_REG_STATUS,		NRF_RX_DR | NRF_TX_DS | NRF_MAX_RT,
+};
+
+
+
+uint8_t	rf24_init(uint8_t mode, const uint8_t *addr)
+{
+uint8_t	i, powerUp;
+
+	SPI_DDR |= (1 << MOSI_BIT) | (1 << SCK_BIT) | (1 << SS_BIT);
+	CE_DDR |= (1 << CE_PIN);
+	NRF_CE_LOW();
+	NRF_CSN_HIGH();
+	SPCR = (1 << SPE) | (1 << MSTR);
+	SPSR = (1 << SPI2X);	/* F_CPU / 2, the radio takes up to 10 MHz */
+
+	powerUp = nrfReadReg(NRF_REG_CONFIG) & NRF_CONFIG_PWR_UP;
+	for(i = 0; i < sizeof(initTable); i += 2) {
+		nrfWriteReg(pgm_read_byte(&initTable[i]), pgm_read_byte(&initTable[i + 1]));
+	}
+#if FEATURE_VALUE
+	nrfWriteReg(NRF_REG_FEATURE, FEATURE_VALUE);
+	if(nrfReadReg(NRF_REG_FEATURE) != FEATURE_VALUE) {	/* nRF24L01 without +: unlock first */
+		nrfCommand(NRF_ACTIVATE, 0x73);
+		nrfWriteReg(NRF_REG_FEATURE, FEATURE_VALUE);
+	}
+#endif
+	nrfWrite(NRF_W_REGISTER | NRF_REG_RX_ADDR_P0, addr, CONFIG_RF24_ADDR_LEN);
+	nrfWrite(NRF_W_REGISTER | NRF_REG_TX_ADDR, addr, CONFIG_RF24_ADDR_LEN);
+	nrfCommand(NRF_FLUSH_TX, NRF_NOP);
+	nrfCommand(NRF_FLUSH_RX, NRF_NOP);
+	if(nrfReadReg(NRF_REG_SETUP_AW) != CONFIG_RF24_ADDR_LEN - 2) {
+		return 1;
+	}
+	nrfWriteReg(NRF_REG_CONFIG, CONFIG_VALUE);
+	if(!powerUp) {
+		_delay_ms(2);	/* power down to standby */
+	}
+	if(RF24_MODE_PRX == mode) {
+		rf24_rx_mode();
+	}
+	return 0;
+}
+
+
+
+void	rf24_tx_mode(void)
+{
+	NRF_CE_LOW();
+	nrfWriteReg(NRF_REG_CONFIG, CONFIG_VALUE);
+}
+
+
+
+void	rf24_rx_mode(void)
+{
+	nrfWriteReg(NRF_REG_CONFIG, CONFIG_VALUE | NRF_CONFIG_PRIM_RX);
+	NRF_CE_HIGH();
+}
+
+
+
+void	rf24_receive_packet(uint8_t *buf, uint8_t *len)
+{
+uint8_t	width;
+
+	*len = 0;
+	if(nrfReadReg(NRF_REG_FIFO_STATUS) & NRF_FIFO_RX_EMPTY) {
+		return;
+	}
+#if CONFIG_RF24_DYNAMIC_PL_ENABLED
+	width = nrfCommand(NRF_R_RX_PL_WID, NRF_NOP);
+	if(width == 0 || width > 32) {  /* corrupt, see datasheet */
+		nrfCommand(NRF_FLUSH_RX, NRF_NOP);
+		nrfWriteReg(NRF_REG_STATUS, NRF_RX_DR);
+		return;
+	}
+#else
+	width = CONFIG_RF24_STATIC_PL_LENGTH;
+#endif
+	nrfRead(NRF_R_RX_PAYLOAD, buf, width);
+	nrfWriteReg(NRF_REG_STATUS, NRF_RX_DR);
+	*len = width;
+}
+
+
+
+#if CONFIG_RF24_ACK_PL_ENABLED
+void	rf24_set_ack_payload(uint8_t pipe, const uint8_t *data, uint8_t len)
+{
+	nrfWrite(NRF_W_ACK_PAYLOAD | pipe, data, len);
+}
+#endif
+
+
+
+void	rf24_flush_txfifo(void)
+{
+	nrfCommand(NRF_FLUSH_TX, NRF_NOP);
+}
@@ -0,0 +1,65 @@
+/* Name: rf24.h
+ * Project: usbXR
+ * Tabsize: 4
+ *
+ * For: usbXR project: https://github.com/visakhanc/usbXR
+ */
+
+#ifndef RF24_H_
+#define RF24_H_
+
+/*
+General Description:
+Driver for the nRF24L01+ radio of usbXR, used by the boot loader and the
+bridge in place of the generic rf24_lib. The configuration of rf24_config.h
+is turned into a constant register table at compile time, so rf24_init()
+is a loop over that table plus the address, and only the features enabled
+there are built. The API is the subset of rf24_lib which usbXR uses; the
+pipelined transmit path (rf24_txq.c), extra pipes (rf24_pipes.c) and capture
+mode (rf24_capture.c) build on it.
+
+The radio runs in polled mode (CONFIG_RF24_POLLED_MODE 1, IRQ pin not used)
+and the SPI clock is F_CPU / 2. RFM7x modules, which need the bank 1
+initialization of rf24_lib (RFM7x_INIT), are not supported.
+*/
+
+#include <stdint.h>
+
+#define RF24_MODE_PTX		0
+#define RF24_MODE_PRX		1
+
+#define RF24_PIPE0			0
+
+/* CONFIG_RF24_TX_PWR, bits of RF_SETUP */
+#define RF24_PWR_M18DBM		(0 << 1)
+#define RF24_PWR_M12DBM		(1 << 1)
+#define RF24_PWR_M6DBM		(2 << 1)
+#define RF24_PWR_0DBM		(3 << 1)
+
+/* CONFIG_RF24_DATA_RATE, bits of RF_SETUP */
+#define RF24_RATE_1MBPS		0x00
+#define RF24_RATE_2MBPS		0x08
+#define RF24_RATE_250KBPS	0x20
+
+uint8_t	rf24_init(uint8_t mode, const uint8_t *addr);
+/* Sets up the SPI port and the radio as in rf24_config.h, with 'addr'
+ * (CONFIG_RF24_ADDR_LEN bytes, first byte sent first) as TX and pipe 0
+ * address, flushes both FIFOs and enters 'mode'. Also ends capture mode.
+ * Returns 0 on success or 1 if the radio does not answer.
+ */
+void	rf24_tx_mode(void);
+/* Switches to PTX. CE stays low until a packet is to be sent. */
+void	rf24_rx_mode(void);
+/* Switches to PRX and starts listening (CE high). */
+void	rf24_receive_packet(uint8_t *buf, uint8_t *len);
+/* Reads the oldest packet of the RX FIFO into 'buf' (up to 32 bytes) and
+ * sets '*len' to its width, or to 0 if the FIFO is empty.
+ */
+void	rf24_set_ack_payload(uint8_t pipe, const uint8_t *data, uint8_t len);
+/* Loads the payload for the next ACK on 'pipe' (PRX mode only). Built with
+ * CONFIG_RF24_ACK_PL_ENABLED only.
+ */
+void	rf24_flush_txfifo(void);
+/* Drops the packets and ACK payloads in the TX FIFO. */
+
+#endif /* RF24_H_ */
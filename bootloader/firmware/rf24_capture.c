@@ -0,0 +1,43 @@
+/* Name: rf24_capture.c
+ * Project: usbXR
+ * Tabsize: 4
+ *
+ * For: usbXR project: https://github.com/visakhanc/usbXR
+ */
+
+#include "rf24.h"
+#include "rf24_spi.h"
+#include "rf24_capture.h"
+
+
+
+void	rf24_capture_start(uint8_t channel, const uint8_t *addr, uint8_t width)
+{
+	NRF_CE_LOW();
+	nrfWriteReg(NRF_REG_CONFIG, nrfReadReg(NRF_REG_CONFIG) & ~NRF_CONFIG_EN_CRC);
+	nrfWriteReg(NRF_REG_EN_AA, 0);
+	nrfWriteReg(NRF_REG_DYNPD, 0);
+	nrfWriteReg(NRF_REG_EN_RXADDR, 1);
+	nrfWriteReg(NRF_REG_SETUP_AW, width - 2);
+	nrfWrite(NRF_W_REGISTER | NRF_REG_RX_ADDR_P0, addr, width);
+	nrfWriteReg(NRF_REG_RX_PW_P0, RF24_CAPTURE_SIZE);
+	nrfWriteReg(NRF_REG_RF_CH, channel);
+	nrfCommand(NRF_FLUSH_RX, NRF_NOP);
+	nrfWriteReg(NRF_REG_STATUS, NRF_RX_DR);
+	NRF_CE_HIGH();
+}
+
+
+
+uint8_t	rf24_capture_receive(uint8_t *buf)
+{
+uint8_t	len;
+
+	if(nrfReadReg(NRF_REG_FIFO_STATUS) & NRF_FIFO_RX_EMPTY) {
+		return 0;
+	}
+	nrfRead(NRF_R_RX_PAYLOAD, buf, RF24_CAPTURE_SIZE);
+	nrfWriteReg(NRF_REG_STATUS, NRF_RX_DR);
+	len = (buf[0] >> 2) + 4;  /* 9 bit control field, payload, 16 bit CRC */
+	return len < RF24_CAPTURE_SIZE ? len : RF24_CAPTURE_SIZE;
+}
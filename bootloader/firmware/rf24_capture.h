@@ -0,0 +1,42 @@
+/* Name: rf24_capture.h
+ * Project: usbXR
+ * Tabsize: 4
+ *
+ * For: usbXR project: https://github.com/visakhanc/usbXR
+ */
+
+#ifndef RF24_CAPTURE_H_
+#define RF24_CAPTURE_H_
+
+/*
+General Description:
+Passive reception of Enhanced ShockBurst traffic for packet capture. A normal
+receiver with auto-ACK would answer the packets it listens to and collide
+with the real receiver, so here pipe 0 runs without auto-ACK, without CRC
+check and with a static width of RF24_CAPTURE_SIZE bytes. Every packet on the
+configured address is returned raw, as the bits following the address: the
+9 bit packet control field (payload length, PID, NO_ACK), the payload and the
+CRC, not aligned to bytes. The host decodes and checks them.
+
+With an address width of 2 (not documented for the nRF24L01+, but accepted)
+and an address matching the preamble, e.g. 0x00 0xaa, the radio picks up
+packets of all addresses on the channel, with a lot of noise.
+
+rf24_init() ends capture mode and restores the normal configuration.
+*/
+
+#include <stdint.h>
+
+#define RF24_CAPTURE_SIZE	32
+
+void	rf24_capture_start(uint8_t channel, const uint8_t *addr, uint8_t width);
+/* Switches the radio to capture mode on 'channel'. 'addr' has 'width' (2..5)
+ * bytes in the order of CONFIG_RF24_ADDRESS.
+ */
+uint8_t	rf24_capture_receive(uint8_t *buf);
+/* Reads one packet (RF24_CAPTURE_SIZE bytes) into 'buf'. Returns the number
+ * of bytes which hold the packet control field, the payload and a 16 bit CRC
+ * (at most RF24_CAPTURE_SIZE) or 0 if the RX FIFO is empty.
+ */
+
+#endif /* RF24_CAPTURE_H_ */
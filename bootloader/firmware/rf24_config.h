@@ -21,8 +21,9 @@
    pin should be connected to RF Module's IRQ pin
    Define to 1 if polled mode is used. In this case RFM70 IRQ pin
    is not connected to AVR
+   usbXR uses polled mode: rf24_txq.c reads the TX status bits itself.
 */
-#define CONFIG_RF24_POLLED_MODE 			                  0
+#define CONFIG_RF24_POLLED_MODE 			                  1
 
 
 /************ FOR RFM7x Modules ONLY ************/
@@ -62,7 +63,8 @@
 
 
 /* Whether to enable Payload in the ACK
-   If defined to 1, also define ACK payload length */
+   If defined to 1, also define ACK payload length: the longest ACK payload
+   expected, rf24.c sets the auto retransmit delay from it */
 #define CONFIG_RF24_ACK_PL_ENABLED			               	1
 #define CONFIG_RF24_ACK_PL_LENGTH			               	6
 
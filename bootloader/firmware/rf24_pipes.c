@@ -0,0 +1,52 @@
+/* Name: rf24_pipes.c
+ * Project: usbXR
+ * Tabsize: 4
+ *
+ * For: usbXR project: https://github.com/visakhanc/usbXR
+ */
+
+#include "rf24.h"
+#include "rf24_spi.h"
+#include "rf24_pipes.h"
+
+
+
+void	rf24_pipes_init(const uint8_t *pipe1Addr, const uint8_t *lsb, uint8_t pipes)
+{
+uint8_t	i, mask = (1 << pipes) - 1;
+
+	NRF_CE_LOW();
+	if(pipes > 1) {
+		nrfWrite(NRF_W_REGISTER | (NRF_REG_RX_ADDR_P0 + 1), pipe1Addr, CONFIG_RF24_ADDR_LEN);
+	}
+	for(i = 2; i < pipes; i++) {
+		nrfWriteReg(NRF_REG_RX_ADDR_P0 + i, lsb[i - 2]);
+	}
+	nrfWriteReg(NRF_REG_EN_AA, nrfReadReg(NRF_REG_EN_AA) | mask);
+	nrfWriteReg(NRF_REG_DYNPD, nrfReadReg(NRF_REG_DYNPD) | mask);
+	nrfWriteReg(NRF_REG_EN_RXADDR, mask);
+	NRF_CE_HIGH();
+}
+
+
+
+uint8_t	rf24_pipes_receive(uint8_t *buf, uint8_t *len)
+{
+uint8_t	pipe, width;
+
+	*len = 0;
+	if(nrfReadReg(NRF_REG_FIFO_STATUS) & NRF_FIFO_RX_EMPTY) {
+		return RF24_PIPE_NONE;
+	}
+	pipe = NRF_RX_P_NO(nrfStatus());
+	width = nrfCommand(NRF_R_RX_PL_WID, NRF_NOP);
+	if(width == 0 || width > 32 || pipe >= RF24_PIPES) {  /* corrupt, see datasheet */
+		nrfCommand(NRF_FLUSH_RX, NRF_NOP);
+		nrfWriteReg(NRF_REG_STATUS, NRF_RX_DR);
+		return RF24_PIPE_NONE;
+	}
+	nrfRead(NRF_R_RX_PAYLOAD, buf, width);
+	nrfWriteReg(NRF_REG_STATUS, NRF_RX_DR);
+	*len = width;
+	return pipe;
+}
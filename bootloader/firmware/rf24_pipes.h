@@ -0,0 +1,45 @@
+/* Name: rf24_pipes.h
+ * Project: usbXR
+ * Tabsize: 4
+ *
+ * For: usbXR project: https://github.com/visakhanc/usbXR
+ */
+
+#ifndef RF24_PIPES_H_
+#define RF24_PIPES_H_
+
+/*
+General Description:
+Reception on all six RX pipes of the nRF24 radio. rf24_init() only opens
+pipe 0, with the address passed to it, so every remote shares one address,
+their packets collide and an ACK payload can only target one of them. Here
+pipes 1..5 get their own addresses: pipe 1 a full address, pipes 2..5 the
+upper bytes of pipe 1 and their own first (least significant) byte, as the
+radio requires. Received packets are returned with their pipe number and
+every pipe can have its own ACK payload, loaded with rf24_set_ack_payload().
+At most three payloads can be loaded at a time. A packet returned by
+rf24_pipes_receive() took the payload of its pipe with its ACK, if one was
+loaded. (TX_DS cannot tell which pipe: it is one bit for all ACK payloads
+sent.)
+
+ACK payloads share the 3-deep TX FIFO with transmitted packets. rf24_txq.c
+flushes the FIFO when it switches to PTX, so callers must load their ACK
+payloads again after rf24_txq_rx_mode().
+*/
+
+#include <stdint.h>
+
+#define RF24_PIPES			6
+#define RF24_PIPE_NONE		0xff
+
+void	rf24_pipes_init(const uint8_t *pipe1Addr, const uint8_t *lsb, uint8_t pipes);
+/* Opens pipes 1 to 'pipes' - 1 with auto-ACK and dynamic payloads, like pipe
+ * 0. 'pipe1Addr' has CONFIG_RF24_ADDR_LEN bytes (first byte sent first),
+ * 'lsb' holds the first address byte of pipes 2, 3, ...
+ */
+uint8_t	rf24_pipes_receive(uint8_t *buf, uint8_t *len);
+/* Reads one packet from the RX FIFO into 'buf' (32 bytes). Returns its pipe
+ * number, or RF24_PIPE_NONE (and *len = 0) if the FIFO is empty.
+ */
+
+#endif /* RF24_PIPES_H_ */
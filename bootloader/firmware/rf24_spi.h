@@ -0,0 +1,136 @@
+/* Name: rf24_spi.h
+ * Project: usbXR
+ * Tabsize: 4
+ *
+ * For: usbXR project: https://github.com/visakhanc/usbXR
+ */
+
+#ifndef RF24_SPI_H_
+#define RF24_SPI_H_
+
+/*
+General Description:
+Raw register access to the nRF24 radio for rf24.c and the modules built on
+it (rf24_txq.c, rf24_pipes.c, rf24_capture.c). The SPI port must have been
+set up by rf24_init().
+
+Bursts (payloads, addresses) overlap the loop with the SPI transfer: the
+next byte is fetched while the current one is shifted out. Reads store a
+byte before they start the next one; the receive buffer of the SPI would
+allow the reverse order, but an interrupt (V-USB) in between would lose a
+byte. At F_CPU / 2 a byte takes 16 cycles on the bus; see Readme.txt for
+the expected cycles of a burst.
+*/
+
+#include <stdint.h>
+#include <avr/io.h>
+#include "rf24_config.h"
+#include "spi_config.h"
+
+/* Commands */
+#define NRF_R_REGISTER		0x00
+#define NRF_W_REGISTER		0x20
+#define NRF_R_RX_PL_WID		0x60
+#define NRF_R_RX_PAYLOAD	0x61
+#define NRF_W_TX_PAYLOAD	0xa0
+#define NRF_W_ACK_PAYLOAD	0xa8	/* | pipe */
+#define NRF_FLUSH_TX		0xe1
+#define NRF_FLUSH_RX		0xe2
+#define NRF_NOP				0xff
+
+/* Registers and bits */
+#define NRF_REG_CONFIG		0x00
+#define NRF_REG_EN_AA		0x01
+#define NRF_REG_EN_RXADDR	0x02
+#define NRF_REG_SETUP_AW	0x03
+#define NRF_REG_RF_CH		0x05
+#define NRF_REG_STATUS		0x07
+#define NRF_REG_OBSERVE_TX	0x08
+#define NRF_REG_RX_ADDR_P0	0x0a
+#define NRF_REG_RX_PW_P0	0x11
+#define NRF_REG_FIFO_STATUS	0x17
+#define NRF_REG_DYNPD		0x1c
+#define NRF_CONFIG_EN_CRC	(1 << 3)
+#define NRF_RX_DR			(1 << 6)
+#define NRF_TX_DS			(1 << 5)
+#define NRF_MAX_RT			(1 << 4)
+#define NRF_RX_P_NO(status)	(((status) >> 1) & 7)	/* 7: RX FIFO empty */
+#define NRF_ARC_CNT(observe)	((observe) & 0x0f)	/* retransmits of the last packet */
+#define NRF_FIFO_TX_EMPTY	(1 << 4)
+#define NRF_FIFO_RX_EMPTY	(1 << 0)
+
+#define NRF_CSN_LOW()		(SPI_PORT &= ~(1 << SS_BIT))
+#define NRF_CSN_HIGH()		(SPI_PORT |= (1 << SS_BIT))
+#define NRF_CE_LOW()		(CE_PORT &= ~(1 << CE_PIN))
+#define NRF_CE_HIGH()		(CE_PORT |= (1 << CE_PIN))
+
+static inline uint8_t nrfSpiByte(uint8_t b)
+{
+	SPDR = b;
+	while(!(SPSR & (1 << SPIF)))
+		;
+	return SPDR;
+}
+
+/* Sends 'cmd' and one argument byte, returns the byte read with the argument */
+static inline uint8_t nrfCommand(uint8_t cmd, uint8_t arg)
+{
+uint8_t	rval;
+
+	NRF_CSN_LOW();
+	nrfSpiByte(cmd);
+	rval = nrfSpiByte(arg);
+	NRF_CSN_HIGH();
+	return rval;
+}
+
+static inline uint8_t nrfStatus(void)
+{
+uint8_t	status;
+
+	NRF_CSN_LOW();
+	status = nrfSpiByte(NRF_NOP);
+	NRF_CSN_HIGH();
+	return status;
+}
+
+#define nrfReadReg(reg)			nrfCommand(NRF_R_REGISTER | (reg), NRF_NOP)
+#define nrfWriteReg(reg, val)	nrfCommand(NRF_W_REGISTER | (reg), (val))
+
+static inline void nrfWrite(uint8_t cmd, const uint8_t *data, uint8_t len)
+{
+uint8_t	b;
+
+	NRF_CSN_LOW();
+	SPDR = cmd;
+	while(len--) {
+		b = *data++;
+		while(!(SPSR & (1 << SPIF)))
+			;
+		SPDR = b;
+	}
+	while(!(SPSR & (1 << SPIF)))
+		;
+	NRF_CSN_HIGH();
+}
+
+static inline void nrfRead(uint8_t cmd, uint8_t *data, uint8_t len)
+{
+	NRF_CSN_LOW();
+	nrfSpiByte(cmd);
+	if(len) {
+		SPDR = NRF_NOP;
+		while(--len) {
+			while(!(SPSR & (1 << SPIF)))
+				;
+			*data++ = SPDR;
+			SPDR = NRF_NOP;
+		}
+		while(!(SPSR & (1 << SPIF)))
+			;
+		*data = SPDR;
+	}
+	NRF_CSN_HIGH();
+}
+
+#endif /* RF24_SPI_H_ */
@@ -0,0 +1,172 @@
+/* Name: rf24_txq.c
+ * Project: usbXR
+ * Tabsize: 4
+ *
+ * For: usbXR project: https://github.com/visakhanc/usbXR
+ */
+
+#include <string.h>  /* memcpy() */
+#include <stdbool.h>
+#include "rf24.h"
+#include "rf24_spi.h"
+#include "rf24_txq.h"
+
+
+
+typedef struct {
+	uint8_t	len;
+	uint8_t	tag;
+	uint8_t	data[CONFIG_RF24_STATIC_PL_LENGTH];
+} txqPacket_t;
+
+static txqPacket_t	queue[RF24_TXQ_DEPTH];	/* copies, needed to reload after MAX_RT */
+static uint8_t		head;
+static uint8_t		count;
+static uint8_t		acked;		/* finished packets not yet reported */
+static bool			txActive;
+static uint8_t		retryLimit;	/* MAX_RT rounds per packet, see rf24_txq_retries() */
+static uint8_t		retries;	/* rounds of the oldest packet so far */
+static uint16_t		retransmits;	/* see rf24_txq_retransmits() */
+
+
+
+uint8_t	rf24_txq_put(const uint8_t *data, uint8_t len, uint8_t tag)
+{
+txqPacket_t	*pkt;
+
+	if(count >= RF24_TXQ_DEPTH) {
+		return 1;
+	}
+	if(!txActive) {
+		rf24_tx_mode();
+		nrfCommand(NRF_FLUSH_TX, NRF_NOP);  /* drop ACK payloads loaded in PRX mode */
+		nrfWriteReg(NRF_REG_STATUS, NRF_TX_DS | NRF_MAX_RT);
+		txActive = true;
+	}
+	else if(0 == count) {  /* all reported: no TX_DS or MAX_RT may be left over */
+		nrfWriteReg(NRF_REG_STATUS, NRF_TX_DS | NRF_MAX_RT);
+	}
+	pkt = &queue[(head + count) % RF24_TXQ_DEPTH];
+	pkt->len = len;
+	pkt->tag = tag;
+	memcpy(pkt->data, data, len);
+	nrfWrite(NRF_W_TX_PAYLOAD, pkt->data, pkt->len);
+	count++;
+	NRF_CE_HIGH();  /* radio sends the FIFO back to back */
+	return 0;
+}
+
+
+
+uint8_t	rf24_txq_poll(uint8_t *tag, uint8_t *status)
+{
+txqPacket_t	*pkt;
+uint8_t		st, i;
+
+	if(0 == count) {
+		return 0;
+	}
+	if(0 == acked) {
+		st = nrfStatus();
+		if(st & (NRF_TX_DS | NRF_MAX_RT)) {
+			retransmits += NRF_ARC_CNT(nrfReadReg(NRF_REG_OBSERVE_TX));
+		}
+		if(st & NRF_TX_DS) {
+			nrfWriteReg(NRF_REG_STATUS, NRF_TX_DS);
+			/* TX_DS is one bit: if the FIFO ran empty, both packets are done,
+			 * else the first (RF24_TXQ_DEPTH is 2 for this). The second may
+			 * have finished after TX_DS was cleared and set it again.
+			 */
+			if(nrfReadReg(NRF_REG_FIFO_STATUS) & NRF_FIFO_TX_EMPTY) {
+				nrfWriteReg(NRF_REG_STATUS, NRF_TX_DS);
+				acked = count;
+			}
+			else {
+				acked = 1;
+			}
+		}
+		else if(st & NRF_MAX_RT) {  /* oldest packet failed, it blocks the FIFO */
+			NRF_CE_LOW();
+			if(retries < retryLimit) {  /* send it again, keeps the order */
+				retries++;
+				nrfWriteReg(NRF_REG_STATUS, NRF_MAX_RT);
+				NRF_CE_HIGH();
+				return 0;
+			}
+			retries = 0;
+			nrfCommand(NRF_FLUSH_TX, NRF_NOP);
+			nrfWriteReg(NRF_REG_STATUS, NRF_MAX_RT);
+			*tag = queue[head].tag;
+			*status = RF24_TXQ_FAILED;
+			head = (head + 1) % RF24_TXQ_DEPTH;
+			count--;
+			for(i = 0; i < count; i++) {
+				pkt = &queue[(head + i) % RF24_TXQ_DEPTH];
+				nrfWrite(NRF_W_TX_PAYLOAD, pkt->data, pkt->len);
+			}
+			if(count) {
+				NRF_CE_HIGH();
+			}
+			return 1;
+		}
+		else {
+			return 0;
+		}
+	}
+	acked--;
+	retries = 0;
+	*tag = queue[head].tag;
+	*status = RF24_TXQ_OK;
+	head = (head + 1) % RF24_TXQ_DEPTH;
+	count--;
+	return 1;
+}
+
+
+
+void	rf24_txq_retries(uint8_t rounds)
+{
+	retryLimit = rounds;
+}
+
+
+
+uint16_t	rf24_txq_retransmits(void)
+{
+uint16_t	n = retransmits;
+
+	retransmits = 0;
+	return n;
+}
+
+
+
+uint8_t	rf24_txq_count(void)
+{
+	return count;
+}
+
+
+
+void	rf24_txq_rx_mode(void)
+{
+	if(txActive && 0 == count) {
+		NRF_CE_LOW();
+		rf24_rx_mode();
+		txActive = false;
+	}
+}
+
+
+
+void	rf24_txq_abort(void)
+{
+	NRF_CE_LOW();
+	nrfCommand(NRF_FLUSH_TX, NRF_NOP);
+	nrfWriteReg(NRF_REG_STATUS, NRF_TX_DS | NRF_MAX_RT);
+	count = 0;
+	acked = 0;
+	retries = 0;
+	txActive = false;
+	rf24_rx_mode();
+}
@@ -0,0 +1,78 @@
+/* Name: rf24_txq.h
+ * Project: usbXR
+ * Tabsize: 4
+ *
+ * For: usbXR project: https://github.com/visakhanc/usbXR
+ */
+
+#ifndef RF24_TXQ_H_
+#define RF24_TXQ_H_
+
+/*
+General Description:
+Pipelined transmit path for the nRF24 radio. A blocking transmit (as
+rf24_transmit_packet() of rf24_lib) loads one payload and busy-waits for its
+ACK, so the radio idles while the MCU services USB. Here up to RF24_TXQ_DEPTH payloads sit in the TX FIFO of
+the radio with CE held high: the radio sends them back to back while the
+caller goes on, and rf24_txq_poll() reports the result of each packet from
+the TX_DS/MAX_RT status bits, in the order they were queued.
+
+A packet which reaches the retransmit limit (MAX_RT) blocks the FIFO. It is
+reported as failed, the FIFO is flushed and the packets behind it are loaded
+again, so one lost remote does not stall the rest of the queue. Callers which
+need the packets in order (an upload over the air) set a number of extra
+rounds with rf24_txq_retries() instead: the packet at the head of the FIFO is
+sent again until it is acknowledged, and only fails after the last round.
+
+At most RF24_TXQ_DEPTH = 2 of the 3 FIFO entries are used. TX_DS is a single
+bit, so after several packets finished only the FIFO status tells how many:
+with two in flight, an empty FIFO means both and a non-empty one the first.
+With three, one or two finished packets would look the same, and a MAX_RT of
+the last one would be blamed on a packet which was delivered.
+
+The radio must be initialized by rf24_init() before.
+*/
+
+#include <stdint.h>
+
+#define RF24_TX_FIFO		3		/* TX FIFO depth of the radio (ACK payloads in PRX mode) */
+#define RF24_TXQ_DEPTH		2		/* packets in flight, see above */
+
+#define RF24_TXQ_OK			0
+#define RF24_TXQ_FAILED		1		/* no ACK after all retransmits */
+#define RF24_TXQ_PENDING	0xff	/* for callers which keep per-packet status */
+
+uint8_t	rf24_txq_put(const uint8_t *data, uint8_t len, uint8_t tag);
+/* Queues a packet for transmission and switches the radio to PTX if needed.
+ * Switching flushes the TX FIFO, which drops pending ACK payloads.
+ * 'tag' is returned with the result. Returns 0 on success or 1 if
+ * RF24_TXQ_DEPTH packets are in flight already.
+ */
+uint8_t	rf24_txq_poll(uint8_t *tag, uint8_t *status);
+/* Checks the radio for finished packets. Returns 1 and the 'tag' and
+ * RF24_TXQ_OK/RF24_TXQ_FAILED 'status' of the oldest finished packet, or 0 if
+ * no packet has finished. An ACK payload of a successful packet is left in
+ * the RX FIFO for rf24_receive_packet().
+ */
+void	rf24_txq_retries(uint8_t rounds);
+/* Sets the number of times a packet is retransmitted again after it reached
+ * the retransmit limit, before it is reported as failed. 0 (the default)
+ * fails it at once.
+ */
+uint16_t	rf24_txq_retransmits(void);
+/* Returns the number of retransmits since the last call (from the ARC counter
+ * of the radio) and clears it. If several packets finish at once, only the
+ * retransmits of the last one are counted.
+ */
+uint8_t	rf24_txq_count(void);
+/* Returns the number of packets in flight. */
+void	rf24_txq_rx_mode(void);
+/* Returns the radio to PRX mode once all packets have finished. Does nothing
+ * while packets are in flight.
+ */
+void	rf24_txq_abort(void);
+/* Drops the packets in flight without reporting them, flushes the TX FIFO
+ * (also ACK payloads loaded in PRX mode) and returns the radio to PRX mode.
+ */
+
+#endif /* RF24_TXQ_H_ */
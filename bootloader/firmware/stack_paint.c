@@ -0,0 +1,44 @@
+/* Name: stack_paint.c
+ * Project: usbXR
+ * Tabsize: 4
+ *
+ * For: usbXR project: https://github.com/visakhanc/usbXR
+ */
+
+#include <avr/io.h>
+#include "stack_paint.h"
+#include "bootloader_entry.h"
+
+extern uint8_t	_end;	/* linker: end of .noinit */
+
+void	stack_paint(void) __attribute__((naked, used, section(".init3")));
+
+
+
+/* Runs before main() without a stack frame: the stack is still empty, so
+ * everything up to the boot loader entry word at the top is painted (the
+ * boot loader may read it after us, see bootloader_entry.h).
+ */
+void	stack_paint(void)
+{
+uint8_t	*p;
+
+	for(p = &_end; p < (uint8_t *)BOOTLOADER_ENTRY_ADDR; p++) {
+		*p = STACK_CANARY;
+	}
+}
+
+uint16_t	stack_unused(void)
+{
+const uint8_t	*p = &_end;
+
+	while(p <= (uint8_t *)RAMEND && STACK_CANARY == *p) {
+		p++;
+	}
+	return p - &_end;
+}
+
+uint16_t	stack_static(void)
+{
+	return (uint16_t)&_end - RAMSTART;
+}
@@ -0,0 +1,36 @@
+/* Name: stack_paint.h
+ * Project: usbXR
+ * Tabsize: 4
+ *
+ * For: usbXR project: https://github.com/visakhanc/usbXR
+ */
+
+#ifndef STACK_PAINT_H_
+#define STACK_PAINT_H_
+
+/*
+General Description:
+RAM high-water mark of the boot loader and the bridge. At reset, before
+.data and .bss are initialized (.init3), the RAM between the end of the
+static variables (_end) and the top of the stack is filled with
+STACK_CANARY. The stack grows down into it; stack_unused() counts the bytes
+above _end which still hold the pattern, so the deepest stack use since reset
+is stack_static() + stack_unused() below RAMEND. Nothing uses malloc(), so
+there is no heap between them.
+
+Linking stack_paint.c is enough to paint the stack. The static RAM per
+buffer is listed at build time by 'make ram-report'.
+*/
+
+#include <stdint.h>
+
+#define STACK_CANARY	0xc5
+
+uint16_t	stack_unused(void);
+/* Returns the number of bytes between the static variables and the stack
+ * which the stack has never reached since reset.
+ */
+uint16_t	stack_static(void);
+/* Returns the size of .data, .bss and .noinit. */
+
+#endif /* STACK_PAINT_H_ */
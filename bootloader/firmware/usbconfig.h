@@ -43,7 +43,7 @@ the newest features and options.
  * default control endpoint 0, an interrupt-in endpoint 1 and an interrupt-in
  * endpoint 3. You must also enable endpoint 1 above.
  */
-#define USB_CFG_SUPPRESS_INTR_CODE      1
+#define USB_CFG_SUPPRESS_INTR_CODE      (!BOOTLOADER_STATUS_IN)
 /* Define this to 1 if you want to declare interrupt-in endpoints, but don't
  * want to send any data over them. If this macro is defined to 1, functions
  * usbSetInterrupt() and usbSetInterrupt3() are omitted. This is useful if
@@ -57,10 +57,10 @@ the newest features and options.
  * it is required by the standard. We have made it a config option because it
  * bloats the code considerably.
  */
-#define USB_CFG_INTR_POLL_INTERVAL      200
+#define USB_CFG_INTR_POLL_INTERVAL      (BOOTLOADER_STATUS_IN ? BOOTLOADER_STATUS_INTERVAL : 200)
 /* If you compile a version with endpoint 1 (interrupt-in), this is the poll
  * interval. The value is in milliseconds and must not be less than 10 ms for
- * low speed devices.
+ * low speed devices. The status input asks for less, see bootloaderconfig.h.
  */
 #define USB_CFG_IS_SELF_POWERED         0
 /* Define this to 1 if the device has its own power supply. Set it to 0 if the
@@ -92,6 +92,17 @@ the newest features and options.
  * of the macros usbDisableAllRequests() and usbEnableAllRequests() in
  * usbdrv.h.
  */
+#if BOOTLOADER_FULL
+#define USB_CFG_LONG_TRANSFERS          1
+#else
+#define USB_CFG_LONG_TRANSFERS          0
+#endif
+/* Define this to 1 if you want to send/receive blocks of more than 254 bytes
+ * in a single control-in or control-out transfer. The boot loader uses this
+ * for report 5, which carries BOOTLOADER_LONG_BLOCK_SIZE bytes of flash data
+ * per transfer. Note that the capability for long transfers increases the
+ * driver size.
+ */
 #define TIMER0_PRESCALING           64 /* must match the configuration for TIMER0 in main */
 #define TOLERATED_DEVIATION_PPT     5  /* max clock deviation before we tune in 1/10 % */
 /* derived constants: */
@@ -170,7 +181,7 @@ tuningOverflow:
  * obdev's free shared VID/PID pair. See the file USBID-License.txt for
  * details.
  */
-#if defined(__AVR_ATmega328P__)
+#if BOOTLOADER_RELAY
 #define USB_CFG_DEVICE_NAME     	'H', 'I', 'D', 'B', 'o', 'o', 't', ' ', 'R', 'e', 'm', 'o', 't', 'e'
 #define USB_CFG_DEVICE_NAME_LEN 	14
 #else
@@ -200,11 +211,7 @@ tuningOverflow:
 /* See USB specification if you want to conform to an existing device class or
  * protocol.
  */
-#if defined(__AVR_ATmega328P__)
-#define USB_CFG_HID_REPORT_DESCRIPTOR_LENGTH    51
-#else
-#define USB_CFG_HID_REPORT_DESCRIPTOR_LENGTH    33  /* total length of report descriptor */
-#endif
+#define USB_CFG_HID_REPORT_DESCRIPTOR_LENGTH    (33 + 18 * BOOTLOADER_RELAY + 10 * USB_CFG_LONG_TRANSFERS + 9 * BOOTLOADER_PAGE_CRC + 9 * BOOTLOADER_SESSION + 9 * BOOTLOADER_BATCH + 4 * BOOTLOADER_STATUS_IN + 9 * BOOTLOADER_STATS)
 /* Define this to the length of the HID report descriptor, if you implement
  * an HID device. Otherwise don't define it or define it to 0.
  */
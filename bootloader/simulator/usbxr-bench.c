@@ -0,0 +1,436 @@
+/* Name: usbxr-bench.c
+ * Project: AVR bootloader HID
+ * Tabsize: 4
+ * License: GNU GPL v2 (see License.txt)
+ *
+ * For: usbXR project: https://github.com/visakhanc/usbXR
+ */
+
+/*
+General Description:
+This program runs the benchmark build of the boot loader (make sim-bench in
+bootloader/firmware, see bench.h) in simavr and counts the CPU cycles of the
+events framed by the firmware's markers: usbFunctionWrite() per page, page
+erase and page write, and relayed blocks and batches until their ACKs.
+
+V-USB is replaced by bench.c in the firmware. The nRF24 radio is emulated
+here at the SPI register level: commands, registers, the TX and RX FIFOs and
+the CE and CSN pins. A packet takes -t microseconds of air time when CE is
+high, then the remote's ACK payload arrives in the RX FIFO. Note that simavr
+completes SPM instructions at once, so the flash times are CPU cycles only.
+
+    usbxr-bench -w baseline.txt bench.elf   records the average of each event
+    usbxr-bench -c baseline.txt bench.elf   fails if one got slower
+
+With -c the exit code is 1 if the average of an event exceeds its baseline
+by more than -p percent (default 5), or if the baseline lacks an event.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_irq.h"
+#include "sim_cycle_timers.h"
+#include "avr_ioport.h"
+#include "avr_spi.h"
+
+#include "../firmware/bootloader_defs.h"
+#include "../firmware/bench.h"
+
+#define MCU_NAME            "atmega328p"
+#define GPIOR0_ADDR         0x3e    /* data space address on the ATmega328P */
+#define BUTTON_PORT         'D'     /* bootLoaderCondition(): PD5 low */
+#define BUTTON_PIN          5
+#define RADIO_PORT          'B'     /* rf24_config.h and spi_config.h */
+#define RADIO_CE_PIN        1
+#define RADIO_CSN_PIN       2
+#define REMOTE_ID           0x11
+#define MAX_SECONDS         20      /* simulated time limit */
+
+/* nRF24 commands and registers used below */
+#define NRF_R_REGISTER      0x00
+#define NRF_W_REGISTER      0x20
+#define NRF_R_RX_PL_WID     0x60
+#define NRF_R_RX_PAYLOAD    0x61
+#define NRF_W_TX_PAYLOAD    0xa0
+#define NRF_W_ACK_PAYLOAD   0xa8    /* | pipe */
+#define NRF_W_TX_NOACK      0xb0
+#define NRF_FLUSH_TX        0xe1
+#define NRF_FLUSH_RX        0xe2
+#define NRF_REG_CONFIG      0x00
+#define NRF_REG_STATUS      0x07
+#define NRF_REG_OBSERVE_TX  0x08
+#define NRF_REG_FIFO_STATUS 0x17
+#define NRF_CONFIG_PRIM_RX  0x01
+#define NRF_CONFIG_PWR_UP   0x02
+#define NRF_RX_DR           0x40
+#define NRF_TX_DS           0x20
+#define NRF_MAX_RT          0x10
+
+#define FIFO_DEPTH          3
+#define MAX_PAYLOAD         32
+
+/* ------------------------------------------------------------------------- */
+
+typedef struct packet {
+    int             len;
+    uint8_t         data[MAX_PAYLOAD];
+} packet_t;
+
+typedef struct fifo {
+    packet_t        packet[FIFO_DEPTH];
+    int             count;
+} fifo_t;
+
+typedef struct benchEvent {
+    const char      *name;
+    long            count;
+    avr_cycle_count_t   start, total, min, max;
+} benchEvent_t;
+
+static struct {
+    uint8_t         reg[32][5];     /* address registers have 5 bytes */
+    uint8_t         status;         /* RX_DR, TX_DS, MAX_RT */
+    fifo_t          tx, rx;
+    int             ce;
+    int             busy;           /* a packet is on the air */
+    uint8_t         cmd;            /* of the current SPI transaction */
+    int             index;          /* bytes transferred since CSN low */
+    uint8_t         data[MAX_PAYLOAD];
+} radio;
+
+static avr_t        *avr;
+static avr_irq_t    *spiInput;
+static int          airUs = 250;
+static int          done;
+static benchEvent_t events[] = {
+    [BENCH_PAGE] = {"page"},
+    [BENCH_ERASE] = {"erase"},
+    [BENCH_WRITE] = {"write"},
+    [BENCH_RELAY] = {"relay"},
+    [BENCH_BATCH] = {"batch"},
+};
+
+#define NUM_EVENTS  ((int)(sizeof(events) / sizeof(events[0])))
+
+/* ------------------------------------------------------------------------- */
+
+static void fifoPush(fifo_t *fifo, const uint8_t *data, int len)
+{
+    if(fifo->count >= FIFO_DEPTH)
+        return;
+    if(len > MAX_PAYLOAD)
+        len = MAX_PAYLOAD;
+    fifo->packet[fifo->count].len = len;
+    memcpy(fifo->packet[fifo->count].data, data, len);
+    fifo->count++;
+}
+
+static void fifoPop(fifo_t *fifo)
+{
+    if(fifo->count == 0)
+        return;
+    fifo->count--;
+    memmove(&fifo->packet[0], &fifo->packet[1], fifo->count * sizeof(packet_t));
+}
+
+static uint8_t radioStatus(void)
+{
+    return radio.status | (radio.rx.count ? 0 : 0x0e) | (radio.tx.count == FIFO_DEPTH ? 0x01 : 0);
+}
+
+static uint8_t radioFifoStatus(void)
+{
+    return (radio.rx.count == 0 ? 0x01 : 0) | (radio.rx.count == FIFO_DEPTH ? 0x02 : 0)
+           | (radio.tx.count == 0 ? 0x10 : 0) | (radio.tx.count == FIFO_DEPTH ? 0x20 : 0);
+}
+
+static void radioKick(void);
+
+/* End of the air time of the oldest packet: the remote acknowledges it with
+ * the status of a boot loader which accepted the data.
+ */
+static avr_cycle_count_t radioTxDone(avr_t *avr, avr_cycle_count_t when, void *param)
+{
+uint8_t ack[6] = {REMOTE_ID, STATUS_TYPE_BOOT, STATUS_OTA_BOOT_OK};
+
+    radio.busy = 0;
+    if(radio.tx.count == 0)     /* flushed meanwhile */
+        return 0;
+    fifoPop(&radio.tx);
+    radio.status |= NRF_TX_DS;
+    if(radio.rx.count < FIFO_DEPTH){
+        fifoPush(&radio.rx, ack, sizeof(ack));
+        radio.status |= NRF_RX_DR;
+    }
+    radioKick();
+    return 0;
+}
+
+/* Starts the next packet if the radio is a powered up transmitter with CE
+ * high, like the chip does.
+ */
+static void radioKick(void)
+{
+uint8_t config = radio.reg[NRF_REG_CONFIG][0];
+
+    if(radio.busy || !radio.ce || radio.tx.count == 0 || (radio.status & NRF_MAX_RT))
+        return;
+    if(!(config & NRF_CONFIG_PWR_UP) || (config & NRF_CONFIG_PRIM_RX))
+        return;
+    radio.busy = 1;
+    avr_cycle_timer_register_usec(avr, airUs, radioTxDone, NULL);
+}
+
+/* Byte received from MOSI: the reply (MISO) goes back at once, which sets
+ * SPIF in the SPI model of simavr.
+ */
+static void spiOutput(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+uint8_t reply = 0, reg;
+int     i = radio.index - 1;    /* data byte index */
+
+    if(radio.index == 0){
+        radio.cmd = value;
+        reply = radioStatus();
+    }else{
+        if(i < MAX_PAYLOAD)
+            radio.data[i] = value;
+        if((radio.cmd & 0xe0) == NRF_R_REGISTER){
+            reg = radio.cmd & 0x1f;
+            if(reg == NRF_REG_STATUS){
+                reply = radioStatus();
+            }else if(reg == NRF_REG_FIFO_STATUS){
+                reply = radioFifoStatus();
+            }else if(reg == NRF_REG_OBSERVE_TX){
+                reply = 0;  /* no retransmits */
+            }else if(i < 5){
+                reply = radio.reg[reg][i];
+            }
+        }else if(radio.cmd == NRF_R_RX_PL_WID){
+            reply = radio.rx.count ? radio.rx.packet[0].len : 0;
+        }else if(radio.cmd == NRF_R_RX_PAYLOAD && radio.rx.count && i < MAX_PAYLOAD){
+            reply = radio.rx.packet[0].data[i];
+        }
+    }
+    radio.index++;
+    avr_raise_irq(spiInput, reply);
+}
+
+/* CSN high ends a command: writes take effect now */
+static void csnChange(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+int     n = radio.index - 1;
+uint8_t reg;
+
+    if(!value){
+        radio.index = 0;
+        return;
+    }
+    if(n < 0)
+        return;
+    if(n > MAX_PAYLOAD)
+        n = MAX_PAYLOAD;
+    if((radio.cmd & 0xe0) == NRF_W_REGISTER){
+        reg = radio.cmd & 0x1f;
+        if(reg == NRF_REG_STATUS){
+            if(n > 0)
+                radio.status &= ~(radio.data[0] & (NRF_RX_DR | NRF_TX_DS | NRF_MAX_RT));
+        }else if(reg != NRF_REG_FIFO_STATUS && reg != NRF_REG_OBSERVE_TX){
+            memcpy(radio.reg[reg], radio.data, n < 5 ? n : 5);
+        }
+    }else if(radio.cmd == NRF_R_RX_PAYLOAD){
+        fifoPop(&radio.rx);
+    }else if(radio.cmd == NRF_W_TX_PAYLOAD || radio.cmd == NRF_W_TX_NOACK){
+        fifoPush(&radio.tx, radio.data, n);
+    }else if(radio.cmd == NRF_FLUSH_TX){
+        radio.tx.count = 0;
+    }else if(radio.cmd == NRF_FLUSH_RX){
+        radio.rx.count = 0;
+    }
+    /* W_ACK_PAYLOAD: the relay answers boot requests, none arrive here */
+    radioKick();
+}
+
+static void ceChange(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+    radio.ce = value;
+    radioKick();
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void markerWrite(struct avr_t *avr, avr_io_addr_t addr, uint8_t v, void *param)
+{
+benchEvent_t    *e;
+avr_cycle_count_t   cycles;
+
+    if(v == BENCH_DONE){
+        done = 1;
+        return;
+    }
+    if((v & ~BENCH_END) >= NUM_EVENTS || events[v & ~BENCH_END].name == NULL)
+        return;
+    e = &events[v & ~BENCH_END];
+    if(!(v & BENCH_END)){
+        e->start = avr->cycle;
+        return;
+    }
+    cycles = avr->cycle - e->start;
+    if(e->count == 0 || cycles < e->min)
+        e->min = cycles;
+    if(cycles > e->max)
+        e->max = cycles;
+    e->total += cycles;
+    e->count++;
+}
+
+static long eventAverage(benchEvent_t *e)
+{
+    return e->count ? (long)(e->total / e->count) : 0;
+}
+
+static int  writeBaseline(const char *name)
+{
+FILE    *fp;
+int     i;
+
+    if((fp = fopen(name, "w")) == NULL){
+        perror(name);
+        return 1;
+    }
+    for(i = 0; i < NUM_EVENTS; i++){
+        if(events[i].name != NULL)
+            fprintf(fp, "%s %ld\n", events[i].name, eventAverage(&events[i]));
+    }
+    fclose(fp);
+    printf("baseline written to %s\n", name);
+    return 0;
+}
+
+/* Returns 1 if an event is slower than its baseline plus 'percent', or if
+ * the baseline has no line for it. Lines starting with '#' are comments.
+ */
+static int  checkBaseline(const char *name, int percent)
+{
+FILE    *fp;
+char    line[128], event[32];
+long    cycles;
+int     i, failed = 0, known[NUM_EVENTS] = {0};
+
+    if((fp = fopen(name, "r")) == NULL){
+        perror(name);
+        return 1;
+    }
+    while(fgets(line, sizeof(line), fp) != NULL){
+        if(line[0] == '#' || sscanf(line, "%31s %ld", event, &cycles) != 2)
+            continue;
+        for(i = 0; i < NUM_EVENTS; i++){
+            if(events[i].name == NULL || strcmp(events[i].name, event) != 0)
+                continue;
+            known[i] = 1;
+            if(eventAverage(&events[i]) * 100 > cycles * (100 + percent)){
+                printf("REGRESSION: %s takes %ld cycles, baseline %ld\n", event, eventAverage(&events[i]), cycles);
+                failed = 1;
+            }
+        }
+    }
+    fclose(fp);
+    for(i = 0; i < NUM_EVENTS; i++){
+        if(events[i].name != NULL && !known[i]){
+            printf("MISSING: %s has no baseline in %s\n", events[i].name, name);
+            failed = 1;
+        }
+    }
+    if(!failed)
+        printf("all events within %d%% of %s\n", percent, name);
+    return failed;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void printUsage(char *pname)
+{
+    fprintf(stderr, "usage: %s [options] <firmware.elf>\n", pname);
+    fprintf(stderr, "  -f <hz>     CPU clock (default 12000000, F_CPU of the build)\n");
+    fprintf(stderr, "  -t <us>     air time of one packet incl. ACK (default %d)\n", airUs);
+    fprintf(stderr, "  -w <file>   write the averages as new baseline\n");
+    fprintf(stderr, "  -c <file>   compare the averages with a baseline, exit code 1 if slower\n");
+    fprintf(stderr, "  -p <n>      tolerance for -c in percent (default 5)\n");
+}
+
+int main(int argc, char **argv)
+{
+elf_firmware_t  firmware;
+char            *writeFile = NULL, *checkFile = NULL;
+long            frequency = 12000000;
+int             opt, state, percent = 5, i;
+
+    while((opt = getopt(argc, argv, "f:t:w:c:p:h")) != -1){
+        switch(opt){
+        case 'f': frequency = atol(optarg); break;
+        case 't': airUs = atoi(optarg); break;
+        case 'w': writeFile = optarg; break;
+        case 'c': checkFile = optarg; break;
+        case 'p': percent = atoi(optarg); break;
+        default:
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if(optind >= argc){
+        printUsage(argv[0]);
+        return 1;
+    }
+    memset(&firmware, 0, sizeof(firmware));
+    if(elf_read_firmware(argv[optind], &firmware) != 0){
+        fprintf(stderr, "Cannot read %s\n", argv[optind]);
+        return 1;
+    }
+    if((avr = avr_make_mcu_by_name(MCU_NAME)) == NULL){
+        fprintf(stderr, "simavr does not know %s\n", MCU_NAME);
+        return 1;
+    }
+    avr_init(avr);
+    avr->frequency = frequency;
+    avr_load_firmware(avr, &firmware);
+    avr->pc = firmware.flashbase;   /* BOOTRST: start in the boot section */
+
+    avr_register_io_write(avr, GPIOR0_ADDR, markerWrite, NULL);
+    spiInput = avr_io_getirq(avr, AVR_IOCTL_SPI_GETIRQ(0), SPI_IRQ_INPUT);
+    avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_SPI_GETIRQ(0), SPI_IRQ_OUTPUT), spiOutput, NULL);
+    avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(RADIO_PORT), RADIO_CSN_PIN), csnChange, NULL);
+    avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(RADIO_PORT), RADIO_CE_PIN), ceChange, NULL);
+    avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(BUTTON_PORT), BUTTON_PIN), 0);  /* stay in the boot loader */
+
+    while(!done){
+        state = avr_run(avr);
+        if(state == cpu_Done || state == cpu_Crashed){
+            fprintf(stderr, "Firmware stopped (state %d) at cycle %llu\n", state, (unsigned long long)avr->cycle);
+            return 1;
+        }
+        if(avr->cycle > (avr_cycle_count_t)frequency * MAX_SECONDS){
+            fprintf(stderr, "Benchmark did not finish within %d s of simulated time\n", MAX_SECONDS);
+            return 1;
+        }
+    }
+
+    printf("event      count       min       avg       max   (cycles at %ld Hz)\n", frequency);
+    for(i = 0; i < NUM_EVENTS; i++){
+        benchEvent_t *e = &events[i];
+        if(e->name == NULL)
+            continue;
+        printf("%-8s %7ld %9llu %9ld %9llu\n", e->name, e->count,
+               (unsigned long long)e->min, eventAverage(e), (unsigned long long)e->max);
+    }
+    if(writeFile != NULL && writeBaseline(writeFile) != 0)
+        return 1;
+    if(checkFile != NULL)
+        return checkBaseline(checkFile, percent);
+    return 0;
+}
@@ -0,0 +1,1012 @@
+/* Name: usbxr-sim.c
+ * Project: AVR bootloader HID
+ * Tabsize: 4
+ * License: GNU GPL v2 (see License.txt)
+ *
+ * For: usbXR project: https://github.com/visakhanc/usbXR
+ */
+
+/*
+General Description:
+This program creates a virtual usbXR HID boot loader through the Linux uhid
+interface (/dev/uhid). The device uses the same VID/PID, strings and report
+descriptor as bootloader/firmware and emulates the boot loader's behaviour
+for reports 1 to 8, including a simulated remote node behind the RF relay.
+Since all requests travel through the real kernel HID stack, bootloadHID can
+be tested and benchmarked on Linux without hardware:
+
+    usbxr-sim -o flash.bin &
+    bootloadHID -r test.hex
+
+With -b it emulates the bridge application (firmware/) instead: output
+reports are "sent" to a simulated remote on pipe 0, which echoes packets of
+the usbxr-ping protocol in its ACK payload, and the results come back as
+input reports. This runs the latency probe without hardware:
+
+    usbxr-sim -b -t 1 &
+    usbxr-ping -c 1000
+
+The device disappears when the host sends the "leave boot loader" request or
+when the simulator is terminated. Flash contents are written to the files
+given with -o (local flash) and -O (remote flash) on exit; -i loads the local
+flash at start, so consecutive runs can continue with the same contents.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <linux/uhid.h>
+#include <linux/input.h>    /* BUS_USB */
+
+#include "../firmware/bootloader_defs.h"
+#include "../../firmware/bridge_defs.h"
+
+#define IDENT_VENDOR_NUM        0x16c0
+#define IDENT_VENDOR_STRING     "obdev.at"
+#define IDENT_PRODUCT_NUM       0x05df
+#define IDENT_PRODUCT_STRING    "HIDBoot"
+#define IDENT_BRIDGE_STRING     "usbXR Bridge"
+
+/* Emulated ATmega328P with a 4 KB boot section at 0x7000 */
+#define PAGE_SIZE           128
+#define FLASH_SIZE          32768
+#define BOOT_SIZE           4096
+#define MAX_BLOCK_SIZE      512     /* BOOTLOADER_LONG_BLOCK_SIZE */
+#define CRC_PAGES           8       /* BOOTLOADER_CRC_PAGES */
+#define SESSION_TIMEOUT     10000   /* BOOTLOADER_SESSION_TIMEOUT in ms */
+#define SESSION_RETRIES     20      /* BOOTLOADER_SESSION_RETRIES */
+#define STATS_REPORT_SIZE   39      /* sizeof(statsReport_t) */
+#define TICKS_PER_MS        1500    /* Timer 1 at F_CPU / 8 */
+
+/* Emulated remote node (ATmega8 running the remote boot loader) */
+#define REMOTE_PAGE_SIZE    64
+#define REMOTE_FLASH_SIZE   8192
+#define REMOTE_BLOCK_SIZE   16
+
+/* ------------------------------------------------------------------------- */
+
+/* Copy of usbHidReportDescriptor in bootloader/firmware/main.c for the
+ * ATmega328P build. Keep both in sync.
+ */
+static const unsigned char  reportDescriptor[] = {
+    0x06, 0x00, 0xff,              // USAGE_PAGE (Vendor defined)
+    0x09, 0x01,                    // USAGE (Vendor Usage 1)
+    0xa1, 0x01,                    // COLLECTION (Application)
+    0x15, 0x00,                    //   LOGICAL_MINIMUM (0)
+    0x26, 0xff, 0x00,              //   LOGICAL_MAXIMUM (255)
+    0x75, 0x08,                    //   REPORT_SIZE (8)
+
+    0x85, 0x01,                    //   REPORT_ID (1)
+    0x95, DEVINFO_LEN - 1,         //   REPORT_COUNT (13)
+    0x09, 0x00,                    //   USAGE (Undefined)
+    0xb2, 0x02, 0x01,              //   FEATURE (Data,Var,Abs,Buf)
+
+    0x85, 0x02,                    //   REPORT_ID (2)
+    0x95, 0x83,                    //   REPORT_COUNT (131)
+    0x09, 0x00,                    //   USAGE (Undefined)
+    0xb2, 0x02, 0x01,              //   FEATURE (Data,Var,Abs,Buf)
+
+    0x85, 0x05,                    //   REPORT_ID (5)
+    0x96, (3 + MAX_BLOCK_SIZE) & 0xff,
+          (3 + MAX_BLOCK_SIZE) >> 8, //   REPORT_COUNT (3 + MAX_BLOCK_SIZE)
+    0x09, 0x00,                    //   USAGE (Undefined)
+    0xb2, 0x02, 0x01,              //   FEATURE (Data,Var,Abs,Buf)
+
+    0x85, 0x06,                    //   REPORT_ID (6)
+    0x95, 3 + 2 * CRC_PAGES,       //   REPORT_COUNT (3 + 2 * CRC_PAGES)
+    0x09, 0x00,                    //   USAGE (Undefined)
+    0xb2, 0x02, 0x01,              //   FEATURE (Data,Var,Abs,Buf)
+
+    0x85, 0x03,                    //   REPORT_ID (3)
+    0x95, 0x07,                    //   REPORT_COUNT (7)
+    0x09, 0x00,                    //   USAGE (Undefined)
+    0xb2, 0x02, 0x01,              //   FEATURE (Data,Var,Abs,Buf)
+    0x09, 0x00,                    //   USAGE (Undefined)
+    0x81, 0x02,                    //   INPUT (Data,Var,Abs)
+
+    0x85, 0x04,                    //   REPORT_ID (4)
+    0x95, 0x13,                    //   REPORT_COUNT (19)
+    0x09, 0x00,                    //   USAGE (Undefined)
+    0xb2, 0x02, 0x01,              //   FEATURE (Data,Var,Abs,Buf)
+
+    0x85, 0x07,                    //   REPORT_ID (7)
+    0x95, 0x0a,                    //   REPORT_COUNT (10)
+    0x09, 0x00,                    //   USAGE (Undefined)
+    0xb2, 0x02, 0x01,              //   FEATURE (Data,Var,Abs,Buf)
+
+    0x85, 0x08,                    //   REPORT_ID (8)
+    0x95, 5 + OTA_BATCH_SIZE,      //   REPORT_COUNT (5 + OTA_BATCH_SIZE)
+    0x09, 0x00,                    //   USAGE (Undefined)
+    0xb2, 0x02, 0x01,              //   FEATURE (Data,Var,Abs,Buf)
+
+    0x85, 0x09,                    //   REPORT_ID (9)
+    0x95, STATS_REPORT_SIZE - 1,   //   REPORT_COUNT (38)
+    0x09, 0x00,                    //   USAGE (Undefined)
+    0xb2, 0x02, 0x01,              //   FEATURE (Data,Var,Abs,Buf)
+
+    0xc0                           // END_COLLECTION
+};
+
+/* Copy of usbHidReportDescriptor in firmware/main.c (bridge application) */
+static const unsigned char  bridgeDescriptor[] = {
+    0x06, 0x00, 0xff,              // USAGE_PAGE (Vendor defined)
+    0x09, 0x01,                    // USAGE (Vendor Usage 1)
+    0xa1, 0x01,                    // COLLECTION (Application)
+    0x15, 0x00,                    //   LOGICAL_MINIMUM (0)
+    0x26, 0xff, 0x00,              //   LOGICAL_MAXIMUM (255)
+    0x75, 0x08,                    //   REPORT_SIZE (8)
+
+    0x85, BRIDGE_REPORT_DATA,      //   REPORT_ID (1)
+    0x95, BRIDGE_IN_REPORT_SIZE - 1, //   REPORT_COUNT (63)
+    0x09, 0x00,                    //   USAGE (Undefined)
+    0x81, 0x02,                    //   INPUT (Data,Var,Abs)
+
+    0x85, BRIDGE_REPORT_SEND,      //   REPORT_ID (2)
+    0x95, 1 + BRIDGE_MAX_PAYLOAD,  //   REPORT_COUNT (33)
+    0x09, 0x00,                    //   USAGE (Undefined)
+    0x91, 0x02,                    //   OUTPUT (Data,Var,Abs)
+
+    0x85, BRIDGE_REPORT_COUNTERS,  //   REPORT_ID (3)
+    0x95, BRIDGE_COUNTERS_SIZE - 1, //   REPORT_COUNT (32)
+    0x09, 0x00,                    //   USAGE (Undefined)
+    0xb2, 0x02, 0x01,              //   FEATURE (Data,Var,Abs,Buf)
+
+    0x85, BRIDGE_REPORT_ACK,       //   REPORT_ID (4)
+    0x95, 2 + BRIDGE_MAX_PAYLOAD,  //   REPORT_COUNT (34)
+    0x09, 0x00,                    //   USAGE (Undefined)
+    0x91, 0x02,                    //   OUTPUT (Data,Var,Abs)
+
+    0x85, BRIDGE_REPORT_CAPTURE,   //   REPORT_ID (5)
+    0x95, BRIDGE_CAPTURE_SIZE - 1, //   REPORT_COUNT (8)
+    0x09, 0x00,                    //   USAGE (Undefined)
+    0xb2, 0x02, 0x01,              //   FEATURE (Data,Var,Abs,Buf)
+
+    0x85, BRIDGE_REPORT_BOOT,      //   REPORT_ID (6)
+    0x95, BRIDGE_BOOT_SIZE - 1,    //   REPORT_COUNT (2)
+    0x09, 0x00,                    //   USAGE (Undefined)
+    0xb2, 0x02, 0x01,              //   FEATURE (Data,Var,Abs,Buf)
+
+    0xc0                           // END_COLLECTION
+};
+
+/* ------------------------------------------------------------------------- */
+
+typedef struct simConfig {
+    char    *productName;
+    char    *serialNumber;
+    int     eraseMs;        /* page erase time */
+    int     writeMs;        /* page write time */
+    int     usbMs;          /* extra latency added to every request */
+    int     radioMs;        /* air time of one relayed packet incl. ACK */
+    int     readyMs;        /* time the remote needs to answer START */
+    int     lossPercent;    /* relayed packets which fail */
+    int     remoteId;
+    int     remoteApp;      /* remote starts in its application */
+    int     bridge;         /* emulate the bridge application */
+    char    *flashFile;
+    char    *remoteFlashFile;
+    char    *initialFlashFile;
+} simConfig_t;
+
+typedef struct simStats {
+    long    getReports;
+    long    setReports;
+    long    bytesWritten;
+    long    pagesErased;
+    long    pagesWritten;
+    long    pagesSkipped;
+    long    radioPackets;
+    long    radioFailures;
+} simStats_t;
+
+enum {
+    REMOTE_APP = 0,         /* running its application */
+    REMOTE_BOOT_REQ,        /* boot loader broadcasting its boot request */
+    REMOTE_READY,           /* received START, ready to receive data */
+};
+
+static simConfig_t      config = {
+    .eraseMs = 4,
+    .writeMs = 4,
+    .usbMs = 0,
+    .radioMs = 1,
+    .readyMs = 100,
+    .lossPercent = 0,
+    .remoteId = 0x11,
+};
+static simStats_t       stats;
+static simStats_t       statsCleared;   /* stats at the last SET of report 9 */
+static unsigned char    flash[FLASH_SIZE];
+static unsigned char    remoteFlash[REMOTE_FLASH_SIZE];
+static volatile int     quit;
+static int              reboot;         /* switch between bridge and boot loader */
+static int              startedAsBridge;
+static int              crcAddress;
+
+/* relay state, mirrors the globals in bootloader/firmware/main.c */
+static int              bootInProgress;
+static int              bootAckPld;
+static int              appPaging;  /* device ID of CMD_OTA_APP_REBOOT, 0 = none */
+static unsigned char    replyBufferRemote[8] = {3};
+static int              statusIn;   /* replyBufferRemote is due as input report */
+static int              remoteState = REMOTE_BOOT_REQ;
+static long             remoteReadyTime;
+static unsigned char    remoteCrcReply[6];  /* ACK payload loaded by the remote */
+static unsigned char    session[11] = {7};  /* report 7 */
+static long             sessionDeadline;
+static unsigned char    batch[7] = {8};     /* report 8 */
+
+/* bridge state */
+static unsigned char    bridgeSeq;
+static unsigned char    echoPayload[BRIDGE_MAX_PAYLOAD];    /* remote's ACK payload */
+static int              echoLen;
+static unsigned char    bridgeCounters[BRIDGE_COUNTERS_SIZE] = {BRIDGE_REPORT_COUNTERS};
+static unsigned char    bridgeCapture[BRIDGE_CAPTURE_SIZE] = {BRIDGE_REPORT_CAPTURE};  /* not emulated */
+
+/* ------------------------------------------------------------------------- */
+
+static long now_ms(void)
+{
+struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+static void sleep_ms(int milliseconds)
+{
+struct timespec ts;
+
+    if(milliseconds <= 0)
+        return;
+    ts.tv_sec = milliseconds / 1000;
+    ts.tv_nsec = (milliseconds % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+}
+
+static int  uhidWrite(int fd, struct uhid_event *ev)
+{
+ssize_t rval;
+
+    rval = write(fd, ev, sizeof(*ev));
+    if(rval < 0){
+        fprintf(stderr, "Cannot write to uhid: %s\n", strerror(errno));
+        return -1;
+    }
+    return rval == sizeof(*ev) ? 0 : -1;
+}
+
+static int  dumpFile(char *name, unsigned char *data, int len)
+{
+FILE    *fp;
+
+    if(name == NULL)
+        return 0;
+    if((fp = fopen(name, "wb")) == NULL){
+        fprintf(stderr, "error opening %s: %s\n", name, strerror(errno));
+        return -1;
+    }
+    fwrite(data, 1, len, fp);
+    fclose(fp);
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* Simulates one relayed radio packet: returns the transmit status as
+ * rf24_transmit_packet() would (0 = ACK received).
+ */
+static int  radioTransmit(void)
+{
+    sleep_ms(config.radioMs);
+    stats.radioPackets++;
+    if(config.lossPercent > 0 && (rand() % 100) < config.lossPercent){
+        stats.radioFailures++;
+        return 1;
+    }
+    return 0;
+}
+
+static void remoteDeviceInfo(unsigned char *data, int status)
+{
+    data[0] = config.remoteId;
+    data[1] = STATUS_TYPE_DEVINFO;
+    data[2] = status;
+    data[3] = REMOTE_PAGE_SIZE / 2;
+    data[4] = REMOTE_FLASH_SIZE / 1024;
+}
+
+/* Updates replyBufferRemote the way the relay main loop does when it
+ * receives packets from the remote while not in a boot session.
+ */
+static void relayPoll(void)
+{
+    if(bootInProgress)
+        return;
+    if(remoteState == REMOTE_APP && appPaging == config.remoteId){
+        remoteState = REMOTE_BOOT_REQ;     /* ota_app_ack_payload() resets it */
+        appPaging = 0;
+    }
+    if(remoteState == REMOTE_BOOT_REQ){
+        remoteDeviceInfo(&replyBufferRemote[1], STATUS_OTA_BOOT_REQ);
+        if(bootAckPld){  /* remote picks up START from the ACK payload */
+            remoteState = REMOTE_READY;
+            remoteReadyTime = now_ms() + config.readyMs;
+        }
+    }else if(remoteState == REMOTE_READY && now_ms() >= remoteReadyTime){
+        remoteDeviceInfo(&replyBufferRemote[1], STATUS_OTA_BOOT_READY);
+    }
+}
+
+/* Packet of a session, retransmitted like rf24_txq_retries() does */
+static int  sessionTransmit(void)
+{
+int i;
+
+    for(i = 0; i <= SESSION_RETRIES; i++){
+        if(radioTransmit() == 0)
+            return 0;
+    }
+    return 1;
+}
+
+static void sessionFail(int error, int address)
+{
+    session[1] = SESSION_FAILED;
+    session[2] = error;
+    session[8] = address & 0xff;
+    session[9] = (address >> 8) & 0xff;
+    session[10] = (address >> 16) & 0xff;
+}
+
+/* Runs the handshake of sessionDevInfo() and sessionPoll() in the firmware */
+static void sessionPoll(void)
+{
+    relayPoll();
+    if(session[1] == SESSION_WAIT_REQ && remoteState == REMOTE_BOOT_REQ
+       && (session[3] == 0 || session[3] == config.remoteId)){
+        session[3] = config.remoteId;
+        session[1] = SESSION_WAIT_READY;
+        bootAckPld = 1;
+        relayPoll();    /* remote picks up START */
+        sessionDeadline = now_ms() + SESSION_TIMEOUT;
+    }else if(session[1] == SESSION_WAIT_READY && remoteState == REMOTE_READY && now_ms() >= remoteReadyTime){
+        session[1] = SESSION_ACTIVE;
+        session[4] = REMOTE_PAGE_SIZE / 2;
+        session[5] = REMOTE_FLASH_SIZE / 1024;
+        bootAckPld = 0;
+        bootInProgress = 1;
+    }
+    if((session[1] == SESSION_WAIT_REQ || session[1] == SESSION_WAIT_READY) && now_ms() >= sessionDeadline)
+        sessionFail(SESSION_ERR_TIMEOUT, 0);
+    if(session[1] == SESSION_FAILED)
+        appPaging = 0;
+}
+
+/* STOP or RESET behind the data blocks */
+static void sessionFinish(int flags)
+{
+    if(session[1] != SESSION_ACTIVE && session[1] != SESSION_DONE)
+        return;
+    if(sessionTransmit() != 0){
+        sessionFail(SESSION_ERR_RADIO, 0);
+    }else{
+        session[1] = SESSION_DONE;
+        session[6]++;
+        if(flags & SESSION_FINISH_RESET)
+            remoteState = REMOTE_APP;
+    }
+    if(flags & SESSION_FINISH_RESET)
+        bootInProgress = 0;
+}
+
+/* CRC-16 as _crc16_update() (start 0xffff), bytes beyond 'size' read 0xff */
+static unsigned memoryCrc(unsigned char *mem, int size, int address, int len)
+{
+int         k;
+unsigned    crc = 0xffff;
+
+    for(; len > 0; len--, address++){
+        crc ^= address < size ? mem[address] : 0xff;
+        for(k = 0; k < 8; k++)
+            crc = (crc & 1) ? (crc >> 1) ^ 0xa001 : crc >> 1;
+    }
+    return crc;
+}
+
+/* Returns -1 (STALL) if the command is refused */
+static int  relayCommand(unsigned char *data)
+{
+int cmd = data[2];
+
+    replyBufferRemote[2] = 0;
+    if(cmd == CMD_OTA_BOOT_START){
+        bootAckPld = 1;
+        session[1] = SESSION_IDLE;
+    }else if(cmd == CMD_OTA_APP_REBOOT){
+        if(session[1] != SESSION_WAIT_REQ || data[1] == 0 || data[1] != session[3])
+            return -1;
+        appPaging = data[1];
+    }else if(cmd == CMD_OTA_BOOT_END){
+        bootInProgress = 0;
+        bootAckPld = 0;
+        appPaging = 0;
+        session[1] = SESSION_IDLE;
+    }else if(cmd == CMD_OTA_BOOT_TXMODE){
+        bootInProgress = 1;
+    }else if(cmd == CMD_OTA_BOOT_SESSION){
+        bootInProgress = 0;
+        bootAckPld = 0;
+        appPaging = 0;
+        memset(session + 1, 0, sizeof(session) - 1);
+        session[1] = SESSION_WAIT_REQ;
+        session[3] = data[1];
+        sessionDeadline = now_ms() + SESSION_TIMEOUT;
+    }else if(cmd == CMD_OTA_BOOT_FINISH){
+        sessionFinish(data[3]);
+    }else{
+        statusIn = 1;
+        if((replyBufferRemote[1] = radioTransmit()) == 0 && data[1] == config.remoteId){
+            replyBufferRemote[2] = config.remoteId;
+            replyBufferRemote[3] = STATUS_TYPE_BOOT;
+            replyBufferRemote[4] = STATUS_OTA_BOOT_OK;
+            if(cmd == CMD_OTA_BOOT_RESET)
+                remoteState = REMOTE_APP;
+            if(cmd == CMD_OTA_BOOT_POLL && remoteCrcReply[0] != 0){
+                memcpy(&replyBufferRemote[2], remoteCrcReply, 6);
+                remoteCrcReply[0] = 0;
+            }
+            if(cmd == CMD_OTA_BOOT_PAGECRC){    /* answered with the next ACK */
+                unsigned address = data[3] | (data[4] << 8), crc;
+                crc = memoryCrc(remoteFlash, REMOTE_FLASH_SIZE, address, data[5] | (data[6] << 8));
+                remoteCrcReply[0] = config.remoteId;
+                remoteCrcReply[1] = STATUS_TYPE_PAGECRC;
+                remoteCrcReply[2] = data[3];
+                remoteCrcReply[3] = data[4];
+                remoteCrcReply[4] = crc & 0xff;
+                remoteCrcReply[5] = crc >> 8;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Returns -1 (STALL) for data outside an active session */
+static int  relayData(unsigned char *data, int len)
+{
+int address;
+
+    replyBufferRemote[2] = 0;
+    if(len < 3 + REMOTE_BLOCK_SIZE)
+        return 0;
+    address = data[0] | (data[1] << 8) | (data[2] << 16);
+    if(session[1] != SESSION_IDLE){
+        if(session[1] != SESSION_ACTIVE)
+            return -1;
+        if(sessionTransmit() != 0){
+            sessionFail(SESSION_ERR_RADIO, address);
+            return 0;
+        }
+        if(address + REMOTE_BLOCK_SIZE <= REMOTE_FLASH_SIZE)
+            memcpy(remoteFlash + address, data + 3, REMOTE_BLOCK_SIZE);
+        session[6]++;
+        if(session[6] == 0)
+            session[7]++;
+        return 0;
+    }
+    statusIn = 1;
+    if((replyBufferRemote[1] = radioTransmit()) == 0){
+        if(remoteState == REMOTE_READY && address + REMOTE_BLOCK_SIZE <= REMOTE_FLASH_SIZE)
+            memcpy(remoteFlash + address, data + 3, REMOTE_BLOCK_SIZE);
+        replyBufferRemote[2] = config.remoteId;
+        replyBufferRemote[3] = STATUS_TYPE_BOOT;
+        replyBufferRemote[4] = STATUS_OTA_BOOT_OK;
+    }
+    return 0;
+}
+
+/* Emulates batchReceive() and batchPoll(): the packets selected by the mask
+ * are relayed like report 4 blocks.
+ */
+static int  relayBatch(unsigned char *data, int len)
+{
+unsigned char   packet[3 + REMOTE_BLOCK_SIZE];
+int             address, mask, i, acked = 0;
+
+    if(len < 5 + OTA_BATCH_SIZE || !bootInProgress || (session[1] != SESSION_IDLE && session[1] != SESSION_ACTIVE))
+        return -1;
+    address = data[0] | (data[1] << 8) | (data[2] << 16);
+    mask = data[3] | (data[4] << 8);
+    for(i = 0; i < OTA_BATCH_PACKETS; i++){
+        if(!(mask & (1 << i)))
+            continue;
+        packet[0] = (address + 16 * i) & 0xff;
+        packet[1] = ((address + 16 * i) >> 8) & 0xff;
+        packet[2] = (address + 16 * i) >> 16;
+        memcpy(packet + 3, data + 5 + 16 * i, REMOTE_BLOCK_SIZE);
+        relayData(packet, sizeof(packet));
+        if(session[1] != SESSION_IDLE ? session[1] == SESSION_ACTIVE : replyBufferRemote[1] == 0)
+            acked |= 1 << i;
+    }
+    memcpy(batch + 1, data, 3);
+    batch[4] = 0;   /* all packets done before the SET completes */
+    batch[5] = acked & 0xff;
+    batch[6] = acked >> 8;
+    return 0;
+}
+
+/* Emulates usbFunctionWrite() for reports 2 and 5. Like the boot loader,
+ * a page is only erased and written when it is complete: pages which match
+ * the flash are skipped, blank pages are only erased.
+ */
+static void writeFlash(unsigned char *data, int len)
+{
+static unsigned char    page[PAGE_SIZE];
+int                     address, pageAddr, i, blank;
+
+    address = data[0] | (data[1] << 8) | (data[2] << 16);
+    data += 3;
+    len -= 3;
+    while(len > 0){
+        int chunk = PAGE_SIZE - (address & (PAGE_SIZE - 1));
+        if(chunk > len)
+            chunk = len;
+        memcpy(page + (address & (PAGE_SIZE - 1)), data, chunk);
+        address += chunk;
+        data += chunk;
+        len -= chunk;
+        if((address & (PAGE_SIZE - 1)) != 0)
+            continue;
+        pageAddr = address - PAGE_SIZE;
+        if(pageAddr + PAGE_SIZE > FLASH_SIZE)
+            continue;
+        if(memcmp(flash + pageAddr, page, PAGE_SIZE) == 0){
+            stats.pagesSkipped++;
+            continue;
+        }
+        sleep_ms(config.eraseMs);
+        stats.pagesErased++;
+        for(i = 0, blank = 1; i < PAGE_SIZE; i++){
+            if(page[i] != 0xff)
+                blank = 0;
+        }
+        memcpy(flash + pageAddr, page, PAGE_SIZE);
+        if(!blank){
+            sleep_ms(config.writeMs);
+            stats.pagesWritten++;
+        }
+    }
+}
+
+static void putInt(unsigned char **p, unsigned long value, int numBytes)
+{
+    while(numBytes--){
+        *(*p)++ = value & 0xff;
+        value >>= 8;
+    }
+}
+
+/* Emulates report 9 from the counters since the last clear, in Timer 1
+ * ticks of the firmware. Flash times are the configured ones, retransmits
+ * and the main loop are not emulated.
+ */
+static int  statsReport(unsigned char *buffer)
+{
+unsigned char   *p = buffer;
+long            erases = stats.pagesErased - statsCleared.pagesErased;
+long            writes = stats.pagesWritten - statsCleared.pagesWritten;
+
+    *p++ = 9;
+    putInt(&p, TICKS_PER_MS, 2);
+    putInt(&p, stats.setReports - statsCleared.setReports, 2);
+    putInt(&p, stats.getReports - statsCleared.getReports, 2);
+    putInt(&p, erases, 2);
+    putInt(&p, writes, 2);
+    putInt(&p, erases ? config.eraseMs * TICKS_PER_MS : 0, 2);
+    putInt(&p, writes ? config.writeMs * TICKS_PER_MS : 0, 2);
+    putInt(&p, (erases * config.eraseMs + writes * config.writeMs) * TICKS_PER_MS, 4);
+    putInt(&p, stats.radioPackets - statsCleared.radioPackets, 2);
+    putInt(&p, stats.radioFailures - statsCleared.radioFailures, 2);
+    memset(p, 0, buffer + STATS_REPORT_SIZE - p);
+    return STATS_REPORT_SIZE;
+}
+
+/* Emulates calcPageCrcs(): CRC-16 (_crc16_update(), start 0xffff) of
+ * CRC_PAGES pages starting at crcAddress.
+ */
+static int  pageCrcs(unsigned char *buffer)
+{
+int         i;
+unsigned    crc;
+
+    buffer[0] = 6;
+    buffer[1] = crcAddress & 0xff;
+    buffer[2] = (crcAddress >> 8) & 0xff;
+    buffer[3] = (crcAddress >> 16) & 0xff;
+    for(i = 0; i < CRC_PAGES; i++){
+        crc = memoryCrc(flash, FLASH_SIZE, crcAddress, PAGE_SIZE);
+        crcAddress += PAGE_SIZE;
+        buffer[4 + 2 * i] = crc & 0xff;
+        buffer[5 + 2 * i] = crc >> 8;
+    }
+    return 4 + 2 * CRC_PAGES;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* Returns the length of the report placed in 'buffer' (including report ID)
+ * or -1 if the report is not supported.
+ */
+static int  handleGetReport(int reportId, unsigned char *buffer)
+{
+    stats.getReports++;
+    if(config.bridge){
+        if(reportId == BRIDGE_REPORT_CAPTURE){
+            memcpy(buffer, bridgeCapture, sizeof(bridgeCapture));
+            return sizeof(bridgeCapture);
+        }
+        if(reportId != BRIDGE_REPORT_COUNTERS)
+            return -1;
+        memcpy(buffer, bridgeCounters, sizeof(bridgeCounters));
+        return sizeof(bridgeCounters);
+    }
+    switch(reportId){
+    case 1:
+        buffer[0] = 1;
+        buffer[1] = PAGE_SIZE & 0xff;
+        buffer[2] = PAGE_SIZE >> 8;
+        buffer[3] = FLASH_SIZE & 0xff;
+        buffer[4] = (FLASH_SIZE >> 8) & 0xff;
+        buffer[5] = (FLASH_SIZE >> 16) & 0xff;
+        buffer[6] = (FLASH_SIZE >> 24) & 0xff;
+        buffer[7] = MAX_BLOCK_SIZE & 0xff;
+        buffer[8] = MAX_BLOCK_SIZE >> 8;
+        buffer[9] = DEVINFO_FLAG_PAGE_CRC | DEVINFO_FLAG_SESSION | DEVINFO_FLAG_BATCH | DEVINFO_FLAG_STATUS_IN | DEVINFO_FLAG_STATS
+                    | DEVINFO_FLAG_SKIP | DEVINFO_FLAG_APP_REBOOT;
+        buffer[10] = BOOT_SIZE & 0xff;
+        buffer[11] = BOOT_SIZE >> 8;
+        buffer[12] = stats.pagesSkipped & 0xff;
+        buffer[13] = (stats.pagesSkipped >> 8) & 0xff;
+        return DEVINFO_LEN;
+    case 3:
+        relayPoll();
+        memcpy(buffer, replyBufferRemote, sizeof(replyBufferRemote));
+        return sizeof(replyBufferRemote);
+    case 6:
+        return pageCrcs(buffer);
+    case 7:
+        sessionPoll();
+        memcpy(buffer, session, sizeof(session));
+        return sizeof(session);
+    case 8:
+        memcpy(buffer, batch, sizeof(batch));
+        return sizeof(batch);
+    case 9:
+        return statsReport(buffer);
+    }
+    return -1;
+}
+
+/* Returns 0 on success, -1 if the report is not supported. */
+static int  handleSetReport(int reportId, unsigned char *data, int len)
+{
+    stats.setReports++;
+    if(config.bridge){
+        if(reportId == BRIDGE_REPORT_CAPTURE && len >= BRIDGE_CAPTURE_SIZE){
+            memcpy(bridgeCapture, data, BRIDGE_CAPTURE_SIZE);
+            return 0;
+        }
+        if(reportId == BRIDGE_REPORT_BOOT && len >= BRIDGE_BOOT_SIZE){
+            if((data[1] | (data[2] << 8)) == BRIDGE_BOOT_KEY)
+                reboot = 1;
+            return 0;
+        }
+        if(reportId != BRIDGE_REPORT_COUNTERS)
+            return -1;
+        memset(bridgeCounters + 1, 0, sizeof(bridgeCounters) - 1);
+        return 0;
+    }
+    switch(reportId){
+    case 1:     /* leave boot loader */
+        if(startedAsBridge)
+            reboot = 1;     /* back to the application */
+        else
+            quit = 1;
+        return 0;
+    case 2:
+    case 5:
+        if(len < 4)
+            return -1;
+        writeFlash(data + 1, len - 1);
+        stats.bytesWritten += len - 4;
+        return 0;
+    case 3:
+        if(len < 3)
+            return -1;
+        return relayCommand(data);
+    case 4:
+        return relayData(data + 1, len - 1);
+    case 8:
+        return relayBatch(data + 1, len - 1);
+    case 9:     /* clear counters */
+        statsCleared = stats;
+        return 0;
+    case 6:
+        if(len < 4)
+            return -1;
+        crcAddress = data[1] | (data[2] << 8) | (data[3] << 16);
+        return 0;
+    }
+    return -1;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void counterAdd(int offset, int size)
+{
+int i;
+
+    for(i = 0; i < size; i++){
+        if(++bridgeCounters[offset + i] != 0)
+            break;
+    }
+}
+
+static int  uhidInput(int fd, unsigned char *report, int len)
+{
+struct uhid_event   ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.type = UHID_INPUT2;
+    memcpy(ev.u.input2.data, report, len);
+    ev.u.input2.size = len;
+    return uhidWrite(fd, &ev);
+}
+
+/* Emulates report 2 of the bridge: the packet goes to the remote on pipe 0,
+ * which answers with its ACK payload and loads echo requests as the next one.
+ * The ACK payload and the event record (if requested) come back in one input
+ * report, as the firmware sends them.
+ */
+static int  bridgeSend(int fd, unsigned char *data, int size)
+{
+unsigned char   report[BRIDGE_IN_REPORT_SIZE] = {BRIDGE_REPORT_DATA};
+int             len, n = 2, status;
+long            air;
+
+    if(size < 3)
+        return 0;
+    len = data[1] & ~BRIDGE_SEND_EVENT;
+    if(len == 0 || len > BRIDGE_MAX_PAYLOAD || size < 2 + len)
+        return 0;
+    status = radioTransmit();
+    if(status == 0){
+        counterAdd(BRIDGE_CNT_TX_PACKETS, 4);
+        if(echoLen > 0){
+            report[n++] = BRIDGE_RECORD(0, echoLen);
+            memcpy(report + n, echoPayload, echoLen);
+            n += echoLen;
+            echoLen = 0;
+            counterAdd(BRIDGE_CNT_RX_PACKETS, 4);
+        }
+        if(data[2] == BRIDGE_ECHO_REQUEST){
+            memcpy(echoPayload, data + 2, len);
+            echoLen = len;
+        }
+    }else{
+        counterAdd(BRIDGE_CNT_TX_FAILED, 2);
+    }
+    if(data[1] & BRIDGE_SEND_EVENT){
+        air = config.radioMs * BRIDGE_TICK_HZ / 1000;
+        report[n++] = BRIDGE_RECORD(BRIDGE_PIPE_EVENT, BRIDGE_EVENT_TX_SIZE);
+        report[n++] = BRIDGE_EVENT_TX;
+        report[n++] = bridgeSeq;
+        report[n++] = status;
+        report[n++] = air & 0xff;
+        report[n++] = (air >> 8) & 0xff;
+    }
+    bridgeSeq++;
+    if(n == 2)
+        return 0;
+    report[1] = n - 2;
+    return uhidInput(fd, report, n);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static int  createDevice(int fd)
+{
+struct uhid_event   ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.type = UHID_CREATE2;
+    /* the HID core names USB devices "<manufacturer> <product>" */
+    snprintf((char *)ev.u.create2.name, sizeof(ev.u.create2.name), "%s %s", IDENT_VENDOR_STRING, config.productName);
+    snprintf((char *)ev.u.create2.phys, sizeof(ev.u.create2.phys), "usbxr-sim");
+    if(config.serialNumber != NULL)
+        snprintf((char *)ev.u.create2.uniq, sizeof(ev.u.create2.uniq), "%s", config.serialNumber);
+    if(config.bridge){
+        memcpy(ev.u.create2.rd_data, bridgeDescriptor, sizeof(bridgeDescriptor));
+        ev.u.create2.rd_size = sizeof(bridgeDescriptor);
+    }else{
+        memcpy(ev.u.create2.rd_data, reportDescriptor, sizeof(reportDescriptor));
+        ev.u.create2.rd_size = sizeof(reportDescriptor);
+    }
+    ev.u.create2.bus = BUS_USB;
+    ev.u.create2.vendor = IDENT_VENDOR_NUM;
+    ev.u.create2.product = IDENT_PRODUCT_NUM;
+    ev.u.create2.version = 0x0100;
+    return uhidWrite(fd, &ev);
+}
+
+static int  handleEvent(int fd)
+{
+struct uhid_event   ev, reply;
+ssize_t             rval;
+
+    memset(&ev, 0, sizeof(ev));
+    if((rval = read(fd, &ev, sizeof(ev))) < 0){
+        if(errno == EINTR)
+            return 0;
+        fprintf(stderr, "Cannot read from uhid: %s\n", strerror(errno));
+        return -1;
+    }
+    sleep_ms(config.usbMs);
+    memset(&reply, 0, sizeof(reply));
+    switch(ev.type){
+    case UHID_GET_REPORT:
+        reply.type = UHID_GET_REPORT_REPLY;
+        reply.u.get_report_reply.id = ev.u.get_report.id;
+        rval = -1;
+        if(ev.u.get_report.rtype == UHID_FEATURE_REPORT)
+            rval = handleGetReport(ev.u.get_report.rnum, reply.u.get_report_reply.data);
+        if(rval < 0){
+            reply.u.get_report_reply.err = EIO;
+        }else{
+            reply.u.get_report_reply.size = rval;
+        }
+        return uhidWrite(fd, &reply);
+    case UHID_SET_REPORT:
+        reply.type = UHID_SET_REPORT_REPLY;
+        reply.u.set_report_reply.id = ev.u.set_report.id;
+        rval = -1;
+        if(ev.u.set_report.rtype == UHID_FEATURE_REPORT)
+            rval = handleSetReport(ev.u.set_report.rnum, ev.u.set_report.data, ev.u.set_report.size);
+        if(rval < 0)
+            reply.u.set_report_reply.err = EIO;
+        if(uhidWrite(fd, &reply) != 0)
+            return -1;
+        if(statusIn){   /* relay reports the end of the transmission */
+            statusIn = 0;
+            return uhidInput(fd, replyBufferRemote, sizeof(replyBufferRemote));
+        }
+        return 0;
+    case UHID_OUTPUT:   /* write() to hidraw, bridge reports 2 and 4 */
+        stats.setReports++;
+        if(config.bridge && ev.u.output.size > 0 && ev.u.output.data[0] == BRIDGE_REPORT_SEND && !bridgeCapture[1])
+            return bridgeSend(fd, ev.u.output.data, ev.u.output.size);
+        return 0;
+    default:    /* UHID_START, UHID_OPEN etc. need no answer */
+        return 0;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void signalHandler(int sig)
+{
+    quit = 1;
+}
+
+static void printUsage(char *pname)
+{
+    fprintf(stderr, "usage: %s [options]\n", pname);
+    fprintf(stderr, "  -b          emulate the bridge application instead of the boot loader,\n");
+    fprintf(stderr, "              which report 6 resets into the boot loader and back\n");
+    fprintf(stderr, "  -n <name>   product string (default \"%s\", \"%s\" with -b)\n", IDENT_PRODUCT_STRING, IDENT_BRIDGE_STRING);
+    fprintf(stderr, "  -s <serial> serial number (default none)\n");
+    fprintf(stderr, "  -e <ms>     page erase time (default %d)\n", config.eraseMs);
+    fprintf(stderr, "  -w <ms>     page write time (default %d)\n", config.writeMs);
+    fprintf(stderr, "  -u <ms>     extra latency per USB request (default %d)\n", config.usbMs);
+    fprintf(stderr, "  -t <ms>     air time per relayed packet (default %d)\n", config.radioMs);
+    fprintf(stderr, "  -R <ms>     remote START to READY time (default %d)\n", config.readyMs);
+    fprintf(stderr, "  -l <pct>    relayed packet loss in percent (default %d)\n", config.lossPercent);
+    fprintf(stderr, "  -d <id>     remote device ID (default 0x%02x)\n", config.remoteId);
+    fprintf(stderr, "  -a          remote runs its application until CMD_OTA_APP_REBOOT\n");
+    fprintf(stderr, "  -i <file>   load local flash image from file at start\n");
+    fprintf(stderr, "  -o <file>   write local flash image to file on exit\n");
+    fprintf(stderr, "  -O <file>   write remote flash image to file on exit\n");
+}
+
+int main(int argc, char **argv)
+{
+int             fd, opt;
+struct pollfd   pfd;
+struct uhid_event   ev;
+
+    while((opt = getopt(argc, argv, "bn:s:e:w:u:t:R:l:d:ai:o:O:h")) != -1){
+        switch(opt){
+        case 'b': config.bridge = 1; break;
+        case 'n': config.productName = optarg; break;
+        case 's': config.serialNumber = optarg; break;
+        case 'e': config.eraseMs = atoi(optarg); break;
+        case 'w': config.writeMs = atoi(optarg); break;
+        case 'u': config.usbMs = atoi(optarg); break;
+        case 't': config.radioMs = atoi(optarg); break;
+        case 'R': config.readyMs = atoi(optarg); break;
+        case 'l': config.lossPercent = atoi(optarg); break;
+        case 'd': config.remoteId = strtol(optarg, NULL, 0); break;
+        case 'a': config.remoteApp = 1; break;
+        case 'i': config.initialFlashFile = optarg; break;
+        case 'o': config.flashFile = optarg; break;
+        case 'O': config.remoteFlashFile = optarg; break;
+        default:
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    startedAsBridge = config.bridge;
+    if(config.remoteApp)
+        remoteState = REMOTE_APP;
+    if(config.productName == NULL)
+        config.productName = config.bridge ? IDENT_BRIDGE_STRING : IDENT_PRODUCT_STRING;
+    memset(flash, 0xff, sizeof(flash));
+    memset(remoteFlash, 0xff, sizeof(remoteFlash));
+    if(config.initialFlashFile != NULL){
+        FILE *fp = fopen(config.initialFlashFile, "rb");
+        if(fp == NULL){
+            fprintf(stderr, "error opening %s: %s\n", config.initialFlashFile, strerror(errno));
+            return 1;
+        }
+        if(fread(flash, 1, sizeof(flash), fp) == 0)
+            fprintf(stderr, "Warning: %s is empty\n", config.initialFlashFile);
+        fclose(fp);
+    }
+    if((fd = open("/dev/uhid", O_RDWR | O_CLOEXEC)) < 0){
+        fprintf(stderr, "Cannot open /dev/uhid: %s\n", strerror(errno));
+        return 1;
+    }
+    if(createDevice(fd) != 0)
+        return 1;
+    signal(SIGINT, signalHandler);
+    signal(SIGTERM, signalHandler);
+    printf("Created virtual '%s %s' device (VID:0x%04x PID:0x%04x)\n", IDENT_VENDOR_STRING, config.productName, IDENT_VENDOR_NUM, IDENT_PRODUCT_NUM);
+    fflush(stdout);
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while(!quit){
+        if(poll(&pfd, 1, 100) <= 0)
+            continue;
+        if(handleEvent(fd) != 0)
+            break;
+        if(reboot){     /* the device disconnects and comes back with the other firmware */
+            reboot = 0;
+            memset(&ev, 0, sizeof(ev));
+            ev.type = UHID_DESTROY;
+            uhidWrite(fd, &ev);
+            config.bridge = !config.bridge;
+            config.productName = config.bridge ? IDENT_BRIDGE_STRING : IDENT_PRODUCT_STRING;
+            sleep_ms(300);
+            if(createDevice(fd) != 0)
+                break;
+            printf("Reset, now '%s %s'\n", IDENT_VENDOR_STRING, config.productName);
+            fflush(stdout);
+        }
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.type = UHID_DESTROY;
+    uhidWrite(fd, &ev);
+    close(fd);
+    printf("GET reports: %ld, SET reports: %ld, bytes written: %ld, pages written: %ld, skipped: %ld\n",
+           stats.getReports, stats.setReports, stats.bytesWritten, stats.pagesWritten, stats.pagesSkipped);
+    printf("relayed packets: %ld, failed: %ld\n", stats.radioPackets, stats.radioFailures);
+    if(dumpFile(config.flashFile, flash, sizeof(flash)) || dumpFile(config.remoteFlashFile, remoteFlash, sizeof(remoteFlash)))
+        return 1;
+    return 0;
+}
@@ -0,0 +1,116 @@
+/* Name: bridge_defs.h
+ * Project: usbXR USB-to-RF bridge
+ * Tabsize: 4
+ *
+ * For: usbXR project: https://github.com/visakhanc/usbXR
+ */
+
+#ifndef BRIDGE_DEFS_H_
+#define BRIDGE_DEFS_H_
+
+/*
+Reports of the bridge application ("usbXR Bridge", same VID/PID as HIDBoot):
+
+Report 1, input (interrupt-in endpoint):
+    [1, n, n bytes of records]
+    One record per RF packet: [header, payload], the header holds the RX
+    pipe and the payload length, see BRIDGE_RECORD_*. Records of all pipes
+    (taken in turn) are packed back to back, so several small packets share
+    one transfer; a record never spans two reports. Reports are sent as soon
+    as data is available and end with a short packet, so they can be shorter
+    than BRIDGE_IN_REPORT_SIZE.
+
+Report 2, output (SET_REPORT on the control endpoint):
+    [2, length, payload (up to 32 bytes)]
+    Transmits one RF packet to the pipe 0 address. The request is stalled if
+    the transmit queue is full; write() fails then and should be repeated.
+    With BRIDGE_SEND_EVENT set in the length byte, the result of the packet
+    is reported by a BRIDGE_EVENT_TX record.
+
+Report 3, feature:
+    GET returns the counters below (all little endian), SET clears them. The
+    last two fields are the RAM use (stack_paint.h), which SET leaves alone.
+
+Report 4, output:
+    [4, pipe, length, payload (up to 32 bytes)]
+    Sets the ACK payload which the remote on 'pipe' gets with the ACK of its
+    next packet. It replaces a payload not yet sent.
+
+Report 5, feature:
+    [5, mode, channel, address width, address (5 bytes)]
+    SET with mode 1 switches to capture mode: the radio listens passively
+    (no ACKs) on 'channel' and 'address' (width 2..5, the bytes in the order
+    of CONFIG_RF24_ADDRESS) and every packet comes as a BRIDGE_PIPE_CAPTURE
+    record. Mode 0 returns to normal operation. Report 2 is stalled while
+    capturing. GET returns the current settings.
+
+Report 6, feature:
+    [6, key (2 bytes, BRIDGE_BOOT_KEY)]
+    SET resets the bridge into the HID boot loader, about 20 ms later so the
+    request completes first (bootloader_entry.h). The device then comes back
+    as HIDBoot; bootloadHID does this by itself when it finds the bridge
+    instead of the boot loader. Other keys are ignored.
+
+Capture records (pipe BRIDGE_PIPE_CAPTURE):
+    [timestamp (2 bytes), raw packet]
+    The timestamp (BRIDGE_TICK_HZ ticks, wraps around) is taken when the
+    packet arrived, the raw packet is the on-air bit stream after the address
+    as returned by rf24_capture_receive(), cut to BRIDGE_CAPTURE_RAW bytes.
+
+Event records come in report 1 with pipe number BRIDGE_PIPE_EVENT:
+    [BRIDGE_EVENT_TX, seq, status, air time (2 bytes)]
+    'seq' counts the accepted report 2 packets (modulo 256, from 0 after
+    reset), 'status' is 0 if the packet was acknowledged. The air time runs
+    from the moment the radio starts sending the packet to the ACK (or the
+    last retransmit), in BRIDGE_TICK_HZ ticks.
+
+Echo protocol (usbxr-ping): a remote which supports it loads every packet
+starting with BRIDGE_ECHO_REQUEST unchanged as the ACK payload for the next
+packet it receives. The host sends the request followed by a
+BRIDGE_ECHO_POLL packet and gets the echo as a pipe 0 record.
+*/
+
+#define BRIDGE_REPORT_DATA          1
+#define BRIDGE_REPORT_SEND          2
+#define BRIDGE_REPORT_COUNTERS      3
+#define BRIDGE_REPORT_ACK           4
+#define BRIDGE_REPORT_CAPTURE       5
+#define BRIDGE_REPORT_BOOT          6
+
+#define BRIDGE_IN_REPORT_SIZE       64      /* including report ID */
+#define BRIDGE_MAX_PAYLOAD          32
+
+#define BRIDGE_SEND_EVENT           0x80    /* report 2: length flag */
+
+#define BRIDGE_PIPE_CAPTURE         6       /* records of captured packets */
+#define BRIDGE_PIPE_EVENT           7       /* records from the bridge itself */
+#define BRIDGE_EVENT_TX             1
+#define BRIDGE_EVENT_TX_SIZE        5
+#define BRIDGE_TICK_HZ              187500L /* F_CPU / 64 */
+
+#define BRIDGE_CAPTURE_SIZE         9       /* report 5 including report ID */
+#define BRIDGE_CAPTURE_RAW          (BRIDGE_MAX_PAYLOAD - 2)
+
+#define BRIDGE_BOOT_SIZE            3       /* report 6 including report ID */
+#define BRIDGE_BOOT_KEY             0xb007  /* little endian */
+
+#define BRIDGE_ECHO_REQUEST         0xe0    /* [0xe0, sequence, any data] */
+#define BRIDGE_ECHO_POLL            0xe1
+
+#define BRIDGE_RECORD(pipe, len)    (((pipe) << 5) | ((len) - 1))
+#define BRIDGE_RECORD_PIPE(header)  ((header) >> 5)
+#define BRIDGE_RECORD_LEN(header)   (((header) & 0x1f) + 1)
+
+/* Byte offsets in report 3 */
+#define BRIDGE_CNT_RX_PACKETS       1       /* 4: packets received */
+#define BRIDGE_CNT_RX_DROPPED       5       /* 2: packets lost, queue full */
+#define BRIDGE_CNT_TX_PACKETS       7       /* 4: packets sent and acknowledged */
+#define BRIDGE_CNT_TX_FAILED        11      /* 2: packets without ACK */
+#define BRIDGE_CNT_TX_BUSY          13      /* 2: output reports stalled, queue full */
+#define BRIDGE_CNT_QUEUE_PEAK       15      /* 2: highest fill level of a pipe queue */
+#define BRIDGE_CNT_PIPE_DROPPED     17      /* 6 x 2: packets lost per pipe */
+#define BRIDGE_CNT_RAM_STATIC       29      /* 2: bytes of static variables */
+#define BRIDGE_CNT_STACK_UNUSED     31      /* 2: RAM never reached by the stack */
+#define BRIDGE_COUNTERS_SIZE        33
+
+#endif /* BRIDGE_DEFS_H_ */
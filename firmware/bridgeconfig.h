@@ -0,0 +1,83 @@
+/* Name: bridgeconfig.h
+ * Project: usbXR USB-to-RF bridge
+ * Tabsize: 4
+ *
+ * For: usbXR project: https://github.com/visakhanc/usbXR
+ */
+
+#ifndef __bridgeconfig_h_included__
+#define __bridgeconfig_h_included__
+
+/*
+General Description:
+This file (together with some settings in Makefile) configures the bridge
+application according to the hardware and sets the size of its buffers. It
+is included by usbconfig.h, so the hardware settings live in one file as in
+the boot loader.
+*/
+
+/* ---------------------------- Hardware Config ---------------------------- */
+
+#define USB_CFG_IOPORTNAME      D
+/* This is the port where the USB bus is connected. When you configure it to
+ * "B", the registers PORTB, PINB and DDRB will be used.
+ */
+#define USB_CFG_DMINUS_BIT      4
+/* This is the bit number in USB_CFG_IOPORT where the USB D- line is connected.
+ * This may be any bit in the port.
+ */
+#define USB_CFG_DPLUS_BIT       2
+/* This is the bit number in USB_CFG_IOPORT where the USB D+ line is connected.
+ * D+ must also be connected to interrupt pin INT0.
+ */
+#define USB_CFG_CLOCK_KHZ       (F_CPU/1000)
+/* Clock rate of the AVR in kHz, usbXR runs from a 12 MHz crystal. */
+
+/* --------------------------- Functional Range ---------------------------- */
+
+#define BRIDGE_POLL_INTERVAL    1
+/* Poll interval of the interrupt-in endpoint in milliseconds. Every poll
+ * carries at most 8 bytes at low speed, so this sets the RF-to-host
+ * bandwidth: 8 kB/s at 1 ms. The USB specification asks for at least 10 ms
+ * on low speed devices, Linux polls at the requested rate anyway. Hosts which
+ * enforce the limit still work, at a tenth of the rate.
+ */
+
+#define BRIDGE_PIPES            6
+/* Number of RX pipes in use (1..6). Pipe 0 has CONFIG_RF24_ADDRESS, shared
+ * with the boot loader, the others the addresses below. Give each remote its
+ * own pipe address, so their packets don't collide and each can get its own
+ * ACK payload.
+ */
+#define BRIDGE_PIPE1_ADDRESS    {0xC1, 0xC2, 0xC2, 0xC2, 0xC2}
+#define BRIDGE_PIPE_LSB         {0xC3, 0xC4, 0xC5, 0xC6}
+/* Address of pipe 1 (first byte sent first, CONFIG_RF24_ADDR_LEN bytes) and
+ * the first byte of pipes 2..5, which share the remaining bytes of pipe 1.
+ */
+
+#define BRIDGE_PIPE_QUEUE_SIZE  128
+/* Bytes of the receive queue of each pipe (power of 2, at most 256). Each RF
+ * packet takes its length plus one byte. Packets which don't fit are dropped
+ * and counted per pipe, so a busy remote cannot crowd out the others.
+ */
+
+#define BRIDGE_TX_QUEUE         4
+/* Number of host-to-RF packets which can wait for transmission. Output
+ * reports arriving while the queue is full are answered with STALL so that
+ * the host's write() fails and can be repeated, nothing is lost silently.
+ */
+
+#define BRIDGE_CAPTURE_IRQ      0
+/* Set to 1 if the IRQ pin of the radio is connected to INT1. Captured packets
+ * are then timestamped in the interrupt, when the radio signals reception,
+ * otherwise when the main loop reads them (up to one loop iteration later).
+ * The boot loader and the rest of the bridge don't use the IRQ pin.
+ */
+
+/* ------------------------------------------------------------------------- */
+
+#ifndef __ASSEMBLER__
+#include "board.h"
+#endif
+
+#endif /* __bridgeconfig_h_included__ */
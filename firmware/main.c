@@ -0,0 +1,658 @@
+/* Name: main.c
+ * Project: usbXR USB-to-RF bridge
+ * Tabsize: 4
+ *
+ * For: usbXR project: https://github.com/visakhanc/usbXR
+ */
+
+/*
+General Description:
+Reference application which turns usbXR into a data gateway between the host
+and remote nodes. Up to six remotes are received on their own RX pipes, their
+packets are collected in per-pipe queues and streamed to the host through the
+interrupt-in endpoint, several packets per report. Each pipe can have an ACK
+payload set by the host. The host sends RF packets with output reports, which are queued and
+passed to the TX FIFO of the radio (rf24_txq.c) from the main loop. Report
+formats are in bridge_defs.h.
+
+Timer 1 runs freely at F_CPU / 64 and timestamps the transmitted packets, so
+the host can tell the air time of a packet from the time spent on USB.
+
+In capture mode (report 5) the radio listens passively on a given channel
+and address (rf24_capture.c) and every packet is passed to the host raw, with
+its timestamp, for usbxr-capture. Switching modes waits until the transmit
+queue is empty and drops the queued records.
+
+Everything runs in the main loop (usbPoll() calls the USB functions below), so
+the buffers and counters need no locking.
+*/
+
+#include <stdbool.h>
+#include <string.h>  /* memcpy() */
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+#include <avr/pgmspace.h>
+#include <util/delay.h>
+#include "rf24.h"
+#include "rf24_config.h"
+#include "rf24_txq.h"
+#include "rf24_pipes.h"
+#include "rf24_capture.h"
+#include "stack_paint.h"
+#include "bootloader_entry.h"
+#include "usbdrv.h"
+#include "bridge_defs.h"
+
+
+
+
+/******************** MACROS AND DEFINITIONS **********************/
+
+#if (BRIDGE_PIPE_QUEUE_SIZE & (BRIDGE_PIPE_QUEUE_SIZE - 1)) != 0 || BRIDGE_PIPE_QUEUE_SIZE > 256
+#   error "BRIDGE_PIPE_QUEUE_SIZE must be a power of 2 up to 256"
+#endif
+
+#if F_CPU / 64 != BRIDGE_TICK_HZ
+#   error "BRIDGE_TICK_HZ does not match F_CPU"
+#endif
+
+#define RX_BURST	3	/* RX FIFO depth of the radio */
+#define QUEUE_MASK	(BRIDGE_PIPE_QUEUE_SIZE - 1)
+#define QUEUES		(BRIDGE_PIPES + 1)	/* the last one holds events */
+#define TIMING_MASK	3	/* txTiming[] index, covers RF24_TXQ_DEPTH packets */
+
+typedef struct {
+	uint8_t	len;
+	uint8_t	seq;
+	bool	event;		/* report the result to the host */
+	uint8_t	data[BRIDGE_MAX_PAYLOAD];
+} txPacket_t;
+
+/* Packet in the TX FIFO of the radio */
+typedef struct {
+	uint16_t	start;	/* timer when it was loaded */
+	bool		queued;	/* loaded behind another packet */
+	bool		event;
+} txTiming_t;
+
+/* Receive queue of one pipe, holds [header, payload] records */
+typedef struct {
+	uint8_t	data[BRIDGE_PIPE_QUEUE_SIZE];
+	uint8_t	head;		/* next byte to write */
+	uint8_t	tail;		/* next byte to send */
+	uint16_t	used;
+} rxQueue_t;
+
+enum {ACK_NONE = 0, ACK_PENDING, ACK_LOADED};  /* ACK payload state of a pipe */
+
+/* Report 3, layout as the BRIDGE_CNT_* offsets (struct is packed) */
+typedef struct {
+	uint8_t		reportId;
+	uint32_t	rxPackets;
+	uint16_t	rxDropped;
+	uint32_t	txPackets;
+	uint16_t	txFailed;
+	uint16_t	txBusy;
+	uint16_t	queuePeak;
+	uint16_t	pipeDropped[RF24_PIPES];
+	uint16_t	ramStatic;
+	uint16_t	stackUnused;
+} counters_t;
+
+
+
+
+/********************** GLOBAL VARIABLES **************************/
+
+static rxQueue_t	rxQueue[QUEUES];
+static uint8_t		nextPipe;	/* queue served first in the next report */
+
+static uint8_t		inReport[BRIDGE_IN_REPORT_SIZE] = {BRIDGE_REPORT_DATA};
+static uint8_t		inLen;		/* bytes of the current report */
+static uint8_t		inSent;		/* bytes passed to usbSetInterrupt() */
+
+static txPacket_t	txQueue[BRIDGE_TX_QUEUE];
+static uint8_t		txHead;
+static uint8_t		txCount;
+static uint8_t		outReport[3 + BRIDGE_MAX_PAYLOAD];
+static uint8_t		outOffset;
+static usbMsgLen_t	outRemaining;
+static bool			outStall;
+static bool			radioTx;	/* radio in PTX mode for host packets */
+static uint8_t		txSeq;		/* sequence number of the next packet */
+static txTiming_t	txTiming[TIMING_MASK + 1];
+static uint16_t		lastDone;	/* timer when the last packet finished */
+
+static txPacket_t	ackPayload[BRIDGE_PIPES];
+static uint8_t		ackState[BRIDGE_PIPES];
+static uint8_t		acksLoaded;	/* ACK payloads in the TX FIFO */
+
+static uint8_t		capture[BRIDGE_CAPTURE_SIZE] = {BRIDGE_REPORT_CAPTURE};
+static bool			capturing;
+static bool			captureChanged;	/* report 5 received, apply in main loop */
+static bool			bootRequested;	/* report 6 received ... */
+static uint16_t		bootTime;		/* ... at this timer value */
+#if BRIDGE_CAPTURE_IRQ
+static volatile uint8_t		stampHead;
+static uint8_t		stampTail;
+static volatile uint16_t	stamps[4];	/* TCNT1 at INT1, >= RX FIFO depth */
+#endif
+
+static counters_t	counters = {.reportId = BRIDGE_REPORT_COUNTERS};
+static uint8_t 		rxBuf[2 + RF24_CAPTURE_SIZE];	/* room for a capture record */
+static uint8_t 		addr[CONFIG_RF24_ADDR_LEN] = CONFIG_RF24_ADDRESS;
+#if BRIDGE_PIPES > 1
+static const uint8_t	pipe1Addr[CONFIG_RF24_ADDR_LEN] = BRIDGE_PIPE1_ADDRESS;
+static const uint8_t	pipeLsb[4] = BRIDGE_PIPE_LSB;
+#endif
+
+
+
+const PROGMEM char usbHidReportDescriptor[USB_CFG_HID_REPORT_DESCRIPTOR_LENGTH] = {
+    0x06, 0x00, 0xff,              // USAGE_PAGE (Vendor defined)
+    0x09, 0x01,                    // USAGE (Vendor Usage 1)
+    0xa1, 0x01,                    // COLLECTION (Application)
+    0x15, 0x00,                    //   LOGICAL_MINIMUM (0)
+    0x26, 0xff, 0x00,              //   LOGICAL_MAXIMUM (255)
+    0x75, 0x08,                    //   REPORT_SIZE (8)
+
+    0x85, BRIDGE_REPORT_DATA,      //   REPORT_ID (1)
+    0x95, BRIDGE_IN_REPORT_SIZE - 1, //   REPORT_COUNT (63)
+    0x09, 0x00,                    //   USAGE (Undefined)
+    0x81, 0x02,                    //   INPUT (Data,Var,Abs)
+
+    0x85, BRIDGE_REPORT_SEND,      //   REPORT_ID (2)
+    0x95, 1 + BRIDGE_MAX_PAYLOAD,  //   REPORT_COUNT (33)
+    0x09, 0x00,                    //   USAGE (Undefined)
+    0x91, 0x02,                    //   OUTPUT (Data,Var,Abs)
+
+    0x85, BRIDGE_REPORT_COUNTERS,  //   REPORT_ID (3)
+    0x95, BRIDGE_COUNTERS_SIZE - 1, //   REPORT_COUNT (32)
+    0x09, 0x00,                    //   USAGE (Undefined)
+    0xb2, 0x02, 0x01,              //   FEATURE (Data,Var,Abs,Buf)
+
+    0x85, BRIDGE_REPORT_ACK,       //   REPORT_ID (4)
+    0x95, 2 + BRIDGE_MAX_PAYLOAD,  //   REPORT_COUNT (34)
+    0x09, 0x00,                    //   USAGE (Undefined)
+    0x91, 0x02,                    //   OUTPUT (Data,Var,Abs)
+
+    0x85, BRIDGE_REPORT_CAPTURE,   //   REPORT_ID (5)
+    0x95, BRIDGE_CAPTURE_SIZE - 1, //   REPORT_COUNT (8)
+    0x09, 0x00,                    //   USAGE (Undefined)
+    0xb2, 0x02, 0x01,              //   FEATURE (Data,Var,Abs,Buf)
+
+    0x85, BRIDGE_REPORT_BOOT,      //   REPORT_ID (6)
+    0x95, BRIDGE_BOOT_SIZE - 1,    //   REPORT_COUNT (2)
+    0x09, 0x00,                    //   USAGE (Undefined)
+    0xb2, 0x02, 0x01,              //   FEATURE (Data,Var,Abs,Buf)
+
+    0xc0                           // END_COLLECTION
+};
+
+
+
+
+/******************** FUNCTION DECLARATIONS  **********************/
+
+usbMsgLen_t   usbFunctionSetup(uint8_t data[8])
+{
+usbRequest_t    *rq = (void *)data;
+
+    if(USBRQ_HID_SET_REPORT == rq->bRequest) {
+		if(rq->wValue.bytes[0] == BRIDGE_REPORT_SEND || rq->wValue.bytes[0] == BRIDGE_REPORT_ACK
+				|| rq->wValue.bytes[0] == BRIDGE_REPORT_CAPTURE || rq->wValue.bytes[0] == BRIDGE_REPORT_BOOT) {
+			outOffset = 0;
+			outRemaining = rq->wLength.word;
+			outStall = (rq->wValue.bytes[0] == BRIDGE_REPORT_SEND && (txCount == BRIDGE_TX_QUEUE || capturing));
+			if(outStall) {
+				counters.txBusy++;
+			}
+			return USB_NO_MSG;  /* Process the packet in usbFunctionWrite() */
+		}
+		else if(rq->wValue.bytes[0] == BRIDGE_REPORT_COUNTERS) {
+			memset((uint8_t *)&counters + 1, 0, sizeof(counters) - 1);
+		}
+    }
+	else if(rq->bRequest == USBRQ_HID_GET_REPORT) {
+		if(rq->wValue.bytes[0] == BRIDGE_REPORT_COUNTERS) {
+			counters.ramStatic = stack_static();
+			counters.stackUnused = stack_unused();
+			usbMsgPtr = (usbMsgPtr_t)&counters;
+			return sizeof(counters);
+		}
+		else if(rq->wValue.bytes[0] == BRIDGE_REPORT_CAPTURE) {
+			usbMsgPtr = (usbMsgPtr_t)capture;
+			return sizeof(capture);
+		}
+    }
+    return 0;
+}
+
+
+
+/* Stores the ACK payload of report 4. A payload already in the TX FIFO can't
+ * be replaced alone, so the FIFO is flushed and all of them are loaded again.
+ */
+static void setAckPayload(uint8_t pipe, uint8_t len, const uint8_t *data)
+{
+uint8_t	i;
+
+	if(pipe >= BRIDGE_PIPES) {
+		return;
+	}
+	if(ACK_LOADED == ackState[pipe]) {
+		rf24_flush_txfifo();
+		for(i = 0; i < BRIDGE_PIPES; i++) {
+			if(ACK_LOADED == ackState[i]) {
+				ackState[i] = ACK_PENDING;
+			}
+		}
+		acksLoaded = 0;
+	}
+	ackPayload[pipe].len = len;
+	memcpy(ackPayload[pipe].data, data, len);
+	ackState[pipe] = ACK_PENDING;
+}
+
+
+
+uint8_t usbFunctionWrite(uint8_t *data, uint8_t len)
+{
+txPacket_t	*pkt;
+
+	if(outStall) {
+		return 0xff;  /* STALL, the host repeats the report */
+	}
+	while(len-- && outRemaining) {
+		outRemaining--;
+		if(outOffset < sizeof(outReport)) {
+			outReport[outOffset++] = *data;
+		}
+		data++;
+	}
+	if(outRemaining) {
+		return 0;
+	}
+	if(BRIDGE_REPORT_ACK == outReport[0]) {  /* [4, pipe, length, payload] */
+		if(outReport[2] > 0 && outReport[2] <= BRIDGE_MAX_PAYLOAD && outOffset >= 3 + outReport[2]) {
+			setAckPayload(outReport[1], outReport[2], &outReport[3]);
+		}
+	}
+	else if(BRIDGE_REPORT_CAPTURE == outReport[0]) {  /* [5, mode, channel, width, address] */
+		if(outOffset >= BRIDGE_CAPTURE_SIZE && outReport[1] <= 1 && outReport[2] < 128
+				&& outReport[3] >= 2 && outReport[3] <= 5) {
+			memcpy(capture, outReport, BRIDGE_CAPTURE_SIZE);
+			captureChanged = true;
+		}
+	}
+	else if(BRIDGE_REPORT_BOOT == outReport[0]) {  /* [6, key] */
+		if(outOffset >= BRIDGE_BOOT_SIZE && (outReport[1] | (outReport[2] << 8)) == BRIDGE_BOOT_KEY) {
+			bootRequested = true;
+			bootTime = TCNT1;
+		}
+	}
+	/* [2, length, payload] */
+	else {
+		len = outReport[1] & ~BRIDGE_SEND_EVENT;
+		if(len > 0 && len <= BRIDGE_MAX_PAYLOAD && outOffset >= 2 + len) {
+			pkt = &txQueue[(txHead + txCount) % BRIDGE_TX_QUEUE];
+			pkt->len = len;
+			pkt->seq = txSeq++;
+			pkt->event = (outReport[1] & BRIDGE_SEND_EVENT) != 0;
+			memcpy(pkt->data, &outReport[2], len);
+			txCount++;
+		}
+	}
+	return 1;
+}
+
+
+
+/* Appends the record [header, data] to queue 'q'. Returns false if it is
+ * full.
+ */
+static bool queuePut(rxQueue_t *q, uint8_t header, const uint8_t *data, uint8_t len)
+{
+uint8_t	i;
+
+	if(BRIDGE_PIPE_QUEUE_SIZE - q->used < len + 1) {
+		return false;
+	}
+	q->data[q->head] = header;
+	q->head = (q->head + 1) & QUEUE_MASK;
+	for(i = 0; i < len; i++) {
+		q->data[q->head] = data[i];
+		q->head = (q->head + 1) & QUEUE_MASK;
+	}
+	q->used += len + 1;
+	if(q->used > counters.queuePeak) {
+		counters.queuePeak = q->used;
+	}
+	return true;
+}
+
+
+
+#if BRIDGE_CAPTURE_IRQ
+ISR(INT1_vect, ISR_NOBLOCK)  /* radio IRQ, must not delay the USB interrupt */
+{
+	stamps[stampHead & 3] = TCNT1;
+	stampHead++;
+}
+#endif
+
+
+
+/* Moves captured packets into the queue of pipe 0 as capture records. The
+ * radio raises IRQ once while RX_DR is set, so packets which arrived together
+ * share one interrupt; all but the first are stamped when read.
+ */
+static void capturePackets(void)
+{
+uint8_t		i, len;
+uint16_t	stamp;
+
+	for(i = 0; i < RX_BURST; i++) {
+		stamp = TCNT1;
+		len = rf24_capture_receive(&rxBuf[2]);
+		if(0 == len) {
+			break;
+		}
+#if BRIDGE_CAPTURE_IRQ
+		if(stampTail != stampHead) {
+			stamp = stamps[stampTail & 3];
+			stampTail++;
+		}
+#endif
+		LED_TOGGLE();
+		counters.rxPackets++;
+		if(len > BRIDGE_CAPTURE_RAW) {
+			len = BRIDGE_CAPTURE_RAW;
+		}
+		rxBuf[0] = stamp & 0xff;
+		rxBuf[1] = stamp >> 8;
+		if(!queuePut(&rxQueue[0], BRIDGE_RECORD(BRIDGE_PIPE_CAPTURE, len + 2), rxBuf, len + 2)) {
+			counters.rxDropped++;
+			counters.pipeDropped[0]++;
+		}
+	}
+}
+
+
+
+/* Moves up to RX_BURST packets from the radio into the queue of their pipe
+ * and notes which ACK payloads went out with them.
+ */
+static void receivePackets(void)
+{
+uint8_t		i, len, pipe;
+
+	if(capturing) {
+		capturePackets();
+		return;
+	}
+	for(i = 0; i < RX_BURST; i++) {
+		pipe = rf24_pipes_receive(rxBuf, &len);
+		if(RF24_PIPE_NONE == pipe) {
+			break;
+		}
+		LED_TOGGLE();
+		counters.rxPackets++;
+		if(!radioTx && ACK_LOADED == ackState[pipe]) {  /* went out with the ACK */
+			ackState[pipe] = ACK_NONE;
+			acksLoaded--;
+		}
+		if(!queuePut(&rxQueue[pipe], BRIDGE_RECORD(pipe, len), rxBuf, len)) {
+			counters.rxDropped++;
+			counters.pipeDropped[pipe]++;
+		}
+	}
+}
+
+
+
+/* Loads pending ACK payloads into the TX FIFO while the radio is in PRX mode */
+static void loadAckPayloads(void)
+{
+uint8_t	i;
+
+	for(i = 0; i < BRIDGE_PIPES && acksLoaded < RF24_TX_FIFO; i++) {
+		if(ACK_PENDING == ackState[i]) {
+			rf24_set_ack_payload(i, ackPayload[i].data, ackPayload[i].len);
+			ackState[i] = ACK_LOADED;
+			acksLoaded++;
+		}
+	}
+}
+
+
+
+/* Copies whole records into inReport, taking one record per queue in turn so
+ * that a busy pipe cannot delay the others. Returns the report length.
+ */
+static uint8_t fillReport(void)
+{
+rxQueue_t	*q;
+uint8_t		n = 2, i, k, rec, progress;
+
+	do {
+		progress = 0;
+		for(k = 0; k < QUEUES; k++) {
+			q = &rxQueue[nextPipe];
+			nextPipe = (nextPipe + 1) % QUEUES;
+			if(0 == q->used) {
+				continue;
+			}
+			rec = BRIDGE_RECORD_LEN(q->data[q->tail]) + 1;
+			if(n + rec > BRIDGE_IN_REPORT_SIZE) {
+				continue;
+			}
+			for(i = 0; i < rec; i++) {
+				inReport[n++] = q->data[q->tail];
+				q->tail = (q->tail + 1) & QUEUE_MASK;
+			}
+			q->used -= rec;
+			progress = 1;
+		}
+	} while(progress);
+	return n;
+}
+
+
+
+/* Passes the next 8 bytes of the current input report to the driver. A new
+ * report takes as many records as fit. A report shorter than
+ * BRIDGE_IN_REPORT_SIZE must end with a short packet, so it is padded by one
+ * byte if its length is a multiple of 8.
+ */
+static void sendInput(void)
+{
+uint8_t	n;
+
+	if(inSent == inLen) {
+		inLen = fillReport();
+		if(2 == inLen) {
+			inLen = 0;
+			return;
+		}
+		inReport[1] = inLen - 2;
+		if(0 == (inLen & 7) && inLen < BRIDGE_IN_REPORT_SIZE) {
+			inReport[inLen++] = 0;
+		}
+		inSent = 0;
+	}
+	n = inLen - inSent;
+	if(n > 8) {
+		n = 8;
+	}
+	usbSetInterrupt(&inReport[inSent], n);
+	inSent += n;
+}
+
+
+
+/* Counts the result of a finished packet and queues its event record. A
+ * packet loaded behind another one starts when that one finishes.
+ */
+static void packetDone(uint8_t seq, uint8_t status)
+{
+txTiming_t	*t = &txTiming[seq & TIMING_MASK];
+uint16_t	now = TCNT1, air;
+uint8_t		event[BRIDGE_EVENT_TX_SIZE];
+
+	if(RF24_TXQ_OK == status) {
+		counters.txPackets++;
+	}
+	else {
+		counters.txFailed++;
+	}
+	air = now - (t->queued ? lastDone : t->start);
+	lastDone = now;
+	if(t->event) {
+		event[0] = BRIDGE_EVENT_TX;
+		event[1] = seq;
+		event[2] = status;
+		event[3] = air & 0xff;
+		event[4] = air >> 8;
+		if(!queuePut(&rxQueue[BRIDGE_PIPES], BRIDGE_RECORD(BRIDGE_PIPE_EVENT, sizeof(event)), event, sizeof(event))) {
+			counters.rxDropped++;
+		}
+	}
+}
+
+
+
+/* Moves queued host packets into the TX FIFO of the radio, so it sends them
+ * back to back, and counts the results. The radio returns to PRX mode when
+ * all packets are out. Switching to PTX flushes the loaded ACK payloads, they
+ * are loaded again afterwards.
+ */
+static void transmitPackets(void)
+{
+txPacket_t	*pkt;
+txTiming_t	*t;
+uint8_t		tag, status, i, queued;
+
+	while(rf24_txq_poll(&tag, &status)) {
+		packetDone(tag, status);
+	}
+	while(txCount) {
+		pkt = &txQueue[txHead];
+		if(!radioTx) {
+			for(i = 0; i < BRIDGE_PIPES; i++) {
+				if(ACK_LOADED == ackState[i]) {
+					ackState[i] = ACK_PENDING;
+				}
+			}
+			acksLoaded = 0;
+			radioTx = true;
+		}
+		queued = rf24_txq_count();
+		if(rf24_txq_put(pkt->data, pkt->len, pkt->seq)) {
+			break;  /* FIFO full */
+		}
+		t = &txTiming[pkt->seq & TIMING_MASK];
+		t->start = TCNT1;
+		t->queued = (queued != 0);
+		t->event = pkt->event;
+		txHead = (txHead + 1) % BRIDGE_TX_QUEUE;
+		txCount--;
+	}
+	if(radioTx && 0 == rf24_txq_count()) {
+		rf24_txq_rx_mode();
+		radioTx = false;
+	}
+	if(!radioTx && !capturing) {
+		loadAckPayloads();
+	}
+}
+
+
+
+/* Switches between normal operation and capture mode as set by report 5,
+ * once all host packets are out. Records of the old mode are dropped.
+ */
+static void applyCapture(void)
+{
+uint8_t	i;
+
+	if(!captureChanged || txCount || radioTx) {
+		return;
+	}
+	captureChanged = false;
+	memset(rxQueue, 0, sizeof(rxQueue));
+	capturing = (capture[1] != 0);
+	if(capturing) {
+		rf24_capture_start(capture[2], &capture[4], capture[3]);
+#if BRIDGE_CAPTURE_IRQ
+		stampTail = stampHead;
+		EICRA |= (1 << ISC11);  /* falling edge */
+		EIFR = (1 << INTF1);
+		EIMSK |= (1 << INT1);
+#endif
+	}
+	else {
+#if BRIDGE_CAPTURE_IRQ
+		EIMSK &= ~(1 << INT1);
+#endif
+		rf24_init(RF24_MODE_PRX, addr);
+#if BRIDGE_PIPES > 1
+		rf24_pipes_init(pipe1Addr, pipeLsb, BRIDGE_PIPES);
+#endif
+		for(i = 0; i < BRIDGE_PIPES; i++) {  /* rf24_init() flushed the TX FIFO */
+			if(ACK_LOADED == ackState[i]) {
+				ackState[i] = ACK_PENDING;
+			}
+		}
+		acksLoaded = 0;
+	}
+}
+
+
+
+static void initForUsbConnectivity(void)
+{
+uint8_t   i = 0;
+
+    usbInit();
+    /* enforce USB re-enumerate: */
+    usbDeviceDisconnect();  /* do this while interrupts are disabled */
+    do{             /* fake USB disconnect for > 250 ms */
+        _delay_ms(1);
+    } while(--i);
+    usbDeviceConnect();
+    sei();
+}
+
+
+
+int main(void)
+{
+	MCUSR = 0;
+	wdt_disable();
+	LED_INIT();
+	LED_OFF();
+	TCCR1B = (1 << CS11) | (1 << CS10);  /* timer 1 free running, F_CPU / 64 */
+	initForUsbConnectivity();
+	if(0 != rf24_init(RF24_MODE_PRX, addr)) {
+		LED_ON();  /* no radio */
+	}
+#if BRIDGE_PIPES > 1
+	rf24_pipes_init(pipe1Addr, pipeLsb, BRIDGE_PIPES);
+#endif
+
+	while(1) {  /* main event loop */
+		usbPoll();
+		receivePackets();
+		transmitPackets();
+		applyCapture();
+		if(usbInterruptIsReady()) {
+			sendInput();
+		}
+		/* after the status stage of report 6 */
+		if(bootRequested && (uint16_t)(TCNT1 - bootTime) > BRIDGE_TICK_HZ / 50) {
+			bootloader_enter();
+		}
+	}
+}